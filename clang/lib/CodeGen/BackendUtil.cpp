@@ -1007,11 +1007,14 @@ void EmitAssemblyHelper::RunOptimizationPipeline(
           [Options](ModulePassManager &MPM, OptimizationLevel Level) {
             MPM.addPass(GCOVProfilerPass(*Options));
           });
-    if (Optional<InstrProfOptions> Options =
-            getInstrProfOptions(CodeGenOpts, LangOpts))
+    // Cheerp lowers the profile counters at link time, once it is known if
+    // they should live in linear memory or in genericjs
+    Optional<InstrProfOptions> InstrProfOpts =
+        getInstrProfOptions(CodeGenOpts, LangOpts);
+    if (InstrProfOpts && TargetTriple.getArch() != llvm::Triple::cheerp)
       PB.registerPipelineStartEPCallback(
-          [Options](ModulePassManager &MPM, OptimizationLevel Level) {
-            MPM.addPass(InstrProfiling(*Options, false));
+          [InstrProfOpts](ModulePassManager &MPM, OptimizationLevel Level) {
+            MPM.addPass(InstrProfiling(*InstrProfOpts, false));
           });
 
     if (CodeGenOpts.OptimizationLevel == 0) {
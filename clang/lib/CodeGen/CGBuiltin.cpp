@@ -12506,6 +12506,20 @@ Value *CodeGenFunction::EmitCheerpBuiltinExpr(unsigned BuiltinID,
     Function *F = CGM.getIntrinsic(Intrinsic::cheerp_grow_memory);
     return Builder.CreateCall(F, Ops);
   }
+  else if (BuiltinID == Cheerp::BI__builtin_cheerp_externref_table_alloc) {
+    llvm::Type *Tys[] = { Ops[0]->getType() };
+    Function *F = CGM.getIntrinsic(Intrinsic::cheerp_externref_table_alloc, Tys);
+    return Builder.CreateCall(F, Ops);
+  }
+  else if (BuiltinID == Cheerp::BI__builtin_cheerp_externref_table_free) {
+    Function *F = CGM.getIntrinsic(Intrinsic::cheerp_externref_table_free);
+    return Builder.CreateCall(F, Ops);
+  }
+  else if (BuiltinID == Cheerp::BI__builtin_cheerp_externref_table_get) {
+    llvm::Type *Tys[] = { ConvertType(E->getType()) };
+    Function *F = CGM.getIntrinsic(Intrinsic::cheerp_externref_table_get, Tys);
+    return Builder.CreateCall(F, Ops);
+  }
   else if (BuiltinID == Cheerp::BI__builtin_cheerp_stack_save) {
     Function *F = CGM.getIntrinsic(Intrinsic::stacksave);
     return Builder.CreateCall(F, Ops);
@@ -4080,7 +4080,15 @@ void Driver::BuildActions(Compilation &C, DerivedArgList &Args,
 
   if (!LinkerInputs.empty()) {
     // Cheerp: We need an additional step for to generated JS
-    if (C.getDefaultToolChain().getArch() == llvm::Triple::cheerp)
+    if (C.getDefaultToolChain().getArch() == llvm::Triple::cheerp &&
+        Args.hasArg(options::OPT_cheerp_fused_pipeline))
+    {
+      // Link, optimize and generate the JS in a single step, stopping after
+      // the optimizations if we only want the final bc file
+      types::ID outputType = Args.hasArg(options::OPT_cheerp_dump_bc) ? types::TY_LLVM_BC : types::TY_Image;
+      Actions.push_back(C.MakeAction<CheerpCompileJobAction>(LinkerInputs, outputType));
+    }
+    else if (C.getDefaultToolChain().getArch() == llvm::Triple::cheerp)
     {
       // First link the whole program
       Action* linkJob = C.MakeAction<LinkJobAction>(LinkerInputs, types::TY_LLVM_BC);
@@ -543,51 +543,67 @@ void WebAssembly::addLibStdCXXIncludePaths(
   addSystemInclude(DriverArgs, CC1Args, LibPath + "/c++/" + Version + "/backward");
 }
 
-void cheerp::Link::ConstructJob(Compilation &C, const JobAction &JA,
-                                const InputInfo &Output,
-                                const InputInfoList &Inputs,
-                                const ArgList &Args,
-                                const char *LinkingOutput) const {
-  ArgStringList CmdArgs;
-
-  CmdArgs.push_back("-o");
-  CmdArgs.push_back(Output.getFilename());
-
+// Add the inputs and libraries of the whole program link. With the fused
+// pipeline llc links them itself: the first input is the module being
+// compiled, and everything else is linked into it before optimizing.
+static void addCheerpLinkArgs(Compilation &C, const ToolChain &TC,
+                              const InputInfoList &Inputs,
+                              const ArgList &Args,
+                              ArgStringList &CmdArgs, bool fused) {
+  bool firstInput = true;
   for (InputInfoList::const_iterator
          it = Inputs.begin(), ie = Inputs.end(); it != ie; ++it) {
     const InputInfo &II = *it;
-    if(II.isFilename())
+    if(!II.isFilename())
+      continue;
+    if (fused && !firstInput)
+      CmdArgs.push_back(Args.MakeArgString(Twine("-cheerp-link-input=") + II.getFilename()));
+    else
       CmdArgs.push_back(II.getFilename());
+    firstInput = false;
   }
 
-  const Driver &D = getToolChain().getDriver();
+  const Driver &D = TC.getDriver();
   bool hasUnalignedMemory = true;
-  auto features = getWasmFeatures(D, Args);
-  if(std::find(features.begin(), features.end(), UNALIGNEDMEM) == features.end())
+  auto features = cheerp::getWasmFeatures(D, Args);
+  if(std::find(features.begin(), features.end(), cheerp::UNALIGNEDMEM) == features.end())
     hasUnalignedMemory = false;
 
+  // With lazy linking the libraries only provide the definitions reachable
+  // from the inputs. The linker itself keeps the runtime functions which the
+  // Cheerp passes and the optimizer may introduce calls to
+  bool lazyLinking = Args.hasArg(options::OPT_cheerp_lazy_linking);
+  auto addLibrary = [&](const std::string& path) {
+    if (lazyLinking)
+      CmdArgs.push_back(Args.MakeArgString((fused ? "-cheerp-lazy-library=" : "-lazy-library=") + path));
+    else if (fused)
+      CmdArgs.push_back(Args.MakeArgString("-cheerp-link-input=" + path));
+    else
+      CmdArgs.push_back(Args.MakeArgString(path));
+  };
+
   // Add standard libraries
   if (!Args.hasArg(options::OPT_nostdlib) &&
       !Args.hasArg(options::OPT_nodefaultlibs)) {
     if (C.getDriver().CCCIsCXX()) {
-      CmdArgs.push_back(Args.MakeArgString(getToolChain().GetFilePath("libstdlibs.bc")));
+      addLibrary(TC.GetFilePath("libstdlibs.bc"));
     } else {
-      CmdArgs.push_back(Args.MakeArgString(getToolChain().GetFilePath("libc.bc")));
-      CmdArgs.push_back(Args.MakeArgString(getToolChain().GetFilePath("crt1.bc")));
+      addLibrary(TC.GetFilePath("libc.bc"));
+      addLibrary(TC.GetFilePath("crt1.bc"));
     }
-    if (getToolChain().getTriple().getOS() == llvm::Triple::WASI)
-      CmdArgs.push_back(Args.MakeArgString(getToolChain().GetFilePath("libwasi.bc")));
+    if (TC.getTriple().getOS() == llvm::Triple::WASI)
+      addLibrary(TC.GetFilePath("libwasi.bc"));
     else
-      CmdArgs.push_back(Args.MakeArgString(getToolChain().GetFilePath("libsystem.bc")));
+      addLibrary(TC.GetFilePath("libsystem.bc"));
 
     // Add wasm helper if needed
     Arg *CheerpLinearOutput = Args.getLastArg(options::OPT_cheerp_linear_output_EQ);
-    llvm::Triple::EnvironmentType env = getToolChain().getTriple().getEnvironment();
+    llvm::Triple::EnvironmentType env = TC.getTriple().getEnvironment();
     if(((CheerpLinearOutput && CheerpLinearOutput->getValue() == StringRef("wasm")) ||
        (!CheerpLinearOutput && env == llvm::Triple::WebAssembly)) &&
 	hasUnalignedMemory)
     {
-      CmdArgs.push_back(Args.MakeArgString(getToolChain().GetFilePath("libwasm.bc")));
+      addLibrary(TC.GetFilePath("libwasm.bc"));
     }
   }
  
@@ -597,31 +613,26 @@ void cheerp::Link::ConstructJob(Compilation &C, const JobAction &JA,
     std::string libName("lib");
     libName += it->getValue();
     std::string bcLibName = libName + ".bc";
-    std::string foundLib = getToolChain().GetFilePath(bcLibName.c_str());
+    std::string foundLib = TC.GetFilePath(bcLibName.c_str());
     if (foundLib == bcLibName) {
       // Try again using .a, the internal format is still assumed to be BC
       std::string aLibName = libName + ".a";
-      foundLib = getToolChain().GetFilePath(aLibName.c_str());
+      foundLib = TC.GetFilePath(aLibName.c_str());
       if(foundLib == aLibName)
         foundLib = bcLibName;
     }
     if (usedLibs.count(foundLib))
       continue;
     usedLibs.insert(foundLib);
-    CmdArgs.push_back(Args.MakeArgString(foundLib));
+    addLibrary(foundLib);
   }
-
-  const char *Exec = Args.MakeArgString((getToolChain().GetProgramPath("llvm-link")));
-  C.addCommand(std::make_unique<Command>(JA, *this, ResponseFileSupport::None(), Exec, CmdArgs, Inputs));
 }
 
-void cheerp::CheerpOptimizer::ConstructJob(Compilation &C, const JobAction &JA,
-                                          const InputInfo &Output,
-                                          const InputInfoList &Inputs,
-                                          const ArgList &Args,
-                                          const char *LinkingOutput) const {
-  ArgStringList CmdArgs;
-  const Driver &D = getToolChain().getDriver();
+// Add the link time optimization pipeline. With the fused pipeline the passes
+// run inside llc, which already receives the target flags shared with opt.
+static void addCheerpOptimizerArgs(const ToolChain &TC, const ArgList &Args,
+                                   ArgStringList &CmdArgs, bool fused) {
+  const Driver &D = TC.getDriver();
 
   std::string optPasses = "";
   auto addPass = [&optPasses](const std::string& passInvocation)->void{
@@ -630,17 +641,29 @@ void cheerp::CheerpOptimizer::ConstructJob(Compilation &C, const JobAction &JA,
 	  optPasses += passInvocation;
   };
 
-  CmdArgs.push_back("-march=cheerp");
+  // -O3 selects a pipeline tuned for throughput instead of size
+  bool optimizeForSpeed = false;
+  if (Arg *OptLevel = Args.getLastArg(options::OPT_O_Group))
+    optimizeForSpeed = OptLevel->getOption().matches(options::OPT_Ofast) ||
+                       (OptLevel->getOption().matches(options::OPT_O) &&
+                        StringRef(OptLevel->getValue()) == "3");
+
+  if (!fused)
+    CmdArgs.push_back("-march=cheerp");
+  // Lower the counters of -fprofile-instr-generate, it does nothing if no object was instrumented
+  addPass("InstrProfLowering");
   if(Args.hasArg(options::OPT_cheerp_preexecute))
     addPass("PreExecute");
   if(Args.hasArg(options::OPT_cheerp_preexecute_main))
     CmdArgs.push_back("-cheerp-preexecute-main");
-  if(Arg* cheerpFixFuncCasts = Args.getLastArg(options::OPT_cheerp_fix_wrong_func_casts))
-    cheerpFixFuncCasts->render(Args, CmdArgs);
-  if(Arg* cheerpUseBigInts = Args.getLastArg(options::OPT_cheerp_use_bigints))
-    cheerpUseBigInts->render(Args, CmdArgs);
-  else if (getToolChain().getTriple().getOS() == llvm::Triple::WASI)
-    CmdArgs.push_back("-cheerp-use-bigints");
+  if (!fused) {
+    if(Arg* cheerpFixFuncCasts = Args.getLastArg(options::OPT_cheerp_fix_wrong_func_casts))
+      cheerpFixFuncCasts->render(Args, CmdArgs);
+    if(Arg* cheerpUseBigInts = Args.getLastArg(options::OPT_cheerp_use_bigints))
+      cheerpUseBigInts->render(Args, CmdArgs);
+    else if (TC.getTriple().getOS() == llvm::Triple::WASI)
+      CmdArgs.push_back("-cheerp-use-bigints");
+  }
   if(Arg* cheerpStrictLinkingEq = Args.getLastArg(options::OPT_cheerp_strict_linking_EQ)) {
     if (cheerpStrictLinkingEq->getValue() != StringRef("warning") &&
         cheerpStrictLinkingEq->getValue() != StringRef("error")) {
@@ -651,40 +674,42 @@ void cheerp::CheerpOptimizer::ConstructJob(Compilation &C, const JobAction &JA,
   }
 
 
-  if(Arg* cheerpLinearOutput = Args.getLastArg(options::OPT_cheerp_linear_output_EQ))
-    cheerpLinearOutput->render(Args, CmdArgs);
-  else
-  {
-    std::string linearOut("-cheerp-linear-output=");
-    llvm::Triple::EnvironmentType env = getToolChain().getTriple().getEnvironment();
-    if (env == llvm::Triple::WebAssembly)
-    {
-      linearOut += "wasm";
-    }
+  if (!fused) {
+    if(Arg* cheerpLinearOutput = Args.getLastArg(options::OPT_cheerp_linear_output_EQ))
+      cheerpLinearOutput->render(Args, CmdArgs);
     else
     {
-      // NOTE: we use "asmjs" also for -target cheerp
-      linearOut += "asmjs";
+      std::string linearOut("-cheerp-linear-output=");
+      llvm::Triple::EnvironmentType env = TC.getTriple().getEnvironment();
+      if (env == llvm::Triple::WebAssembly)
+      {
+        linearOut += "wasm";
+      }
+      else
+      {
+        // NOTE: we use "asmjs" also for -target cheerp
+        linearOut += "asmjs";
+      }
+      CmdArgs.push_back(Args.MakeArgString(linearOut));
     }
-    CmdArgs.push_back(Args.MakeArgString(linearOut));
+    auto features = cheerp::getWasmFeatures(D, Args);
+    if(std::find(features.begin(), features.end(), cheerp::EXPORTEDTABLE) != features.end())
+      CmdArgs.push_back("-cheerp-wasm-exported-table");
+    if(std::find(features.begin(), features.end(), cheerp::EXPORTEDMEMORY) != features.end())
+      CmdArgs.push_back("-cheerp-wasm-exported-memory");
+    if(std::find(features.begin(), features.end(), cheerp::SIMD) == features.end())
+      CmdArgs.push_back("-cheerp-wasm-no-simd");
+    if(std::find(features.begin(), features.end(), cheerp::UNALIGNEDMEM) == features.end())
+      CmdArgs.push_back("-cheerp-wasm-no-unaligned-mem");
+
+    if (Args.hasArg(options::OPT_cheerp_no_icf))
+      CmdArgs.push_back("-cheerp-no-icf");
   }
-  auto features = getWasmFeatures(D, Args);
-  if(std::find(features.begin(), features.end(), EXPORTEDTABLE) != features.end())
-    CmdArgs.push_back("-cheerp-wasm-exported-table");
-  if(std::find(features.begin(), features.end(), EXPORTEDMEMORY) != features.end())
-    CmdArgs.push_back("-cheerp-wasm-exported-memory");
-  if(std::find(features.begin(), features.end(), SIMD) == features.end())
-    CmdArgs.push_back("-cheerp-wasm-no-simd");
-  if(std::find(features.begin(), features.end(), UNALIGNEDMEM) == features.end())
-    CmdArgs.push_back("-cheerp-wasm-no-unaligned-mem");
-
-  if (Args.hasArg(options::OPT_cheerp_no_icf))
-    CmdArgs.push_back("-cheerp-no-icf");
 
   addPass("function(CheerpLowerInvoke)");
   if (Args.hasArg(options::OPT_fexceptions))
     CmdArgs.push_back("-cheerp-keep-invokes");
-  addPass("function(simplifycfg)");
+  addPass("function(simplifycfg,DowncastFolding)");
 
   addPass("CallConstructors");
   addPass("GlobalDepsAnalyzer");
@@ -696,25 +721,80 @@ void cheerp::CheerpOptimizer::ConstructJob(Compilation &C, const JobAction &JA,
   if(!Args.hasArg(options::OPT_cheerp_no_lto))
   {
     addPass("FreeAndDeleteRemoval");
+    addPass("DynamicCastLowering");
+    addPass("GuardElimination");
     CmdArgs.push_back("-cheerp-lto");
-    addPass("default<Os>");
+    if (optimizeForSpeed)
+      CmdArgs.push_back("-cheerp-optimize-for-speed");
+    const std::string ltoPipeline = optimizeForSpeed ? "default<O3>" : "default<Os>";
+    if(Arg* cheerpLTOPartitions = Args.getLastArg(options::OPT_cheerp_lto_partitions_EQ)) {
+      unsigned partitions;
+      if (StringRef(cheerpLTOPartitions->getValue()).getAsInteger(10, partitions)) {
+        D.Diag(diag::err_drv_invalid_value)
+        << cheerpLTOPartitions->getAsString(Args) << cheerpLTOPartitions->getValue();
+      }
+      cheerpLTOPartitions->render(Args, CmdArgs);
+      // Optimize the partitions in parallel, then fold the identical functions across them
+      addPass("PartitionedLTO(" + ltoPipeline + ")");
+      if (!Args.hasArg(options::OPT_cheerp_no_icf))
+        addPass("IdenticalCodeFolding");
+    }
+    else
+      addPass(ltoPipeline);
+    if (Arg* cheerpPEBoundedMemory = Args.getLastArg(options::OPT_cheerp_partial_executer_bounded_memory))
+      cheerpPEBoundedMemory->render(Args, CmdArgs);
+    if (Arg* cheerpPEReport = Args.getLastArg(options::OPT_cheerp_partial_executer_report_EQ))
+      cheerpPEReport->render(Args, CmdArgs);
     addPass("PartialExecuter");
+    if (optimizeForSpeed)
+    {
+      // Inlining exposes more constant arguments to PartialExecuter, and the
+      // code it removes makes more callees cheap enough to inline
+      addPass("cgscc(inline)");
+      addPass("PartialExecuter");
+    }
     // -Os converts loops to canonical form, which may causes empty forwarding branches, remove those
     // Also cleanup any constants instruced by PartialExecuter
     addPass("function(simplifycfg,instcombine)");
   }
-  CmdArgs.push_back(Args.MakeArgString(std::string("-passes=")+optPasses));
-  CmdArgs.push_back("-o");
-  CmdArgs.push_back(Output.getFilename());
-
-  const InputInfo &II = *Inputs.begin();
-  CmdArgs.push_back(II.getFilename());
+  CmdArgs.push_back(Args.MakeArgString(std::string(fused ? "-cheerp-passes=" : "-passes=")+optPasses));
 
   // Honor -mllvm
   Args.AddAllArgValues(CmdArgs, options::OPT_mllvm);
   // Honor -cheerp-no-pointer-scev
   if (Arg *CheerpNoPointerSCEV = Args.getLastArg(options::OPT_cheerp_no_pointer_scev))
     CheerpNoPointerSCEV->render(Args, CmdArgs);
+}
+
+void cheerp::Link::ConstructJob(Compilation &C, const JobAction &JA,
+                                const InputInfo &Output,
+                                const InputInfoList &Inputs,
+                                const ArgList &Args,
+                                const char *LinkingOutput) const {
+  ArgStringList CmdArgs;
+
+  CmdArgs.push_back("-o");
+  CmdArgs.push_back(Output.getFilename());
+
+  addCheerpLinkArgs(C, getToolChain(), Inputs, Args, CmdArgs, /*fused*/false);
+
+  const char *Exec = Args.MakeArgString((getToolChain().GetProgramPath("llvm-link")));
+  C.addCommand(std::make_unique<Command>(JA, *this, ResponseFileSupport::None(), Exec, CmdArgs, Inputs));
+}
+
+void cheerp::CheerpOptimizer::ConstructJob(Compilation &C, const JobAction &JA,
+                                          const InputInfo &Output,
+                                          const InputInfoList &Inputs,
+                                          const ArgList &Args,
+                                          const char *LinkingOutput) const {
+  ArgStringList CmdArgs;
+
+  addCheerpOptimizerArgs(getToolChain(), Args, CmdArgs, /*fused*/false);
+  CmdArgs.push_back("-o");
+  CmdArgs.push_back(Output.getFilename());
+
+  const InputInfo &II = *Inputs.begin();
+  CmdArgs.push_back(II.getFilename());
 
   const char *Exec = Args.MakeArgString((getToolChain().GetProgramPath("opt")));
   C.addCommand(std::make_unique<Command>(JA, *this, ResponseFileSupport::None(), Exec, CmdArgs, Inputs));
@@ -909,6 +989,12 @@ void cheerp::CheerpCompiler::ConstructJob(Compilation &C, const JobAction &JA,
     CmdArgs.push_back("-cheerp-wasm-no-globalization");
   if (noUnalignedMem)
     CmdArgs.push_back("-cheerp-wasm-no-unaligned-mem");
+  if(Arg* cheerpWasmCodegenCache = Args.getLastArg(options::OPT_cheerp_wasm_codegen_cache_EQ))
+    cheerpWasmCodegenCache->render(Args, CmdArgs);
+  if(Arg* cheerpJSCodegenCache = Args.getLastArg(options::OPT_cheerp_js_codegen_cache_EQ))
+    cheerpJSCodegenCache->render(Args, CmdArgs);
+  if(Arg* cheerpNameMap = Args.getLastArg(options::OPT_cheerp_name_map_EQ))
+    cheerpNameMap->render(Args, CmdArgs);
 
   if(Arg* cheerpSourceMap = Args.getLastArg(options::OPT_cheerp_sourcemap_EQ))
     cheerpSourceMap->render(Args, CmdArgs);
@@ -951,12 +1037,26 @@ void cheerp::CheerpCompiler::ConstructJob(Compilation &C, const JobAction &JA,
   else if (getToolChain().getTriple().getOS() == llvm::Triple::WASI)
     CmdArgs.push_back("-cheerp-use-bigints");
 
-  // Set output to binary mode to avoid linefeed conversion on Windows.
-  CmdArgs.push_back("-filetype");
-  CmdArgs.push_back("obj");
+  // Set output to binary mode to avoid linefeed conversion on Windows. When
+  // only the bitcode is dumped the backend does not emit any file of its own
+  bool passesOnly = Args.hasArg(options::OPT_cheerp_fused_pipeline) &&
+                    Args.hasArg(options::OPT_cheerp_dump_bc);
+  if (!passesOnly) {
+    CmdArgs.push_back("-filetype");
+    CmdArgs.push_back("obj");
+  }
 
-  const InputInfo &II = *Inputs.begin();
-  CmdArgs.push_back(II.getFilename());
+  // With the fused pipeline the whole program is linked and optimized in
+  // memory, and the inputs are the ones the link step would get
+  if (Args.hasArg(options::OPT_cheerp_fused_pipeline)) {
+    addCheerpOptimizerArgs(getToolChain(), Args, CmdArgs, /*fused*/true);
+    if (passesOnly)
+      CmdArgs.push_back("-cheerp-passes-only");
+    addCheerpLinkArgs(C, getToolChain(), Inputs, Args, CmdArgs, /*fused*/true);
+  } else {
+    const InputInfo &II = *Inputs.begin();
+    CmdArgs.push_back(II.getFilename());
+  }
 
   const char *Exec = Args.MakeArgString((getToolChain().GetProgramPath("llc")));
   C.addCommand(std::make_unique<Command>(JA, *this, ResponseFileSupport::None(), Exec, CmdArgs, Inputs));
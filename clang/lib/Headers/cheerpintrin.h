@@ -41,6 +41,19 @@ size_t __builtin_cheerp_pointer_kind(const P* ptr);
 
 int __builtin_cheerp_grow_memory(int bytes);
 
+/* Store a JS object in the externref table of the wasm module and return its slot.
+   Slots can be kept in linear memory and are released with __builtin_cheerp_externref_table_free.
+   The null object is always stored in slot 0. Only available in wasm code with externref support.
+   The slots are managed by the allocator alone, there is no way to store an object in a given slot.
+*/
+template<class T>
+int __builtin_cheerp_externref_table_alloc(T* obj);
+
+void __builtin_cheerp_externref_table_free(int slot);
+
+template<class R>
+R* __builtin_cheerp_externref_table_get(int slot);
+
 void* __buitin_cheerp_stack_save();
 
 void __buitin_cheerp_stack_restore(void*);
@@ -0,0 +1,44 @@
+// Check that -cheerp-fused-pipeline replaces the llvm-link, opt and llc steps
+// with a single llc job which receives the optimizer pipeline and all the link
+// inputs. With -cheerp-dump-bc the job stops after the optimizations and only
+// writes the bitcode, so no object file type is requested.
+
+// RUN: %clang -### --target=cheerp-leaningtech-webbrowser-wasm -cheerp-fused-pipeline %s 2>&1 \
+// RUN:   | FileCheck -check-prefix=FUSED %s
+// FUSED: "-cc1"
+// FUSED-NOT: "{{([^"]*[/\\])?}}llvm-link{{(\.exe)?}}"
+// FUSED-NOT: "{{([^"]*[/\\])?}}opt{{(\.exe)?}}"
+// FUSED: llc{{.*}}" "-march=cheerp"
+// FUSED-SAME: "-filetype" "obj" {{.*}}"-cheerp-passes={{[^"]*}}GlobalDepsAnalyzer{{[^"]*}}"
+// FUSED-SAME: "-cheerp-link-input={{[^"]*}}libc.bc" "-cheerp-link-input={{[^"]*}}crt1.bc"
+// FUSED-SAME: "-cheerp-link-input={{[^"]*}}libsystem.bc"
+// FUSED-NOT: -cheerp-passes-only
+
+// RUN: %clang -### --target=cheerp-leaningtech-webbrowser-wasm -cheerp-fused-pipeline \
+// RUN:   -cheerp-dump-bc %s 2>&1 \
+// RUN:   | FileCheck -check-prefix=DUMP %s
+// DUMP-NOT: "{{([^"]*[/\\])?}}llvm-link{{(\.exe)?}}"
+// DUMP-NOT: "{{([^"]*[/\\])?}}opt{{(\.exe)?}}"
+// DUMP: llc{{.*}}" "-march=cheerp"
+// DUMP-NOT: "-filetype"
+// DUMP-SAME: "-cheerp-passes={{[^"]*}}" "-cheerp-passes-only"
+
+// RUN: %clang -### --target=cheerp-leaningtech-webbrowser-wasm %s 2>&1 \
+// RUN:   | FileCheck -check-prefix=SPLIT %s
+// SPLIT: "{{([^"]*[/\\])?}}llvm-link{{(\.exe)?}}"
+// SPLIT: "{{([^"]*[/\\])?}}opt{{(\.exe)?}}" {{.*}}"-passes={{[^"]*}}GlobalDepsAnalyzer
+// SPLIT: llc{{.*}}" "-march=cheerp"
+// SPLIT-NOT: -cheerp-passes
+
+// Libraries found as lib<name>.a are passed as link inputs too, llc reads the
+// bitcode members of the archive.
+// RUN: rm -rf %t && mkdir -p %t && touch %t/libfoo.a
+// RUN: %clang -### --target=cheerp-leaningtech-webbrowser-wasm -cheerp-fused-pipeline \
+// RUN:   -L%t -lfoo %s 2>&1 \
+// RUN:   | FileCheck -check-prefix=ARCHIVE %s
+// ARCHIVE: llc{{.*}}" "-march=cheerp"
+// ARCHIVE-SAME: "-cheerp-link-input={{[^"]*}}libfoo.a"
+
+int main(void) {
+  return 0;
+}
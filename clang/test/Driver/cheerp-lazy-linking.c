@@ -0,0 +1,29 @@
+// Check that -cheerp-lazy-linking passes the system libraries as lazy
+// libraries, both to llvm-link and to the fused llc pipeline. The runtime
+// functions the backend needs later are kept by the lazy linker itself, so no
+// hard-coded root list is passed on the command line.
+
+// RUN: %clang -### --target=cheerp-leaningtech-webbrowser-wasm -cheerp-lazy-linking %s 2>&1 \
+// RUN:   | FileCheck -check-prefix=LINK %s
+// LINK: llvm-link{{.*}}" {{.*}}"-lazy-library={{[^"]*}}libc.bc" "-lazy-library={{[^"]*}}crt1.bc"
+// LINK-SAME: "-lazy-library={{[^"]*}}libsystem.bc"
+// LINK-NOT: -lazy-root
+
+// RUN: %clang -### --target=cheerp-leaningtech-wasi-wasm -cheerp-lazy-linking %s 2>&1 \
+// RUN:   | FileCheck -check-prefix=WASI %s
+// WASI: llvm-link{{.*}}" {{.*}}"-lazy-library={{[^"]*}}libwasi.bc"
+// WASI-NOT: -lazy-root
+
+// RUN: %clang -### --target=cheerp-leaningtech-webbrowser-wasm -cheerp-lazy-linking \
+// RUN:   -cheerp-fused-pipeline %s 2>&1 \
+// RUN:   | FileCheck -check-prefix=FUSED %s
+// FUSED: llc{{.*}}" {{.*}}"-cheerp-lazy-library={{[^"]*}}libc.bc" "-cheerp-lazy-library={{[^"]*}}crt1.bc"
+// FUSED-NOT: -cheerp-lazy-root
+
+// RUN: %clang -### --target=cheerp-leaningtech-webbrowser-wasm %s 2>&1 \
+// RUN:   | FileCheck -check-prefix=EAGER %s
+// EAGER-NOT: -lazy-library
+
+int main(void) {
+  return 0;
+}
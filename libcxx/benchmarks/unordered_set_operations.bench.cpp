@@ -1,4 +1,5 @@
 #include <unordered_set>
+#include <utility>
 #include <vector>
 #include <functional>
 #include <cstdint>
@@ -125,6 +126,54 @@ struct SlowStringEq {
   }
 };
 
+// Pointers returned by an allocator share their low bits, which makes them a
+// bad input for hash functions that don't mix the value.
+inline std::vector<int*> getAlignedPointerInputs(size_t N) {
+    std::vector<int*> inputs;
+    for (auto i : getRandomIntegerInputs<uint32_t>(N))
+        inputs.push_back(reinterpret_cast<int*>(static_cast<uintptr_t>(i & 0xfffff) * 16));
+    return inputs;
+}
+
+inline std::vector<double> getRandomDoubleInputs(size_t N) {
+    std::vector<double> inputs;
+    for (auto i : getRandomIntegerInputs<uint32_t>(N))
+        inputs.push_back(static_cast<double>(i) / 16);
+    return inputs;
+}
+
+// Keys made of two words go through std::__hash_combine, which must not be
+// symmetric in its arguments nor collapse when the two words are equal.
+struct IntPairHash {
+  IntPairHash() = default;
+  inline TEST_ALWAYS_INLINE
+  std::size_t operator()(const std::pair<int, int>& data) const {
+      return std::__hash_combine(std::hash<int>{}(data.first),
+                                 std::hash<int>{}(data.second));
+  }
+};
+
+// Every (a, b) is followed by (b, a)
+inline std::vector<std::pair<int, int>> getSymmetricPairInputs(size_t N) {
+    std::vector<std::pair<int, int>> inputs;
+    auto values = getRandomIntegerInputs<uint32_t>(N);
+    for (size_t i = 0; i + 1 < N; i += 2) {
+        const int a = static_cast<int>(values[i] & 0xffff);
+        const int b = static_cast<int>(values[i + 1] & 0xffff);
+        inputs.push_back(std::make_pair(a, b));
+        inputs.push_back(std::make_pair(b, a));
+    }
+    return inputs;
+}
+
+// Every key is (a, a)
+inline std::vector<std::pair<int, int>> getEqualPairInputs(size_t N) {
+    std::vector<std::pair<int, int>> inputs;
+    for (auto i : getSortedIntegerInputs<int>(N))
+        inputs.push_back(std::make_pair(i, i));
+    return inputs;
+}
+
 //----------------------------------------------------------------------------//
 //                               BM_Hash
 // ---------------------------------------------------------------------------//
@@ -163,6 +212,31 @@ BENCHMARK_CAPTURE(BM_Hash,
     UInt32Hash{},
     getSortedTopBitsIntegerInputs<uint32_t>) -> Arg(TestNumInputs);
 
+BENCHMARK_CAPTURE(BM_Hash,
+    pointer_aligned_std_hash,
+    std::hash<int*>{},
+    getAlignedPointerInputs) -> Arg(TestNumInputs);
+
+BENCHMARK_CAPTURE(BM_Hash,
+    uint64_random_std_hash,
+    std::hash<uint64_t>{},
+    getRandomIntegerInputs<uint64_t>) -> Arg(TestNumInputs);
+
+BENCHMARK_CAPTURE(BM_Hash,
+    double_random_std_hash,
+    std::hash<double>{},
+    getRandomDoubleInputs) -> Arg(TestNumInputs);
+
+BENCHMARK_CAPTURE(BM_Hash,
+    int_pair_symmetric_hash_combine,
+    IntPairHash{},
+    getSymmetricPairInputs) -> Arg(TestNumInputs);
+
+BENCHMARK_CAPTURE(BM_Hash,
+    int_pair_equal_hash_combine,
+    IntPairHash{},
+    getEqualPairInputs) -> Arg(TestNumInputs);
+
 
 //----------------------------------------------------------------------------//
 //                       BM_InsertValue
@@ -191,6 +265,34 @@ BENCHMARK_CAPTURE(BM_InsertValueRehash,
     std::unordered_set<uint32_t, UInt32Hash>{},
     getSortedTopBitsIntegerInputs<uint32_t>)->Arg(TestNumInputs);
 
+// Pointers //
+BENCHMARK_CAPTURE(BM_InsertValue,
+    unordered_set_aligned_pointer,
+    std::unordered_set<int*>{},
+    getAlignedPointerInputs)->Arg(TestNumInputs);
+
+// 64-bit keys //
+BENCHMARK_CAPTURE(BM_InsertValue,
+    unordered_set_uint64,
+    std::unordered_set<uint64_t>{},
+    getRandomIntegerInputs<uint64_t>)->Arg(TestNumInputs);
+
+BENCHMARK_CAPTURE(BM_InsertValue,
+    unordered_set_double,
+    std::unordered_set<double>{},
+    getRandomDoubleInputs)->Arg(TestNumInputs);
+
+// Pairs //
+BENCHMARK_CAPTURE(BM_InsertValue,
+    unordered_set_int_pair_symmetric,
+    std::unordered_set<std::pair<int, int>, IntPairHash>{},
+    getSymmetricPairInputs)->Arg(TestNumInputs);
+
+BENCHMARK_CAPTURE(BM_InsertValue,
+    unordered_set_int_pair_equal,
+    std::unordered_set<std::pair<int, int>, IntPairHash>{},
+    getEqualPairInputs)->Arg(TestNumInputs);
+
 // String //
 BENCHMARK_CAPTURE(BM_InsertValue,
     unordered_set_string,
@@ -635,7 +635,8 @@ _LIBCPP_HIDDEN void __sort(_RandomAccessIterator __first, _RandomAccessIterator
   std::__introsort<_AlgPolicy, _Compare>(__first, __last, __comp, __depth_limit);
 }
 
-#ifndef __CHEERP__
+// In genericjs pointers are not integers, in linear memory they can be sorted as such
+#if !defined(__CHEERP__) || defined(__ASMJS__)
 template <class _Compare, class _Tp>
 inline _LIBCPP_INLINE_VISIBILITY void __sort(_Tp** __first, _Tp** __last, __less<_Tp*>&) {
   __less<uintptr_t> __comp;
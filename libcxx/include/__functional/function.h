@@ -400,7 +400,11 @@ template <class _Fp> class __value_func;
 
 template <class _Rp, class... _ArgTypes> class __value_func<_Rp(_ArgTypes...)>
 {
+    // In genericjs there is no untyped storage to construct a __func into,
+    // they are always allocated as typed objects and the buffer is not needed
+#if !defined(__CHEERP__) || defined(__ASMJS__)
     typename aligned_storage<3 * sizeof(void*)>::type __buf_;
+#endif
 
     typedef __base<_Rp(_ArgTypes...)> __func;
     __func* __f_;
@@ -454,11 +458,13 @@ template <class _Rp, class... _ArgTypes> class __value_func<_Rp(_ArgTypes...)>
     {
         if (__f.__f_ == nullptr)
             __f_ = nullptr;
+#if !defined(__CHEERP__) || defined(__ASMJS__)
         else if ((void*)__f.__f_ == &__f.__buf_)
         {
             __f_ = __as_base(&__buf_);
             __f.__f_->__clone(__f_);
         }
+#endif
         else
             __f_ = __f.__f_->__clone();
     }
@@ -468,11 +474,13 @@ template <class _Rp, class... _ArgTypes> class __value_func<_Rp(_ArgTypes...)>
     {
         if (__f.__f_ == nullptr)
             __f_ = nullptr;
+#if !defined(__CHEERP__) || defined(__ASMJS__)
         else if ((void*)__f.__f_ == &__f.__buf_)
         {
             __f_ = __as_base(&__buf_);
             __f.__f_->__clone(__f_);
         }
+#endif
         else
         {
             __f_ = __f.__f_;
@@ -483,9 +491,12 @@ template <class _Rp, class... _ArgTypes> class __value_func<_Rp(_ArgTypes...)>
     _LIBCPP_INLINE_VISIBILITY
     ~__value_func()
     {
+#if !defined(__CHEERP__) || defined(__ASMJS__)
         if ((void*)__f_ == &__buf_)
             __f_->destroy();
-        else if (__f_)
+        else
+#endif
+        if (__f_)
             __f_->destroy_deallocate();
     }
 
@@ -495,11 +506,13 @@ template <class _Rp, class... _ArgTypes> class __value_func<_Rp(_ArgTypes...)>
         *this = nullptr;
         if (__f.__f_ == nullptr)
             __f_ = nullptr;
+#if !defined(__CHEERP__) || defined(__ASMJS__)
         else if ((void*)__f.__f_ == &__f.__buf_)
         {
             __f_ = __as_base(&__buf_);
             __f.__f_->__clone(__f_);
         }
+#endif
         else
         {
             __f_ = __f.__f_;
@@ -513,9 +526,12 @@ template <class _Rp, class... _ArgTypes> class __value_func<_Rp(_ArgTypes...)>
     {
         __func* __f = __f_;
         __f_ = nullptr;
+#if !defined(__CHEERP__) || defined(__ASMJS__)
         if ((void*)__f == &__buf_)
             __f->destroy();
-        else if (__f)
+        else
+#endif
+        if (__f)
             __f->destroy_deallocate();
         return *this;
     }
@@ -533,6 +549,7 @@ template <class _Rp, class... _ArgTypes> class __value_func<_Rp(_ArgTypes...)>
     {
         if (&__f == this)
             return;
+#if !defined(__CHEERP__) || defined(__ASMJS__)
         if ((void*)__f_ == &__buf_ && (void*)__f.__f_ == &__f.__buf_)
         {
             typename aligned_storage<sizeof(__buf_)>::type __tempbuf;
@@ -563,6 +580,7 @@ template <class _Rp, class... _ArgTypes> class __value_func<_Rp(_ArgTypes...)>
             __f_ = __as_base(&__buf_);
         }
         else
+#endif
             _VSTD::swap(__f_, __f.__f_);
     }
 
@@ -377,8 +377,10 @@ struct _PairT {
 _LIBCPP_INLINE_VISIBILITY
 inline size_t __hash_combine(size_t __lhs, size_t __rhs) _NOEXCEPT {
     const _PairT __p = {__lhs, __rhs};
-#ifdef __CHEERP__
-    return __scalar_hash<size_t>()(__p.first) ^ __scalar_hash<size_t>()(__p.second);
+#if defined(__CHEERP__) && !defined(__ASMJS__)
+    // _PairT can't be type punned in genericjs, mix the two words without making
+    // the combination symmetric
+    return __p.first ^ (__p.second + 0x9e3779b9 + (__p.first << 6) + (__p.first >> 2));
 #else
     typedef __scalar_hash<_PairT> _HashT;
     return _HashT()(__p);
@@ -8,6 +8,9 @@
 
 #include <new>
 #include <stdlib.h>
+#ifdef __CHEERP__
+#include <malloc.h>
+#endif
 
 #include "include/atomic_support.h"
 
@@ -58,6 +61,109 @@ __throw_bad_alloc()
 // in this shared library, so that they can be overridden by programs
 // that define non-weak copies of the functions.
 
+#ifdef __CHEERP__
+// In linear memory small objects are recycled through size segregated free
+// lists, which avoids going through malloc for most C++ allocations. Cheerp
+// lowers new and delete expressions directly to malloc and free, so every block
+// must stay a regular malloc chunk: blocks are only cached, never carved out of
+// private arenas. Freeing a block from operator new with free, or deleting a
+// block from malloc, is then always safe. The size class of a deleted block is
+// derived from its usable size, and the lists are bounded so that the cache
+// can't retain an unbounded amount of memory.
+namespace {
+
+const size_t __small_granule = 16;
+const size_t __small_classes = 16;
+const size_t __small_max_size = __small_granule * __small_classes;
+const size_t __small_max_cached = 64;
+
+struct __free_block
+{
+    __free_block* __next;
+};
+
+__free_block* __free_lists[__small_classes];
+size_t __free_counts[__small_classes];
+
+struct __cheerp_new_stats
+{
+    size_t __small_allocs;
+    size_t __large_allocs;
+    size_t __cached_blocks;
+} __stats;
+
+inline void* __new_alloc(size_t __size)
+{
+    if (__size > __small_max_size)
+    {
+        __stats.__large_allocs++;
+        return ::malloc(__size);
+    }
+    size_t __class = (__size - 1) / __small_granule;
+    size_t __block_size = (__class + 1) * __small_granule;
+    void* __p;
+    if (__free_block* __b = __free_lists[__class])
+    {
+        __free_lists[__class] = __b->__next;
+        __free_counts[__class]--;
+        __stats.__cached_blocks--;
+        __p = __b;
+    }
+    else if ((__p = ::malloc(__block_size)) == nullptr)
+        return nullptr;
+    __stats.__small_allocs++;
+    return __p;
+}
+
+inline void __new_free(void* __p)
+{
+    // A block can serve all the requests of the largest class it covers
+    size_t __usable = ::malloc_usable_size(__p);
+    if (__usable < __small_granule || __usable > __small_max_size)
+    {
+        ::free(__p);
+        return;
+    }
+    size_t __class = __usable / __small_granule - 1;
+    if (__free_counts[__class] >= __small_max_cached)
+    {
+        ::free(__p);
+        return;
+    }
+    __free_block* __b = static_cast<__free_block*>(__p);
+    __b->__next = __free_lists[__class];
+    __free_lists[__class] = __b;
+    __free_counts[__class]++;
+    __stats.__cached_blocks++;
+}
+
+} // namespace
+
+// Report the counters of the small object allocator, declared in <new>
+extern "C" _LIBCPP_FUNC_VIS void
+__cheerp_operator_new_stats(size_t* __small_allocs, size_t* __large_allocs,
+                            size_t* __cached_blocks) noexcept
+{
+    *__small_allocs = __stats.__small_allocs;
+    *__large_allocs = __stats.__large_allocs;
+    *__cached_blocks = __stats.__cached_blocks;
+}
+#else
+namespace {
+
+inline void* __new_alloc(size_t __size)
+{
+    return ::malloc(__size);
+}
+
+inline void __new_free(void* __p)
+{
+    ::free(__p);
+}
+
+} // namespace
+#endif
+
 _LIBCPP_WEAK
 void *
 operator new(std::size_t size) _THROW_BAD_ALLOC
@@ -65,7 +171,7 @@ operator new(std::size_t size) _THROW_BAD_ALLOC
     if (size == 0)
         size = 1;
     void* p;
-    while ((p = ::malloc(size)) == nullptr)
+    while ((p = __new_alloc(size)) == nullptr)
     {
         // If malloc fails and there is a new_handler,
         // call it to try free up memory.
@@ -131,7 +237,9 @@ _LIBCPP_WEAK
 void
 operator delete(void* ptr) noexcept
 {
-    ::free(ptr);
+    if (ptr == nullptr)
+        return;
+    __new_free(ptr);
 }
 
 _LIBCPP_WEAK
@@ -26,6 +26,7 @@
 #include <stdlib.h>
 
 #if defined(__CHEERP__)
+#include <cheerp/client.h>
 #include <cheerp/clientlib.h>
 #endif
 
@@ -81,13 +82,45 @@ random_device::~random_device()
 }
 
 #ifdef __CHEERP__
+namespace {
+
+// Values are drawn from crypto.getRandomValues in batches, so that most calls
+// don't need to cross into JS
+const size_t __entropy_pool_size = 256;
+#ifdef __ASMJS__
+unsigned __entropy_pool[__entropy_pool_size];
+#else
+client::Uint32Array* __entropy_pool = nullptr;
+#endif
+size_t __entropy_pool_pos = __entropy_pool_size;
+
 [[cheerp::genericjs]]
+void __refill_entropy_pool()
+{
+#ifdef __ASMJS__
+    client::crypto.getRandomValues(cheerp::MakeTypedArray(__entropy_pool, sizeof(__entropy_pool)));
+#else
+    if (__entropy_pool == nullptr)
+        __entropy_pool = new client::Uint32Array(__entropy_pool_size);
+    client::crypto.getRandomValues(__entropy_pool);
 #endif
+    __entropy_pool_pos = 0;
+}
+
+} // namespace
+#endif
+
 unsigned
 random_device::operator()()
 {
 #ifdef __CHEERP__
-    return client::Math.random() * (65536.0 * 65536.0);
+    if (__entropy_pool_pos == __entropy_pool_size)
+        __refill_entropy_pool();
+#ifdef __ASMJS__
+    return __entropy_pool[__entropy_pool_pos++];
+#else
+    return (*__entropy_pool)[__entropy_pool_pos++];
+#endif
 #else
     return arc4random();
 #endif
@@ -221,7 +254,7 @@ random_device::entropy() const noexcept
     return std::numeric_limits<result_type>::digits;
 
   return ent;
-#elif defined(_LIBCPP_USING_ARC4_RANDOM) || defined(_LIBCPP_USING_FUCHSIA_CPRNG)
+#elif defined(_LIBCPP_USING_ARC4_RANDOM) || defined(_LIBCPP_USING_FUCHSIA_CPRNG) || defined(__CHEERP__)
   return std::numeric_limits<result_type>::digits;
 #else
   return 0;
@@ -0,0 +1,62 @@
+//===----------------------------------------------------------------------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+
+// Cheerp lowers new and delete expressions to malloc and free, so the blocks
+// recycled by libc++'s operator new must be interchangeable with the ones of
+// malloc. Check that mixing the two never corrupts the heap.
+
+// REQUIRES: target=cheerp{{.*}}
+
+#include <new>
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+
+#include "test_macros.h"
+
+int main(int, char**) {
+  const std::size_t sizes[] = {1, 8, 16, 17, 100, 256, 257, 4096};
+  for (int round = 0; round < 100; ++round) {
+    for (std::size_t size : sizes) {
+      // operator new and free
+      void* p = ::operator new(size);
+      std::memset(p, 0xab, size);
+      std::free(p);
+
+      // malloc and operator delete
+      void* q = std::malloc(size);
+      assert(q != nullptr);
+      std::memset(q, 0xcd, size);
+      ::operator delete(q);
+
+      // new expressions and the other side
+      char* a = new char[size];
+      std::memset(a, 0xef, size);
+      ::operator delete[](a);
+      char* b = static_cast<char*>(::operator new[](size));
+      std::memset(b, 0x12, size);
+      delete[] b;
+    }
+  }
+  // Recycled blocks must not overlap live ones
+  void* blocks[64];
+  for (int i = 0; i < 64; ++i) {
+    blocks[i] = (i % 2) ? ::operator new(24) : std::malloc(24);
+    std::memset(blocks[i], i, 24);
+  }
+  for (int i = 0; i < 64; ++i) {
+    const unsigned char* bytes = static_cast<const unsigned char*>(blocks[i]);
+    for (int j = 0; j < 24; ++j)
+      assert(bytes[j] == i);
+    if (i % 3)
+      std::free(blocks[i]);
+    else
+      ::operator delete(blocks[i]);
+  }
+  return 0;
+}
@@ -126,9 +126,12 @@ public:
 class AllocaStoresExtractorAnalysis : public llvm::AnalysisInfoMixin<AllocaStoresExtractorAnalysis> {
 	friend llvm::AnalysisInfoMixin<AllocaStoresExtractorAnalysis>;
 	static llvm::AnalysisKey Key;
+	static llvm::Module* analyzedModule;
 public:
 	using Result = AllocaStoresExtractorWrapper;
 	static Result run(llvm::Module& M, llvm::ModuleAnalysisManager&);
+	// Allow the next pipeline over the same module to compute the analysis again
+	static void release();
 };
 
 }
@@ -13,6 +13,7 @@
 #define _CHEERP_BUILTIN_INSTRUCTIONS_H
 
 #include "llvm/IR/Function.h"
+#include "llvm/IR/Module.h"
 #include "llvm/IR/Intrinsics.h"
 #include "llvm/Cheerp/WasmOpcodes.h"
 
@@ -39,6 +39,7 @@ extern llvm::cl::opt<std::string> GlobalPrefix;
 extern llvm::cl::opt<unsigned> CheerpHeapSize;
 extern llvm::cl::opt<unsigned> CheerpStackSize;
 extern llvm::cl::opt<bool> CheerpNoICF;
+extern llvm::cl::opt<bool> CheerpOptimizeForSpeed;
 extern llvm::cl::opt<bool> BoundsCheck;
 extern llvm::cl::opt<bool> AvoidWasmTraps;
 extern llvm::cl::opt<bool> AggressiveGepOptimizer;
@@ -49,6 +50,7 @@ extern llvm::cl::opt<bool> WasmNoGrowMemory;
 extern llvm::cl::opt<bool> WasmExportedTable;
 extern llvm::cl::opt<bool> WasmExportedMemory;
 extern llvm::cl::opt<bool> WasmBranchHints;
+extern llvm::cl::opt<unsigned> BranchHintThreshold;
 extern llvm::cl::opt<bool> WasmAnyref;
 extern llvm::cl::opt<bool> WasmReturnCalls;
 extern llvm::cl::opt<bool> WasmNoSIMD;
@@ -56,5 +58,8 @@ extern llvm::cl::opt<bool> WasmNoGlobalization;
 extern llvm::cl::opt<bool> WasmNoUnalignedMem;
 extern llvm::cl::opt<bool> UseBigInts;
 extern llvm::cl::opt<bool> KeepInvokes;
+extern llvm::cl::opt<std::string> WasmCodegenCache;
+extern llvm::cl::opt<std::string> NameMap;
+extern llvm::cl::opt<std::string> JSCodegenCache;
 
 #endif //_CHEERP_COMMAND_LINE_H
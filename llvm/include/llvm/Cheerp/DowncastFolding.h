@@ -0,0 +1,29 @@
+//===-- Cheerp/DowncastFolding.h - Cheerp optimization pass ---------------===//
+//
+//                     Cheerp: The C++ compiler for the Web
+//
+// This file is distributed under the Apache License v2.0 with LLVM Exceptions.
+// See LICENSE.TXT for details.
+//
+// Copyright 2023 Leaning Technologies
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef _CHEERP_DOWNCAST_FOLDING_H
+#define _CHEERP_DOWNCAST_FOLDING_H
+
+#include "llvm/IR/PassManager.h"
+
+namespace cheerp {
+
+// Fold cheerp_downcast calls whose argument is a GEP to a base of an object of the
+// destination type, and cheerp_downcast_current calls on complete objects in genericjs.
+// The remaining downcasts are the only ones that need the downcast array at runtime.
+class DowncastFoldingPass: public llvm::PassInfoMixin<DowncastFoldingPass> {
+public:
+	llvm::PreservedAnalyses run(llvm::Function& F, llvm::FunctionAnalysisManager&);
+};
+
+}
+
+#endif //_CHEERP_DOWNCAST_FOLDING_H
@@ -0,0 +1,32 @@
+//===-- Cheerp/DynamicCastLowering.h - Cheerp optimization pass -----------===//
+//
+//                     Cheerp: The C++ compiler for the Web
+//
+// This file is distributed under the Apache License v2.0 with LLVM Exceptions.
+// See LICENSE.TXT for details.
+//
+// Copyright 2023 Leaning Technologies
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef _CHEERP_DYNAMIC_CAST_LOWERING_H
+#define _CHEERP_DYNAMIC_CAST_LOWERING_H
+
+#include "llvm/IR/PassManager.h"
+
+namespace cheerp {
+
+// Cheerp always links the whole program, so the class hierarchy can be fully
+// recovered from the RTTI initializers. A dynamic_cast that follows a chain of
+// single inheritance links, to a class whose derived classes also only use single
+// inheritance, can only succeed with offset 0. Such casts are lowered to a few
+// comparisons between the type_info stored in the vtable and the type_infos of
+// the destination subtree, instead of calling __dynamic_cast_genericjs/asmjs.
+class DynamicCastLoweringPass: public llvm::PassInfoMixin<DynamicCastLoweringPass> {
+public:
+	llvm::PreservedAnalyses run(llvm::Module& M, llvm::ModuleAnalysisManager&);
+};
+
+}
+
+#endif //_CHEERP_DYNAMIC_CAST_LOWERING_H
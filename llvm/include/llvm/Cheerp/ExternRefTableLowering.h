@@ -0,0 +1,34 @@
+//===-- Cheerp/ExternRefTableLowering.h - Cheerp optimization pass --------===//
+//
+//                     Cheerp: The C++ compiler for the Web
+//
+// This file is distributed under the Apache License v2.0 with LLVM Exceptions.
+// See LICENSE.TXT for details.
+//
+// Copyright 2023 Leaning Technologies
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef _CHEERP_EXTERNREF_TABLE_LOWERING_H
+#define _CHEERP_EXTERNREF_TABLE_LOWERING_H
+
+#include "llvm/IR/PassManager.h"
+
+namespace cheerp {
+
+// Lower cheerp_externref_table_alloc and cheerp_externref_table_free to calls
+// to a free-slot allocator for the externref table of the wasm module. The
+// allocator is generated as wasm code on top of the table.get, table.set,
+// table.size and table.grow intrinsics, so JS objects can be stored from wasm
+// without going through JS glue. Slot 0 always holds null, and a slot
+// holding null is considered free. The raw table.set, table.size and
+// table.grow intrinsics are reserved to the allocator.
+class ExternRefTableLoweringPass: public llvm::PassInfoMixin<ExternRefTableLoweringPass> {
+public:
+	llvm::PreservedAnalyses run(llvm::Module& M, llvm::ModuleAnalysisManager& MAM);
+	static bool isRequired() { return true;}
+};
+
+}
+
+#endif //_CHEERP_EXTERNREF_TABLE_LOWERING_H
@@ -314,6 +314,11 @@ public:
 		innerPtr->MAM = &MAM;
 		return *innerPtr;
 	}
+	static void release()
+	{
+		delete innerPtr;
+		innerPtr = nullptr;
+	}
 	operator GlobalDepsAnalyzer&()
 	{
 		assert(innerPtr);
@@ -337,9 +342,13 @@ public:
 class GlobalDepsAnalysis : public llvm::AnalysisInfoMixin<GlobalDepsAnalysis> {
 	friend llvm::AnalysisInfoMixin<GlobalDepsAnalysis>;
 	static llvm::AnalysisKey Key;
+	static llvm::Module* analyzedModule;
 public:
 	using Result = GlobalDepsAnalyzerWrapper;
 	GlobalDepsAnalyzerWrapper run(llvm::Module& M, llvm::ModuleAnalysisManager&);
+	// Discard the analyzer state at the end of a pipeline, so that the next
+	// pipeline over the same module can compute it again
+	static void release();
 };
 
 } //cheerp
@@ -0,0 +1,31 @@
+//===-- Cheerp/GlobalScalarReplacement.h - Cheerp optimization pass -------===//
+//
+//                     Cheerp: The C++ compiler for the Web
+//
+// This file is distributed under the Apache License v2.0 with LLVM Exceptions.
+// See LICENSE.TXT for details.
+//
+// Copyright 2023 Leaning Technologies
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef _CHEERP_GLOBAL_SCALAR_REPLACEMENT_H
+#define _CHEERP_GLOBAL_SCALAR_REPLACEMENT_H
+
+#include "llvm/IR/PassManager.h"
+
+namespace cheerp {
+
+// Split aggregate globals in linear memory whose fields are only reached by
+// loads and stores through constant offsets into one global per field. Each
+// field is then accessed directly, which allows LinearMemoryHelper to promote
+// it to a wasm global (or an asm.js module variable) instead of keeping it in
+// memory.
+class GlobalScalarReplacementPass: public llvm::PassInfoMixin<GlobalScalarReplacementPass> {
+public:
+	llvm::PreservedAnalyses run(llvm::Module& M, llvm::ModuleAnalysisManager& MAM);
+};
+
+}
+
+#endif //_CHEERP_GLOBAL_SCALAR_REPLACEMENT_H
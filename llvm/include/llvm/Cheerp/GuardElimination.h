@@ -0,0 +1,31 @@
+//===-- Cheerp/GuardElimination.h - Cheerp optimization pass --------------===//
+//
+//                     Cheerp: The C++ compiler for the Web
+//
+// This file is distributed under the Apache License v2.0 with LLVM Exceptions.
+// See LICENSE.TXT for details.
+//
+// Copyright 2023 Leaning Technologies
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef _CHEERP_GUARD_ELIMINATION_H
+#define _CHEERP_GUARD_ELIMINATION_H
+
+#include "llvm/IR/PassManager.h"
+
+namespace cheerp {
+
+// Function-local statics with a dynamic initializer are protected by a guard
+// variable. When the initializer only touches the static itself it is evaluated
+// at compile time, its result becomes the initial value of the static and the
+// guard is considered always set. The checks, the __cxa_guard_* calls and the
+// initialization code are then removed as dead code by the following passes.
+class GuardEliminationPass: public llvm::PassInfoMixin<GuardEliminationPass> {
+public:
+	llvm::PreservedAnalyses run(llvm::Module& M, llvm::ModuleAnalysisManager& MAM);
+};
+
+}
+
+#endif //_CHEERP_GUARD_ELIMINATION_H
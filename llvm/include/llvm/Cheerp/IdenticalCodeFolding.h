@@ -33,6 +33,21 @@ struct pair_hash {
 	}
 };
 
+class HashAccumulator64 {
+	uint64_t hash;
+public:
+	HashAccumulator64() {
+		// Initialize to random constant, so the state isn't zero.
+		hash = 0x6acaa36bef8325c5ULL;
+	}
+	void add(uint64_t value) {
+		hash = llvm::hashing::detail::hash_16_bytes(hash, value);
+	}
+	uint64_t getHash() {
+		return hash;
+	}
+};
+
 /**
  * Determine which globals (variables and functions) can be folded since they
  * are identical.
@@ -46,7 +61,10 @@ public:
 
 private:
 	std::unordered_map<std::pair<const llvm::Instruction*, const llvm::Instruction*>, bool, pair_hash> equivalenceCache;
-	uint64_t hashFunction(llvm::Function& F);
+	// The hashes only read the IR, so they can be computed in parallel
+	static uint64_t hashFunction(const llvm::Function& F);
+	static void hashOperand(HashAccumulator64& hash, const llvm::Value* V);
+	static void hashType(HashAccumulator64& hash, const llvm::Type* T);
 
 	bool equivalentFunction(const llvm::Function* A, const llvm::Function* B);
 	bool equivalentBlock(const llvm::BasicBlock* A, const llvm::BasicBlock* B);
@@ -55,9 +73,9 @@ private:
 	bool equivalentConstant(const llvm::Constant* A, const llvm::Constant* B);
 	bool equivalentType(const llvm::Type* A, const llvm::Type* B);
 	bool equivalentGep(const llvm::GetElementPtrInst* A, const llvm::GetElementPtrInst* B);
-	bool ignoreInstruction(const llvm::Instruction* I);
+	static bool ignoreInstruction(const llvm::Instruction* I);
 	bool hasSameIntegerBitWidth(const llvm::Type* A, const llvm::Type* B);
-	bool isStaticIndirectFunction(const llvm::Value* A);
+	static bool isStaticIndirectFunction(const llvm::Value* A);
 	bool isFunctionExternal(const llvm::Function* F);
 
 	void mergeTwoFunctions(llvm::Function* F, llvm::Function* G);
@@ -70,21 +88,6 @@ private:
 	std::vector<llvm::Function*> deleteList;
 };
 
-class HashAccumulator64 {
-	uint64_t hash;
-public:
-	HashAccumulator64() {
-		// Initialize to random constant, so the state isn't zero.
-		hash = 0x6acaa36bef8325c5ULL;
-	}
-	void add(uint64_t value) {
-		hash = llvm::hashing::detail::hash_16_bytes(hash, value);
-	}
-	uint64_t getHash() {
-		return hash;
-	}
-};
-
 class IdenticalCodeFoldingPass : public llvm::PassInfoMixin<IdenticalCodeFoldingPass> {
 public:
 	llvm::PreservedAnalyses run(llvm::Module& M, llvm::ModuleAnalysisManager& MAM);
@@ -0,0 +1,33 @@
+//===-- Cheerp/InstrProfLowering.h - Cheerp profile counters lowering -----===//
+//
+//                     Cheerp: The C++ compiler for the Web
+//
+// This file is distributed under the Apache License v2.0 with LLVM Exceptions.
+// See LICENSE.TXT for details.
+//
+// Copyright 2023 Leaning Technologies
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef _CHEERP_INSTR_PROF_LOWERING_H
+#define _CHEERP_INSTR_PROF_LOWERING_H
+
+#include "llvm/IR/PassManager.h"
+
+namespace cheerp {
+
+// Lower the llvm.instrprof intrinsics emitted by -fprofile-instr-generate.
+// Each instrumented function gets a slice of a single array of counters, which
+// lives in linear memory if any instrumented function is compiled to
+// asm.js/wasm and in a JS typed array otherwise. The slices are described by
+// the cheerp_profile_counters and cheerp_profile_functions named metadata,
+// which the JS writer uses to serialize the counters.
+class InstrProfLoweringPass: public llvm::PassInfoMixin<InstrProfLoweringPass> {
+public:
+	llvm::PreservedAnalyses run(llvm::Module& M, llvm::ModuleAnalysisManager&);
+	static bool isRequired() { return true; }
+};
+
+}
+
+#endif //_CHEERP_INSTR_PROF_LOWERING_H
@@ -0,0 +1,87 @@
+//===-- Cheerp/LazyLinker.h - Demand-driven linking of bitcode libraries --===//
+//
+//                     Cheerp: The C++ compiler for the Web
+//
+// This file is distributed under the Apache License v2.0 with LLVM Exceptions.
+// See LICENSE.TXT for details.
+//
+// Copyright 2023 Leaning Technologies
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef _CHEERP_LAZY_LINKER_H
+#define _CHEERP_LAZY_LINKER_H
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace llvm {
+class Comdat;
+class Constant;
+class GlobalValue;
+class LLVMContext;
+class Linker;
+class Module;
+}
+
+namespace cheerp {
+
+// Archive-style symbol resolution for the system and user libraries. Each
+// library is either a plain bitcode file, which is a single member, or an
+// archive of bitcode members, indexed through its symbol table.
+//
+// Starting from the symbols left undefined in the destination module, the
+// explicit roots, the runtime functions which the Cheerp passes may introduce
+// calls to, the definitions referenced by named metadata (which covers
+// jsexported functions and classes) and the constructors of every pulled
+// member, the definitions are followed transitively through the symbol index.
+// Using a library function also requires the ones the optimizer may rewrite
+// its calls into, like puts for printf.
+// Only reachable function bodies are ever materialized, members which are not
+// reached are not linked, and unreachable definitions are stripped from the
+// others before they are handed to the IR linker.
+class LazyLibraryLinker
+{
+public:
+	LazyLibraryLinker(llvm::LLVMContext& Context, llvm::Module& Composite, bool Verbose = false, bool IgnoreNonBitcode = false);
+	~LazyLibraryLinker();
+	llvm::Error addLibrary(std::unique_ptr<llvm::MemoryBuffer> Buffer);
+	llvm::Error link(llvm::Linker& L, llvm::ArrayRef<std::string> Roots);
+private:
+	struct Member;
+	llvm::Expected<llvm::Module*> load(Member& Mem);
+	llvm::Error indexSymbol(llvm::StringRef Name, Member& Mem, bool Weak);
+	llvm::Error require(llvm::StringRef Name);
+	llvm::Error reach(Member& Mem, llvm::GlobalValue* Root);
+	void reachConstant(const llvm::Constant* C, llvm::SmallVectorImpl<llvm::GlobalValue*>& Worklist);
+	void stripUnreached(Member& Mem);
+
+	llvm::LLVMContext& Context;
+	llvm::Module& Composite;
+	bool Verbose;
+	bool IgnoreNonBitcode;
+	std::vector<std::unique_ptr<llvm::MemoryBuffer>> Buffers;
+	std::vector<std::unique_ptr<Member>> Members;
+	// Symbol name to the member defining it. Strong definitions override weak
+	// ones, otherwise the first definition wins
+	struct IndexedSymbol
+	{
+		Member* Mem;
+		bool Weak;
+	};
+	llvm::StringMap<IndexedSymbol> SymbolIndex;
+	std::vector<std::string> PendingSymbols;
+	std::vector<std::pair<Member*, llvm::GlobalValue*>> PendingRoots;
+	llvm::SmallPtrSet<const llvm::Constant*, 32> VisitedConstants;
+};
+
+}
+
+#endif //_CHEERP_LAZY_LINKER_H
@@ -194,6 +194,10 @@ public:
 	}
 
 	uint32_t getGlobalVariableAddress(const llvm::GlobalVariable* G) const;
+	bool hasGlobalVariableAddress(const llvm::GlobalVariable* G) const
+	{
+		return globalAddresses.count(G);
+	}
 	const llvm::GlobalVariable* getGlobalVariableFromAddress(llvm::Value* C) const;
 	uint32_t getFunctionAddress(const llvm::Function* F) const;
 	bool functionHasAddress(const llvm::Function* F) const;
@@ -309,6 +313,10 @@ public:
 		assert(builtinIds[b] != std::numeric_limits<uint32_t>::max());
 		return builtinIds[b];
 	}
+	bool hasBuiltinId(BuiltinInstr::BUILTIN b) const
+	{
+		return builtinIds[b] != std::numeric_limits<uint32_t>::max();
+	}
 
 	bool canGrowMemory() const {
 		return growMem;
@@ -371,6 +379,7 @@ private:
 	std::vector<const llvm::GlobalVariable*> asmjsAddressableGlobals;
 	GlobalUsageMap globalizedGlobalsUsage;
 	void generateGlobalizedGlobalsUsage();
+	static bool canGlobalizeAsmJS(const llvm::GlobalVariable& GV);
 
 	FunctionAddressesMap functionAddresses;
 	GlobalAddressesMap globalAddresses;
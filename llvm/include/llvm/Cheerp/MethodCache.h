@@ -0,0 +1,61 @@
+//===-- Cheerp/MethodCache.h - Cache of compiled functions ----------------===//
+//
+//                     Cheerp: The C++ compiler for the Web
+//
+// This file is distributed under the Apache License v2.0 with LLVM Exceptions.
+// See LICENSE.TXT for details.
+//
+// Copyright 2023 Leaning Technologies
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef _CHEERP_METHOD_CACHE_H
+#define _CHEERP_METHOD_CACHE_H
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/IR/Instruction.h"
+#include "llvm/IR/ModuleSlotTracker.h"
+#include "llvm/Support/raw_ostream.h"
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace cheerp {
+
+// Content addressed, on disk cache of the compiled bodies of functions, used
+// by both the wasm and the JS writers. The keys are computed by the writers
+// and must cover everything the output depends on. Entries are written
+// atomically, so the cache can be shared by concurrent builds, and any I/O
+// failure is treated as a miss.
+class MethodCache
+{
+public:
+	struct Entry
+	{
+		std::string body;
+		// Offset in the body and direction of the branch hints (wasm)
+		std::vector<std::pair<uint32_t, bool>> branchHints;
+		// Bitmask of the heaps accessed by the function (JS)
+		uint32_t usedHeaps = 0;
+	};
+	// The extension keeps apart the entries of different writers
+	MethodCache(llvm::StringRef directory, llvm::StringRef extension);
+	bool lookup(llvm::StringRef key, Entry& entry) const;
+	void store(llvm::StringRef key, const Entry& entry) const;
+private:
+	std::string getEntryPath(llvm::StringRef key) const;
+	std::string directory;
+	std::string extension;
+};
+
+// Print the version and the revision of the compiler, so that the entries of a
+// different build are never reused even if the method encoding was not bumped
+void printCompilerIdentityForKey(llvm::raw_ostream& os);
+
+// Print an instruction as part of a cache key. Metadata slots are numbered
+// module wide, so they are dropped and the branch weights are printed by value
+void printInstructionForKey(const llvm::Instruction& I, llvm::raw_ostream& os, llvm::ModuleSlotTracker& MST);
+
+}
+
+#endif //_CHEERP_METHOD_CACHE_H
@@ -68,6 +68,8 @@ public:
 		HANDLE_VAARG,
 		EXCEPTION,
 		FETCHBUFFER,
+		TAIL_CALL,
+		TRAMPOLINE,
 		MEMORY,
 		HEAP8,
 		HEAP16,
@@ -82,7 +84,7 @@ public:
 	 * all the global variable names
 	 */
 	explicit NameGenerator( const llvm::Module&, const GlobalDepsAnalyzer &, Registerize &, const PointerAnalyzer& PA, LinearMemoryHelper& linearHelper,
-		const std::vector<std::string>& reservedNames, bool makeReadableNames, bool exportedMemory );
+		const std::vector<std::string>& reservedNames, bool makeReadableNames, bool exportedMemory, llvm::StringRef nameMapFile );
 
 	/**
 	 * Return the computed name for the given variable.
@@ -173,7 +175,39 @@ public:
 	// Determine if an instruction actually needs a name
 	bool needsName(const llvm::Instruction &, const PointerAnalyzer& PA) const;
 
+	/**
+	 * Print the names of the arguments and registers of F in a deterministic order,
+	 * for the keys of the JS codegen cache
+	 */
+	void printLocalNamesForKey(const llvm::Function& F, llvm::raw_ostream& os) const;
+	/**
+	 * Same as above for the names of the types and of the builtins
+	 */
+	void printGlobalNamesForKey(llvm::raw_ostream& os) const;
+	/**
+	 * Return the name of a global value, or an empty string if it has none
+	 */
+	llvm::StringRef findGlobalName(const llvm::GlobalValue* GV, uint32_t elemIdx) const
+	{
+		const auto& map = elemIdx == 0 ? namemap : secondaryNamemap;
+		auto it = map.find(GV);
+		return it == map.end() ? llvm::StringRef() : llvm::StringRef(it->second);
+	}
+
 private:
+	// We either encode arguments in the Value or a pair of (Function, register id)
+	// This will be unified to the second case when we registerize args
+	struct localData
+	{
+		const llvm::Value* argOrFunc;
+		uint32_t regId;
+		bool needsSecondaryName;
+	};
+	typedef std::pair<unsigned, localData> useLocalPair;
+	typedef std::vector<useLocalPair> useLocalVec;
+	// Collect the registers and the arguments of the function, sorted by increasing number of uses
+	useLocalVec collectFunctionLocals(const llvm::Function& f);
+
 	void assignLocalName(llvm::StringRef name)
 	{
 		if (shortestLocalName.size() == 0 || name.size() < shortestLocalName.size())
@@ -181,6 +215,7 @@ private:
 	}
 	void generateCompressedNames( const llvm::Module& M, const GlobalDepsAnalyzer &, LinearMemoryHelper& linearHelper, bool exportedMemory);
 	void generateReadableNames( const llvm::Module& M, const GlobalDepsAnalyzer &, LinearMemoryHelper& linearHelper );
+	void generateStableNames( const llvm::Module& M, const GlobalDepsAnalyzer &, LinearMemoryHelper& linearHelper, bool exportedMemory, llvm::StringRef nameMapFile );
 
 	Registerize& registerize;
 	const PointerAnalyzer& PA;
@@ -0,0 +1,45 @@
+//===-- Cheerp/PartitionedLTO.h - Parallel link time optimization ---------===//
+//
+//                     Cheerp: The C++ compiler for the Web
+//
+// This file is distributed under the Apache License v2.0 with LLVM Exceptions.
+// See LICENSE.TXT for details.
+//
+// Copyright 2023 Leaning Technologies
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef _CHEERP_PARTITIONED_LTO_H
+#define _CHEERP_PARTITIONED_LTO_H
+
+#include "llvm/IR/PassManager.h"
+#include <functional>
+
+namespace cheerp {
+
+// Run a link time optimization pipeline on partitions of the module in
+// parallel. The functions are split in balanced partitions, keeping together
+// the comdat groups and the local functions with a single caller, and small
+// callees are imported as available_externally in the partitions calling them
+// so that they can still be inlined. Local globals referenced across
+// partitions are temporarily made external. Each partition is optimized in its
+// own thread and LLVMContext, then they are linked back into the module and the
+// original linkages are restored.
+class PartitionedLTOPass: public llvm::PassInfoMixin<PartitionedLTOPass> {
+public:
+	// Runs the per-partition pipeline on a module. It is called concurrently
+	// from the worker threads, each with a different LLVMContext, or once on
+	// the calling thread with the whole module if it is not worth partitioning
+	typedef std::function<void(llvm::Module&, bool isPartition)> PartitionPipeline;
+	explicit PartitionedLTOPass(PartitionPipeline pipeline): pipeline(std::move(pipeline))
+	{
+	}
+	llvm::PreservedAnalyses run(llvm::Module& M, llvm::ModuleAnalysisManager& MAM);
+	static bool isRequired() { return true; }
+private:
+	PartitionPipeline pipeline;
+};
+
+}
+
+#endif //_CHEERP_PARTITIONED_LTO_H
@@ -39,6 +39,13 @@
 #include "llvm/Cheerp/FFIWrapping.h"
 #include "llvm/Cheerp/StoreMerging.h"
 #include "llvm/Cheerp/CallConstructors.h"
+#include "llvm/Cheerp/DynamicCastLowering.h"
+#include "llvm/Cheerp/DowncastFolding.h"
+#include "llvm/Cheerp/GuardElimination.h"
+#include "llvm/Cheerp/GlobalScalarReplacement.h"
+#include "llvm/Cheerp/ExternRefTableLowering.h"
+#include "llvm/Cheerp/PartitionedLTO.h"
+#include "llvm/Cheerp/InstrProfLowering.h"
 #include "llvm/Cheerp/CommandLine.h"
 
 namespace cheerp {
@@ -12,6 +12,7 @@
 #ifndef _CHEERP_POINTER_PASSES_H
 #define _CHEERP_POINTER_PASSES_H
 
+#include "llvm/Analysis/PostDominators.h"
 #include "llvm/IR/Instructions.h"
 #include "llvm/IR/Module.h"
 #include "llvm/IR/Dominators.h"
@@ -94,6 +95,20 @@ public:
 	static bool isRequired() { return true;}
 };
 
+/**
+ * This pass replaces genericjs allocations of a fixed size which never escape
+ * the function with allocas, so that SROA can promote their fields to registers
+ */
+
+//===----------------------------------------------------------------------===//
+//
+// AllocateToAlloca
+//
+class AllocateToAllocaPass : public llvm::PassInfoMixin<AllocateToAllocaPass> {
+public:
+	llvm::PreservedAnalyses run(llvm::Function& F, llvm::FunctionAnalysisManager& FAM);
+};
+
 
 
 /**
@@ -141,6 +141,8 @@ enum class WasmOpcode {
 	I64_REINTERPRET_F64 = 0xbd,
 	F32_REINTERPRET_I32 = 0xbe,
 	F64_REINTERPRET_I64 = 0xbf,
+	REF_IS_NULL = 0xd1,
+	MISC = 0xfc,
 	SIMD = 0xfd,
 };
 
@@ -166,6 +168,14 @@ enum class WasmU32Opcode {
 	TEE_LOCAL = 0x22,
 	GET_GLOBAL = 0x23,
 	SET_GLOBAL = 0x24,
+	TABLE_GET = 0x25,
+	TABLE_SET = 0x26,
+	REF_NULL = 0xd0,
+};
+
+enum class WasmMiscU32Opcode {
+	TABLE_GROW = 0x0f,
+	TABLE_SIZE = 0x10,
 };
 
 enum class WasmU32U32Opcode {
@@ -27,6 +27,7 @@
 #include "llvm/ADT/DenseSet.h"
 #include "llvm/IR/DebugLoc.h"
 #include "llvm/IR/Metadata.h"
+#include "llvm/IR/ModuleSlotTracker.h"
 #include "llvm/IR/DebugInfo.h"
 #include "llvm/Support/FormattedStream.h"
 
@@ -311,6 +312,9 @@ private:
 	// Whether to export the function table from the module
 	const bool exportedTable;
 
+	// Whether the module stores JS objects in a table of externref values
+	const bool externRefTable;
+
 	mutable std::vector<uint32_t> nopLocations;
 
 	void filterNop(llvm::SmallVectorImpl<char>& buffer, std::function<void(uint32_t, char)> filterCallback) const;
@@ -375,6 +379,9 @@ private:
 	void compileExportSection();
 	void compileElementSection();
 	void compileCodeSection();
+	// Keys of the per-function codegen cache, see -cheerp-wasm-codegen-cache
+	std::string computeCodegenConfigKey() const;
+	std::string computeMethodCacheKey(const llvm::Function& F, llvm::StringRef configKey, llvm::ModuleSlotTracker& MST) const;
 	void compileDataSection();
 	void compileNameSection();
 
@@ -404,6 +411,7 @@ private:
 	bool isSignedLoad(const llvm::Value* V) const;
 	bool isReturnPartOfTailCall(const llvm::Instruction& ti) const;
 	bool isTailCall(const llvm::CallInst& ci) const;
+	static bool isNoOpTailCallBitCast(const llvm::Instruction& I);
 	// Returns true if, by potentially inverting commutative instructions, there is a way
 	// to use the last written register as the first operand
 	bool mayHaveLastWrittenRegAsFirstOperand(const llvm::Value* v) const;
@@ -496,12 +504,19 @@ public:
 		sharedMemory(sharedMemory),
 		noGrowMemory(!linearHelper.canGrowMemory()),
 		exportedTable(exportedTable),
+		externRefTable(usesExternRefTable(m)),
 		PA(PA),
 		inlineableCache(PA),
 		stream(s)
 	{
 	}
 	void makeWasm();
+	static bool usesExternRefTable(const llvm::Module& m);
+	// The externref table comes after the function table, if there is one
+	uint32_t getExternRefTableIndex() const
+	{
+		return linearHelper.getFunctionTables().empty() ? 0 : 1;
+	}
 	void compileBB(WasmBuffer& code, const llvm::BasicBlock& BB, const llvm::PHINode* phiHandledAsResult = nullptr);
 	void compileDowncast(WasmBuffer& code, const llvm::CallBase* callV);
 	void compileConstantExpr(WasmBuffer& code, const llvm::ConstantExpr* ce);
@@ -521,6 +536,7 @@ public:
 	static void encodeInst(WasmSIMDU32U32Opcode opcode, uint32_t i1, uint32_t i2, WasmBuffer& code);
 	static void encodeInst(WasmSIMDU32U32U32Opcode opcode, uint32_t i1, uint32_t i2, uint32_t i3, WasmBuffer& code);
 	static void encodeInst(WasmU32U32Opcode opcode, uint32_t i1, uint32_t i2, WasmBuffer& code);
+	static void encodeInst(WasmMiscU32Opcode opcode, uint32_t immediate, WasmBuffer& code);
 	void encodeInst(WasmInvalidOpcode opcode, WasmBuffer& code);
 	void encodeVectorConstantZero(WasmBuffer& code);
 	void encodeConstantDataVector(WasmBuffer& code, const llvm::ConstantDataVector* cdv);
@@ -17,6 +17,7 @@
 #include "llvm/Cheerp/BaseWriter.h"
 #include "llvm/Cheerp/GlobalDepsAnalyzer.h"
 #include "llvm/Cheerp/LinearMemoryHelper.h"
+#include "llvm/Cheerp/MethodCache.h"
 #include "llvm/Cheerp/NameGenerator.h"
 #include "llvm/Cheerp/PointerAnalyzer.h"
 #include "llvm/Cheerp/Registerize.h"
@@ -48,7 +49,7 @@ class ostream_proxy
 {
 public:
 	ostream_proxy( llvm::raw_ostream & s, SourceMapGenerator* g, bool readableOutput = false ) :
-		stream(s),
+		stream(&s),
 		sourceMapGenerator(g),
 		readableOutput(readableOutput),
 		newLine(true),
@@ -57,9 +58,9 @@ public:
 
 	friend ostream_proxy& operator<<( ostream_proxy & os, char c )
 	{
-		uint64_t begin = os.stream.tell();
+		uint64_t begin = os.stream->tell();
 		os.write_indent(c);
-		uint64_t end = os.stream.tell();
+		uint64_t end = os.stream->tell();
 		if(os.sourceMapGenerator)
 			os.sourceMapGenerator->addLineOffset(end-begin);
 		return os;
@@ -67,9 +68,9 @@ public:
 
 	friend ostream_proxy& operator<<( ostream_proxy & os, llvm::StringRef s )
 	{
-		uint64_t begin = os.stream.tell();
+		uint64_t begin = os.stream->tell();
 		os.write_indent(s);
-		uint64_t end = os.stream.tell();
+		uint64_t end = os.stream->tell();
 		if(os.sourceMapGenerator)
 			os.sourceMapGenerator->addLineOffset(end-begin);
 		return os;
@@ -81,7 +82,7 @@ public:
 			return os;
 		if(os.sourceMapGenerator)
 			os.sourceMapGenerator->finishLine();
-		os.stream << '\n';
+		*os.stream << '\n';
 		os.newLine = true;
 		return os;
 	}
@@ -91,14 +92,14 @@ public:
 		!std::is_convertible<T&&, llvm::StringRef>::value, // Use this only if T is not convertible to StringRef
 		ostream_proxy&>::type operator<<( ostream_proxy & os, T && t )
 	{
-		uint64_t begin = os.stream.tell();
+		uint64_t begin = os.stream->tell();
 		if ( os.newLine && os.readableOutput )
 			for ( int i = 0; i < os.indentLevel; i++ )
-				os.stream << '\t';
+				*os.stream << '\t';
 
-		os.stream << std::forward<T>(t);
+		*os.stream << std::forward<T>(t);
 		os.newLine = false;
-		uint64_t end = os.stream.tell();
+		uint64_t end = os.stream->tell();
 		if(os.sourceMapGenerator)
 			os.sourceMapGenerator->addLineOffset(end-begin);
 		return os;
@@ -108,16 +109,26 @@ public:
 	// the 'syncRawStream' method to avoid breaking sourcemaps.
 	llvm::raw_ostream & getRawStream() const
 	{
-		return stream;
+		return *stream;
 	}
 
 	void syncRawStream(uint64_t beginVal)
 	{
-		uint64_t end = stream.tell();
+		uint64_t end = stream->tell();
 		if(sourceMapGenerator)
 			sourceMapGenerator->addLineOffset(end-beginVal);
 	}
 
+	// Send the output to a different stream and return the previous one. This is not
+	// compatible with source maps, since the offsets would be out of sync
+	llvm::raw_ostream & redirect(llvm::raw_ostream & s)
+	{
+		assert(!sourceMapGenerator);
+		llvm::raw_ostream & old = *stream;
+		stream = &s;
+		return old;
+	}
+
 private:
 
 	// Return true if we are closing a curly bracket, need to unindent by 1.
@@ -146,13 +157,13 @@ private:
 
 		if ( newLine && readableOutput )
 			for ( int i = 0; i < oldIndent; i++ )
-				stream << '\t';
+				*stream << '\t';
 
-		stream << std::forward<T>(t);
+		*stream << std::forward<T>(t);
 		newLine = false;
 	}
 
-	llvm::raw_ostream & stream;
+	llvm::raw_ostream* stream;
 	SourceMapGenerator* sourceMapGenerator;
 	bool readableOutput;
 	bool newLine;
@@ -226,6 +237,19 @@ private:
 		{
 			used[id] = true;
 		}
+		// The used heaps as a bitmask, to replay the effects of cached functions
+		uint32_t getUsedMask() const
+		{
+			uint32_t mask = 0;
+			for(size_t i = 0; i < used.size(); i++)
+				mask |= used[i] ? (1u << i) : 0;
+			return mask;
+		}
+		void setUsedMask(uint32_t mask)
+		{
+			for(size_t i = 0; i < used.size(); i++)
+				used[i] = mask & (1u << i);
+		}
 	private:
 		const std::array<llvm::StringRef,6> heapNames;
 		std::array<bool, 6> used;
@@ -312,7 +336,8 @@ private:
 
 	bool isGlobalized(const llvm::Value* v) const final
 	{
-		return false;
+		const llvm::GlobalVariable* GV = llvm::dyn_cast<llvm::GlobalVariable>(v);
+		return GV && linearHelper.getGlobalizedGlobalUsage().count(GV);
 	}
 
 	/**
@@ -448,7 +473,7 @@ private:
 
 	void compileConstantExpr(const llvm::ConstantExpr* ce, PARENT_PRIORITY parentPrio, bool asmjs);
 	bool doesConstantDependOnUndefined(const llvm::Constant* C) const;
-	void compileMethodArgs(llvm::User::const_op_iterator it, llvm::User::const_op_iterator itE, const llvm::CallBase&, bool forceBoolean);
+	void compileMethodArgs(llvm::User::const_op_iterator it, llvm::User::const_op_iterator itE, const llvm::CallBase&, bool forceBoolean, bool asArray = false);
 	COMPILE_INSTRUCTION_FEEDBACK compileTerminatorInstruction(const llvm::Instruction& I);
 	bool compileCompoundStatement(const llvm::Instruction* I, uint32_t regId);
 	COMPILE_INSTRUCTION_FEEDBACK compileNotInlineableInstruction(const llvm::Instruction& I, PARENT_PRIORITY parentPrio);
@@ -470,6 +495,11 @@ private:
 	static bool omitBraces(const Token& T, const PointerAnalyzer& PA, const Registerize& registerize);
 	void compileTokens(const TokenList& Tokens);
 	void compileMethod(const llvm::Function& F);
+	// Keys of the per-function codegen cache, see -cheerp-js-codegen-cache
+	std::string computeCodegenConfigKey();
+	std::string computeMethodCacheKey(const llvm::Function& F, llvm::StringRef configKey, llvm::ModuleSlotTracker& MST) const;
+	// Compile the method or reuse the cached output, if any
+	void compileMethodCached(const llvm::Function& F, const MethodCache& methodCache, llvm::StringRef configKey, llvm::ModuleSlotTracker& MST);
 	/**
 	 * Helper structure for compiling globals
 	 */
@@ -492,6 +522,7 @@ private:
 	void compileNullPtrs();
 	void compileCreateClosure();
 	void compileHandleVAArg();
+	void compileTailCallHelpers();
 	void compileCheerpException();
 	void compileBuiltins(bool asmjs);
 	/**
@@ -577,7 +608,10 @@ private:
 	using JSExportedTypesMap = llvm::DenseMap<const llvm::Type*, llvm::StringRef>;
 	JSExportedTypesMap jsExportedTypes;
 	std::deque<JSExportedNamedDecl> jsExportedDecls;
+	// genericjs functions with musttail calls executed by the trampoline
+	llvm::DenseSet<const llvm::Function*> trampolinedFunctions;
 
+	void collectTrampolinedFunctions();
 	bool hasJSExports();
 	void compileInlineAsm(const llvm::CallInst& ci);
 
@@ -711,6 +745,11 @@ public:
 	 * Compile the function for growing the wasm linear memory
 	 */
 	void compileGrowMem();
+	/**
+	 * Compile globalThis.__cheerpProfileDump, which serializes the counters
+	 * of -fprofile-instr-generate in the llvm-profdata text format
+	 */
+	void compileProfileDump();
 	/**
 	 * Compile an helper function to assign all global heap symbols
 	 */
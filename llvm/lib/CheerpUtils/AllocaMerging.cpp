@@ -939,14 +939,20 @@ PreservedAnalyses AllocaStoresExtractorPass::run(Module& M, ModuleAnalysisManage
 	return PreservedAnalyses::none();
 }
 
+llvm::Module* AllocaStoresExtractorAnalysis::analyzedModule{nullptr};
+
 AllocaStoresExtractorWrapper AllocaStoresExtractorAnalysis::run(Module& M, ModuleAnalysisManager& MAM)
 {
-	static llvm::Module* modulePtr = nullptr;
-	assert(modulePtr != &M);
-	modulePtr = &M;
+	assert(analyzedModule != &M);
+	analyzedModule = &M;
 	return AllocaStoresExtractorWrapper();
 }
 
+void AllocaStoresExtractorAnalysis::release()
+{
+	analyzedModule = nullptr;
+}
+
 llvm::AnalysisKey AllocaStoresExtractorAnalysis::Key;
 
 }
@@ -12,6 +12,7 @@
 #include "llvm/InitializePasses.h"
 #include "llvm/Cheerp/ByValLowering.h"
 #include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/ValueTracking.h"
 #include "llvm/Cheerp/Utility.h"
 #include "llvm/IR/Instructions.h"
 #include "llvm/IR/Intrinsics.h"
@@ -24,8 +25,90 @@ STATISTIC(NumNewAllocas, "Number of new allocas created");
 
 namespace llvm {
 
+static unsigned getByValAlignment(const DataLayout& DL, const AttributeList& Attrs, unsigned ArgIdx, Type* ArgType)
+{
+	unsigned AllocAlignment = DL.getABITypeAlignment(ArgType);
+	auto Alignment = Attrs.getParamAlignment(ArgIdx);
+	if(Alignment.has_value() && Alignment.value().value() > AllocAlignment)
+		AllocAlignment = Alignment.value().value();
+	return AllocAlignment;
+}
+
+// A musttail call must not reference memory in the frame of the caller, so
+// copying the byval arguments to new allocas is not possible. The byval
+// arguments of the caller are owned by its own caller and outlive the tail
+// call, and musttail guarantees that they match the ones of the callee. So
+// the arguments are copied there instead, which is what native targets do
+// with the incoming arguments area.
+static bool ExpandMustTailCall(const DataLayout& DL, CallInst* Call)
+{
+	bool Modify = false;
+	AttributeList Attrs = Call->getAttributes();
+	Function* Caller = Call->getFunction();
+	struct ArgCopy
+	{
+		unsigned ArgIdx;
+		Value* Src;
+		Type* ArgType;
+		unsigned AllocAlignment;
+	};
+	SmallVector<ArgCopy, 4> Copies;
+	IRBuilder<> Builder(Call);
+	for (unsigned ArgIdx = 0; ArgIdx < Call->arg_size(); ++ArgIdx)
+	{
+		unsigned AttrIdx = ArgIdx + 1;
+		if (!Attrs.hasAttributeAtIndex(AttrIdx, Attribute::ByVal))
+			continue;
+		Modify = true;
+		Value *ArgPtr = Call->getArgOperand(ArgIdx);
+		Type *ArgType = Call->getParamByValType(ArgIdx);
+		Call->removeAttributeAtIndex(AttrIdx, Attribute::ByVal);
+		Call->addAttributeAtIndex(AttrIdx, Attribute::NoAlias);
+		// Forwarding the argument of the caller is the common case
+		if (ArgPtr->stripPointerCasts() == Caller->getArg(ArgIdx))
+			continue;
+		ConstantInt *ArgSize = ConstantInt::get(
+			Call->getContext(), APInt(64, DL.getTypeStoreSize(ArgType)));
+		unsigned AllocAlignment = getByValAlignment(DL, Attrs, ArgIdx, ArgType);
+		// The source may be another argument of the caller, which is going to be
+		// overwritten. Copy it to a temporary first.
+		if (isa<Argument>(getUnderlyingObject(ArgPtr)))
+		{
+			Instruction *TmpBuf = new AllocaInst(ArgType, 0, 0, Align(AllocAlignment),
+				ArgPtr->getName() + ".byval_tmp");
+			NumNewAllocas++;
+			Caller->getEntryBlock().getInstList().push_front(TmpBuf);
+			Instruction *MemCpy = Builder.CreateMemCpy(TmpBuf, MaybeAlign(AllocAlignment), ArgPtr, MaybeAlign(AllocAlignment), ArgSize,
+				false, nullptr, nullptr, nullptr, nullptr, llvm::IRBuilderBase::CheerpTypeInfo(ArgType));
+			MemCpy->setDebugLoc(Call->getDebugLoc());
+			ArgPtr = TmpBuf;
+		}
+		Copies.push_back({ArgIdx, ArgPtr, ArgType, AllocAlignment});
+	}
+	// Only overwrite the arguments of the caller after all the temporaries are ready
+	for (const ArgCopy& Copy: Copies)
+	{
+		ConstantInt *ArgSize = ConstantInt::get(
+			Call->getContext(), APInt(64, DL.getTypeStoreSize(Copy.ArgType)));
+		Value* CallerArg = Caller->getArg(Copy.ArgIdx);
+		Instruction *MemCpy = Builder.CreateMemCpy(CallerArg, MaybeAlign(Copy.AllocAlignment), Copy.Src, MaybeAlign(Copy.AllocAlignment), ArgSize,
+			false, nullptr, nullptr, nullptr, nullptr, llvm::IRBuilderBase::CheerpTypeInfo(Copy.ArgType));
+		MemCpy->setDebugLoc(Call->getDebugLoc());
+		Value* OldArg = Call->getArgOperand(Copy.ArgIdx);
+		if (CallerArg->getType() != OldArg->getType())
+			CallerArg = Builder.CreateBitCast(CallerArg, OldArg->getType());
+		Call->setArgOperand(Copy.ArgIdx, CallerArg);
+	}
+	return Modify;
+}
+
 static bool ExpandCall(const DataLayout& DL, CallBase* Call)
 {
+	if (CallInst* CI = dyn_cast<CallInst>(Call))
+	{
+		if (CI->isMustTailCall())
+			return ExpandMustTailCall(DL, CI);
+	}
 	bool Modify = false;
 	AttributeList Attrs = Call->getAttributes();
 	for (unsigned ArgIdx = 0; ArgIdx < Call->arg_size(); ++ArgIdx)
@@ -38,14 +121,7 @@ static bool ExpandCall(const DataLayout& DL, CallBase* Call)
 			Type *ArgType = Call->getParamByValType(ArgIdx);
 			ConstantInt *ArgSize = ConstantInt::get(
 				Call->getContext(), APInt(64, DL.getTypeStoreSize(ArgType)));
-			unsigned AllocAlignment = DL.getABITypeAlignment(ArgType);
-			auto Alignment = Attrs.getParamAlignment(ArgIdx);
-			if(Alignment.has_value())
-			{
-				Align a = Alignment.value();
-				if(a.value() > AllocAlignment)
-					AllocAlignment = a.value();
-			}
+			unsigned AllocAlignment = getByValAlignment(DL, Attrs, ArgIdx, ArgType);
 			// Make a copy of the byval argument.
 			Instruction *CopyBuf = new AllocaInst(ArgType, 0, 0, Align(AllocAlignment),
 				ArgPtr->getName() + ".byval_copy");
@@ -50,6 +50,8 @@ llvm::cl::opt<unsigned> CheerpStackSize("cheerp-linear-stack-size", llvm::cl::in
 
 llvm::cl::opt<bool> CheerpNoICF("cheerp-no-icf", llvm::cl::init(0), llvm::cl::desc("Disable identical code folding for wasm/asmjs") );
 
+llvm::cl::opt<bool> CheerpOptimizeForSpeed("cheerp-optimize-for-speed", llvm::cl::desc("Tune the target specific optimizations for speed instead of size") );
+
 llvm::cl::opt<bool> BoundsCheck("cheerp-bounds-check", llvm::cl::desc("Generate debug code for bounds-checking arrays") );
 
 llvm::cl::opt<bool> AvoidWasmTraps("cheerp-avoid-wasm-traps", llvm::cl::desc("Avoid traps from WebAssembly by generating more verbose code") );
@@ -68,7 +70,9 @@ llvm::cl::opt<bool> WasmExportedTable("cheerp-wasm-exported-table", llvm::cl::de
 
 llvm::cl::opt<bool> WasmExportedMemory("cheerp-wasm-exported-memory", llvm::cl::desc("Export the memory from the wasm module as 'memory'"));
 
-llvm::cl::opt<bool> WasmBranchHints("cheerp-wasm-branch-hinting", llvm::cl::desc("Enable generating branch hinting"));
+llvm::cl::opt<bool> WasmBranchHints("cheerp-wasm-branch-hinting", llvm::cl::desc("Enable generating branch hinting, and laying out the likely arm of branches first in JS"));
+
+llvm::cl::opt<unsigned> BranchHintThreshold("cheerp-branch-hint-threshold", llvm::cl::init(80), llvm::cl::desc("Minimum probability (in percent) of a branch direction to hint it in wasm and to lay it out first in JS") );
 
 llvm::cl::opt<bool> WasmAnyref("cheerp-wasm-externref", llvm::cl::desc("Enable support for the externref value type in wasm"));
 
@@ -76,10 +80,19 @@ llvm::cl::opt<bool> WasmReturnCalls("cheerp-wasm-return-calls", llvm::cl::desc("
 
 llvm::cl::opt<bool> WasmNoSIMD("cheerp-wasm-no-simd", llvm::cl::desc("Disable SIMD support"));
 
-llvm::cl::opt<bool> WasmNoGlobalization("cheerp-wasm-no-globalization", llvm::cl::desc("Disable promotion of global variables to proper wasm globals"));
+llvm::cl::opt<bool> WasmNoGlobalization("cheerp-wasm-no-globalization", llvm::cl::desc("Disable promotion of global variables to proper wasm globals or asm.js module variables"));
 
 llvm::cl::opt<bool> WasmNoUnalignedMem("cheerp-wasm-no-unaligned-mem", llvm::cl::desc("Disable the use of unaligned load/stores in optimizations"));
 
 llvm::cl::opt<bool> UseBigInts("cheerp-use-bigints", llvm::cl::desc("Use the BigInt type in JS to represent i64 values"));
 
 llvm::cl::opt<bool> KeepInvokes("cheerp-keep-invokes", llvm::cl::desc("Don't lower invokes to calls"));
+
+llvm::cl::opt<std::string> WasmCodegenCache("cheerp-wasm-codegen-cache", llvm::cl::Optional,
+  llvm::cl::desc("If specified, the directory used to cache the compiled wasm functions between builds"), llvm::cl::value_desc("directory"));
+
+llvm::cl::opt<std::string> NameMap("cheerp-name-map", llvm::cl::Optional,
+  llvm::cl::desc("If specified, the file used to keep the minified JS names stable between builds"), llvm::cl::value_desc("filename"));
+
+llvm::cl::opt<std::string> JSCodegenCache("cheerp-js-codegen-cache", llvm::cl::Optional,
+  llvm::cl::desc("If specified, the directory used to cache the compiled JS functions between builds"), llvm::cl::value_desc("directory"));
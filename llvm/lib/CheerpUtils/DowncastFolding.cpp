@@ -0,0 +1,126 @@
+//===-- DowncastFolding.cpp - Cheerp optimization pass --------------------===//
+//
+//                     Cheerp: The C++ compiler for the Web
+//
+// This file is distributed under the Apache License v2.0 with LLVM Exceptions.
+// See LICENSE.TXT for details.
+//
+// Copyright 2023 Leaning Technologies
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/Cheerp/DowncastFolding.h"
+#include "llvm/Cheerp/Utility.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Operator.h"
+
+#define DEBUG_TYPE "CheerpDowncastFolding"
+STATISTIC(NumFoldedDowncasts, "Number of cheerp_downcast calls folded to the containing object");
+STATISTIC(NumFoldedDowncastCurrents, "Number of cheerp_downcast_current calls folded to 0");
+
+using namespace llvm;
+
+namespace cheerp {
+
+namespace {
+
+bool isBaseMember(const Module& M, StructType* st, uint32_t index)
+{
+	uint32_t firstBase, baseCount;
+	if(TypeSupport::getBasesInfo(M, st, firstBase, baseCount) && index >= firstBase && index < firstBase + baseCount)
+		return true;
+	// The direct base is flattened at the beginning of the derived class
+	if(st->getDirectBase() && index < st->getDirectBase()->getNumElements())
+		return isBaseMember(M, st->getDirectBase(), index);
+	return false;
+}
+
+// Returns the object containing the base pointed by the downcast argument, if it has the downcast type
+Value* getDowncastObject(const IntrinsicInst& II)
+{
+	Type* srcType = II.getParamElementType(0);
+	Type* dstType = II.getType()->getPointerElementType();
+	// Downcasts to i8* are used for pointers to member functions and exceptions
+	if(!dstType->isStructTy() || TypeSupport::isClientType(dstType))
+		return nullptr;
+	GEPOperator* GEP = dyn_cast<GEPOperator>(II.getArgOperand(0));
+	if(!GEP || GEP->getNumIndices() < 2 || GEP->getSourceElementType() != dstType)
+		return nullptr;
+	if(GEP->getPointerOperand()->getType() != II.getType())
+		return nullptr;
+	const ConstantInt* first = dyn_cast<ConstantInt>(GEP->idx_begin()->get());
+	if(!first || !first->isZero())
+		return nullptr;
+	const Module& M = *II.getModule();
+	Type* cur = dstType;
+	for(auto it = GEP->idx_begin() + 1; it != GEP->idx_end(); ++it)
+	{
+		StructType* st = dyn_cast<StructType>(cur);
+		const ConstantInt* index = dyn_cast<ConstantInt>(it->get());
+		// Only walk through bases, a downcast from a member is not valid
+		if(!st || !index || !isBaseMember(M, st, index->getZExtValue()))
+			return nullptr;
+		cur = st->getElementType(index->getZExtValue());
+	}
+	if(cur != srcType)
+		return nullptr;
+	return GEP->getPointerOperand();
+}
+
+bool isCompleteObject(const Value* V)
+{
+	V = V->stripPointerCastsSafe();
+	if(isa<GlobalVariable>(V) || isa<AllocaInst>(V))
+		return true;
+	if(const IntrinsicInst* II = dyn_cast<IntrinsicInst>(V))
+		return II->getIntrinsicID() == Intrinsic::cheerp_allocate;
+	return false;
+}
+
+}
+
+PreservedAnalyses DowncastFoldingPass::run(Function& F, FunctionAnalysisManager&)
+{
+	// In asm.js/wasm downcast_current returns the pointer itself, not an offset
+	bool asmjs = F.getSection() == StringRef("asmjs");
+	SmallVector<IntrinsicInst*, 8> toErase;
+	for(BasicBlock& BB: F)
+	{
+		for(Instruction& I: BB)
+		{
+			IntrinsicInst* II = dyn_cast<IntrinsicInst>(&I);
+			if(!II)
+				continue;
+			if(II->getIntrinsicID() == Intrinsic::cheerp_downcast)
+			{
+				Value* object = getDowncastObject(*II);
+				if(!object)
+					continue;
+				II->replaceAllUsesWith(object);
+				toErase.push_back(II);
+				NumFoldedDowncasts++;
+			}
+			else if(II->getIntrinsicID() == Intrinsic::cheerp_downcast_current && !asmjs)
+			{
+				// Complete objects are always at offset 0
+				if(!isCompleteObject(II->getArgOperand(0)))
+					continue;
+				II->replaceAllUsesWith(ConstantInt::get(II->getType(), 0));
+				toErase.push_back(II);
+				NumFoldedDowncastCurrents++;
+			}
+		}
+	}
+	for(IntrinsicInst* II: toErase)
+		II->eraseFromParent();
+	if(toErase.empty())
+		return PreservedAnalyses::all();
+	return PreservedAnalyses::none();
+}
+
+}
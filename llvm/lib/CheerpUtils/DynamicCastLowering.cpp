@@ -0,0 +1,271 @@
+//===-- DynamicCastLowering.cpp - Cheerp optimization pass ----------------===//
+//
+//                     Cheerp: The C++ compiler for the Web
+//
+// This file is distributed under the Apache License v2.0 with LLVM Exceptions.
+// See LICENSE.TXT for details.
+//
+// Copyright 2023 Leaning Technologies
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/Cheerp/DynamicCastLowering.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/ADT/StringSwitch.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Operator.h"
+#include "llvm/Support/CommandLine.h"
+
+#include <algorithm>
+
+#define DEBUG_TYPE "CheerpDynamicCastLowering"
+STATISTIC(NumLoweredDynamicCasts, "Number of dynamic_cast calls lowered to type_info comparisons");
+
+using namespace llvm;
+
+static cl::opt<unsigned> DynamicCastMaxCompares("cheerp-dynamic-cast-max-compares", cl::init(8), cl::Hidden,
+	cl::desc("Maximum number of type_info comparisons emitted when lowering a dynamic_cast"));
+
+namespace cheerp {
+
+namespace {
+
+enum TypeInfoKind { CLASS, SI_CLASS, VMI_CLASS, NOT_A_CLASS };
+
+struct TypeInfoNode
+{
+	TypeInfoKind kind{NOT_A_CLASS};
+	// The only direct base, only valid for SI_CLASS
+	const GlobalVariable* base{nullptr};
+	// Directly derived classes, flagged with true if they use single inheritance
+	SmallVector<std::pair<const GlobalVariable*, bool>, 4> derived;
+};
+
+class ClassHierarchy
+{
+public:
+	explicit ClassHierarchy(const Module& M);
+	bool isComplete() const { return complete; }
+	// Returns true if src is reached from dst only through single inheritance links
+	bool isSingleInheritanceBase(const GlobalVariable* src, const GlobalVariable* dst) const;
+	// Collect dst and all the classes derived from it. Returns false if any of them
+	// uses multiple or virtual inheritance, or if there are more than maxSize
+	bool collectSubtree(const GlobalVariable* dst, SmallVectorImpl<const GlobalVariable*>& subtree, unsigned maxSize) const;
+private:
+	void collectBases(const Constant* C, SmallVectorImpl<const GlobalVariable*>& bases) const;
+	DenseMap<const GlobalVariable*, TypeInfoNode> nodes;
+	bool complete{true};
+};
+
+// Cheerp refers to vtables and type_infos through casts of all-zero-index GEPs,
+// which stripPointerCastsSafe keeps on targets that are not byte addressable
+const Value* stripTypeInfoPointer(const Value* V)
+{
+	V = V->stripPointerCastsSafe();
+	while(const GEPOperator* GEP = dyn_cast<GEPOperator>(V))
+	{
+		if(!GEP->hasAllZeroIndices())
+			break;
+		V = GEP->getPointerOperand()->stripPointerCastsSafe();
+	}
+	return V;
+}
+
+TypeInfoKind getTypeInfoKind(const GlobalVariable* GV)
+{
+	if(!GV->hasInitializer())
+		return NOT_A_CLASS;
+	const ConstantStruct* init = dyn_cast<ConstantStruct>(GV->getInitializer());
+	if(!init || init->getNumOperands() < 2)
+		return NOT_A_CLASS;
+	const GlobalVariable* vtable = dyn_cast<GlobalVariable>(stripTypeInfoPointer(init->getOperand(0)));
+	if(!vtable)
+		return NOT_A_CLASS;
+	return StringSwitch<TypeInfoKind>(vtable->getName())
+		.Case("_ZTVN10__cxxabiv117__class_type_infoE", CLASS)
+		.Case("_ZTVN10__cxxabiv120__si_class_type_infoE", SI_CLASS)
+		.Case("_ZTVN10__cxxabiv121__vmi_class_type_infoE", VMI_CLASS)
+		.Default(NOT_A_CLASS);
+}
+
+ClassHierarchy::ClassHierarchy(const Module& M)
+{
+	for(const GlobalVariable& GV: M.globals())
+	{
+		// A type_info we can't see may hide classes derived from the ones we know about
+		if(GV.isDeclaration() && GV.getName().startswith("_ZTI"))
+		{
+			complete = false;
+			return;
+		}
+		TypeInfoKind kind = getTypeInfoKind(&GV);
+		if(kind == NOT_A_CLASS)
+			continue;
+		nodes[&GV].kind = kind;
+	}
+	for(auto& it: nodes)
+	{
+		const GlobalVariable* GV = it.first;
+		TypeInfoNode& node = it.second;
+		const ConstantStruct* init = cast<ConstantStruct>(GV->getInitializer());
+		if(node.kind == SI_CLASS)
+		{
+			const GlobalVariable* base = init->getNumOperands() > 2 ?
+				dyn_cast<GlobalVariable>(stripTypeInfoPointer(init->getOperand(2))) : nullptr;
+			if(!base || !nodes.count(base))
+			{
+				complete = false;
+				return;
+			}
+			node.base = base;
+		}
+		else if(node.kind == VMI_CLASS)
+		{
+			// Operand 0 and 1 are the vtable and the name, the bases are stored afterwards
+			SmallVector<const GlobalVariable*, 4> bases;
+			for(unsigned i = 2; i < init->getNumOperands(); i++)
+				collectBases(cast<Constant>(init->getOperand(i)), bases);
+			for(const GlobalVariable* base: bases)
+				nodes.find(base)->second.derived.push_back(std::make_pair(GV, false));
+		}
+	}
+	// Add the single inheritance links in module order, so that the generated code is deterministic
+	for(const GlobalVariable& GV: M.globals())
+	{
+		auto it = nodes.find(&GV);
+		if(it == nodes.end() || it->second.kind != SI_CLASS)
+			continue;
+		nodes.find(it->second.base)->second.derived.push_back(std::make_pair(&GV, true));
+	}
+}
+
+void ClassHierarchy::collectBases(const Constant* C, SmallVectorImpl<const GlobalVariable*>& bases) const
+{
+	const Value* stripped = stripTypeInfoPointer(C);
+	if(const GlobalVariable* GV = dyn_cast<GlobalVariable>(stripped))
+	{
+		if(nodes.count(GV) && std::find(bases.begin(), bases.end(), GV) == bases.end())
+			bases.push_back(GV);
+		return;
+	}
+	for(const Use& op: cast<Constant>(stripped)->operands())
+		collectBases(cast<Constant>(op.get()), bases);
+}
+
+bool ClassHierarchy::isSingleInheritanceBase(const GlobalVariable* src, const GlobalVariable* dst) const
+{
+	const GlobalVariable* cur = dst;
+	while(cur != src)
+	{
+		auto it = nodes.find(cur);
+		if(it == nodes.end() || it->second.kind != SI_CLASS)
+			return false;
+		cur = it->second.base;
+	}
+	return true;
+}
+
+bool ClassHierarchy::collectSubtree(const GlobalVariable* dst, SmallVectorImpl<const GlobalVariable*>& subtree, unsigned maxSize) const
+{
+	subtree.push_back(dst);
+	for(unsigned i = 0; i < subtree.size(); i++)
+	{
+		auto it = nodes.find(subtree[i]);
+		if(it == nodes.end())
+			return false;
+		for(const auto& derived: it->second.derived)
+		{
+			if(!derived.second)
+				return false;
+			subtree.push_back(derived.first);
+		}
+		if(subtree.size() > maxSize)
+			return false;
+	}
+	return true;
+}
+
+bool lowerDynamicCast(CallInst* CI, const ClassHierarchy& hierarchy)
+{
+	// Arguments are: downcast offset, vtable, static type, destination type, offset hint
+	if(CI->arg_size() != 5)
+		return false;
+	const GlobalVariable* src = dyn_cast<GlobalVariable>(stripTypeInfoPointer(CI->getArgOperand(2)));
+	const GlobalVariable* dst = dyn_cast<GlobalVariable>(stripTypeInfoPointer(CI->getArgOperand(3)));
+	if(!src || !dst)
+		return false;
+	if(!hierarchy.isSingleInheritanceBase(src, dst))
+		return false;
+	SmallVector<const GlobalVariable*, 8> subtree;
+	if(!hierarchy.collectSubtree(dst, subtree, DynamicCastMaxCompares))
+		return false;
+
+	// The type_info is the last member of both __vtable_base and __vtable_base_asmjs
+	Value* vtable = CI->getArgOperand(1);
+	if(vtable->getType()->isOpaquePointerTy())
+		return false;
+	StructType* vtableBaseTy = dyn_cast<StructType>(vtable->getType()->getNonOpaquePointerElementType());
+	if(!vtableBaseTy || vtableBaseTy->isOpaque() || vtableBaseTy->getNumElements() == 0)
+		return false;
+	unsigned rttiIndex = vtableBaseTy->getNumElements() - 1;
+	Type* rttiTy = vtableBaseTy->getElementType(rttiIndex);
+	if(!rttiTy->isPointerTy())
+		return false;
+
+	IRBuilder<> Builder(CI);
+	Value* dynamicType = Builder.CreateLoad(rttiTy, Builder.CreateStructGEP(vtableBaseTy, vtable, rttiIndex));
+	Value* isDst = nullptr;
+	for(const GlobalVariable* GV: subtree)
+	{
+		Constant* typeInfo = ConstantExpr::getBitCast(const_cast<GlobalVariable*>(GV), rttiTy);
+		Value* cmp = Builder.CreateICmpEQ(dynamicType, typeInfo);
+		isDst = isDst ? Builder.CreateOr(isDst, cmp) : cmp;
+	}
+	// Single inheritance bases are always at offset 0, failure is encoded as INT_MIN
+	IntegerType* offsetTy = cast<IntegerType>(CI->getType());
+	Value* success = ConstantInt::get(offsetTy, 0);
+	Value* failure = ConstantInt::get(offsetTy, APInt::getSignedMinValue(offsetTy->getBitWidth()));
+	CI->replaceAllUsesWith(Builder.CreateSelect(isDst, success, failure));
+	CI->eraseFromParent();
+	NumLoweredDynamicCasts++;
+	return true;
+}
+
+}
+
+PreservedAnalyses DynamicCastLoweringPass::run(Module& M, ModuleAnalysisManager&)
+{
+	Function* dynamicCasts[] = { M.getFunction("__dynamic_cast_genericjs"), M.getFunction("__dynamic_cast_asmjs") };
+	if(!dynamicCasts[0] && !dynamicCasts[1])
+		return PreservedAnalyses::all();
+
+	ClassHierarchy hierarchy(M);
+	if(!hierarchy.isComplete())
+		return PreservedAnalyses::all();
+
+	bool Changed = false;
+	for(Function* F: dynamicCasts)
+	{
+		if(!F)
+			continue;
+		SmallVector<CallInst*, 16> calls;
+		for(User* U: F->users())
+		{
+			CallInst* CI = dyn_cast<CallInst>(U);
+			if(CI && CI->getCalledFunction() == F)
+				calls.push_back(CI);
+		}
+		for(CallInst* CI: calls)
+			Changed |= lowerDynamicCast(CI, hierarchy);
+	}
+	if(!Changed)
+		return PreservedAnalyses::all();
+	return PreservedAnalyses::none();
+}
+
+}
@@ -0,0 +1,270 @@
+//===-- ExternRefTableLowering.cpp - Cheerp optimization pass -------------===//
+//
+//                     Cheerp: The C++ compiler for the Web
+//
+// This file is distributed under the Apache License v2.0 with LLVM Exceptions.
+// See LICENSE.TXT for details.
+//
+// Copyright 2023 Leaning Technologies
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/Cheerp/ExternRefTableLowering.h"
+#include "llvm/Cheerp/CommandLine.h"
+#include "llvm/Cheerp/Utility.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Intrinsics.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/ErrorHandling.h"
+
+using namespace llvm;
+
+static cl::opt<unsigned> ExternRefTableMinGrow("cheerp-externref-table-min-grow", cl::init(16), cl::Hidden,
+	cl::desc("Minimum number of slots added to the externref table when it is full"));
+
+namespace cheerp {
+
+namespace {
+
+struct ExternRefTableAllocator
+{
+	Module& M;
+	PointerType* refTy;
+	// Number of free slots in the table. The table starts with only slot 0,
+	// which is reserved for null
+	GlobalVariable* freeSlots;
+	// All the slots below this one are in use
+	GlobalVariable* firstFree;
+
+	ExternRefTableAllocator(Module& M, PointerType* refTy);
+	Function* createAllocFunction();
+	Function* createFreeFunction();
+};
+
+ExternRefTableAllocator::ExternRefTableAllocator(Module& M, PointerType* refTy): M(M), refTy(refTy)
+{
+	Type* Int32Ty = Type::getInt32Ty(M.getContext());
+	freeSlots = new GlobalVariable(M, Int32Ty, false, GlobalValue::InternalLinkage,
+			ConstantInt::get(Int32Ty, 0), "__cheerp_externref_table_free_slots");
+	freeSlots->setSection("asmjs");
+	// Slot 0 is reserved for null
+	firstFree = new GlobalVariable(M, Int32Ty, false, GlobalValue::InternalLinkage,
+			ConstantInt::get(Int32Ty, 1), "__cheerp_externref_table_first_free");
+	firstFree->setSection("asmjs");
+}
+
+Function* ExternRefTableAllocator::createAllocFunction()
+{
+	LLVMContext& Ctx = M.getContext();
+	Type* Int32Ty = Type::getInt32Ty(Ctx);
+	FunctionType* FTy = FunctionType::get(Int32Ty, { refTy }, false);
+	Function* F = Function::Create(FTy, GlobalValue::InternalLinkage, "__cheerp_externref_table_alloc", &M);
+	F->setSection("asmjs");
+	Function* tableGet = Intrinsic::getDeclaration(&M, Intrinsic::cheerp_externref_table_get, { refTy });
+	Function* tableSet = Intrinsic::getDeclaration(&M, Intrinsic::cheerp_externref_table_set, { refTy });
+	Function* tableSize = Intrinsic::getDeclaration(&M, Intrinsic::cheerp_externref_table_size);
+	Function* tableGrow = Intrinsic::getDeclaration(&M, Intrinsic::cheerp_externref_table_grow, { refTy });
+	Constant* nullRef = ConstantPointerNull::get(refTy);
+	Constant* zero = ConstantInt::get(Int32Ty, 0);
+	Constant* one = ConstantInt::get(Int32Ty, 1);
+	Argument* obj = F->getArg(0);
+
+	BasicBlock* entry = BasicBlock::Create(Ctx, "entry", F);
+	BasicBlock* nullObj = BasicBlock::Create(Ctx, "null", F);
+	BasicBlock* notNullObj = BasicBlock::Create(Ctx, "notnull", F);
+	BasicBlock* grow = BasicBlock::Create(Ctx, "grow", F);
+	BasicBlock* growFailed = BasicBlock::Create(Ctx, "grow.failed", F);
+	BasicBlock* grown = BasicBlock::Create(Ctx, "grown", F);
+	BasicBlock* search = BasicBlock::Create(Ctx, "search", F);
+	BasicBlock* loop = BasicBlock::Create(Ctx, "loop", F);
+	BasicBlock* found = BasicBlock::Create(Ctx, "found", F);
+
+	IRBuilder<> Builder(entry);
+	Builder.CreateCondBr(Builder.CreateICmpEQ(obj, nullRef), nullObj, notNullObj);
+
+	Builder.SetInsertPoint(nullObj);
+	Builder.CreateRet(zero);
+
+	Builder.SetInsertPoint(notNullObj);
+	Value* freeCount = Builder.CreateLoad(Int32Ty, freeSlots);
+	Builder.CreateCondBr(Builder.CreateICmpEQ(freeCount, zero), grow, search);
+
+	// Double the size of the table. All the existing slots are in use, so the
+	// search starts from the first new one
+	Builder.SetInsertPoint(grow);
+	Value* size = Builder.CreateCall(tableSize);
+	Constant* minGrow = ConstantInt::get(Int32Ty, std::max(1u, unsigned(ExternRefTableMinGrow)));
+	Value* delta = Builder.CreateSelect(Builder.CreateICmpULT(size, minGrow), minGrow, size);
+	Value* oldSize = Builder.CreateCall(tableGrow, { nullRef, delta });
+	Builder.CreateCondBr(Builder.CreateICmpEQ(oldSize, ConstantInt::get(Int32Ty, -1)), growFailed, grown);
+
+	Builder.SetInsertPoint(growFailed);
+	Builder.CreateCall(Intrinsic::getDeclaration(&M, Intrinsic::trap));
+	Builder.CreateUnreachable();
+
+	Builder.SetInsertPoint(grown);
+	Builder.CreateStore(delta, freeSlots);
+	Builder.CreateStore(oldSize, firstFree);
+	Builder.CreateBr(search);
+
+	Builder.SetInsertPoint(search);
+	Value* start = Builder.CreateLoad(Int32Ty, firstFree);
+	Builder.CreateBr(loop);
+
+	// There is at least a free slot, and none of them is below the start
+	Builder.SetInsertPoint(loop);
+	PHINode* slot = Builder.CreatePHI(Int32Ty, 2);
+	Value* next = Builder.CreateAdd(slot, one);
+	slot->addIncoming(start, search);
+	slot->addIncoming(next, loop);
+	Value* current = Builder.CreateCall(tableGet, { slot });
+	Builder.CreateCondBr(Builder.CreateICmpEQ(current, nullRef), found, loop);
+
+	Builder.SetInsertPoint(found);
+	Builder.CreateCall(tableSet, { slot, obj });
+	Builder.CreateStore(next, firstFree);
+	Value* remaining = Builder.CreateLoad(Int32Ty, freeSlots);
+	Builder.CreateStore(Builder.CreateSub(remaining, one), freeSlots);
+	Builder.CreateRet(slot);
+	return F;
+}
+
+Function* ExternRefTableAllocator::createFreeFunction()
+{
+	LLVMContext& Ctx = M.getContext();
+	Type* Int32Ty = Type::getInt32Ty(Ctx);
+	FunctionType* FTy = FunctionType::get(Type::getVoidTy(Ctx), { Int32Ty }, false);
+	Function* F = Function::Create(FTy, GlobalValue::InternalLinkage, "__cheerp_externref_table_free", &M);
+	F->setSection("asmjs");
+	Function* tableGet = Intrinsic::getDeclaration(&M, Intrinsic::cheerp_externref_table_get, { refTy });
+	Function* tableSet = Intrinsic::getDeclaration(&M, Intrinsic::cheerp_externref_table_set, { refTy });
+	Constant* nullRef = ConstantPointerNull::get(refTy);
+	Argument* slot = F->getArg(0);
+
+	BasicBlock* entry = BasicBlock::Create(Ctx, "entry", F);
+	BasicBlock* release = BasicBlock::Create(Ctx, "release", F);
+	BasicBlock* exit = BasicBlock::Create(Ctx, "exit", F);
+
+	// Slot 0 always holds null, and releasing an already free slot does nothing
+	IRBuilder<> Builder(entry);
+	Value* current = Builder.CreateCall(tableGet, { slot });
+	Builder.CreateCondBr(Builder.CreateICmpEQ(current, nullRef), exit, release);
+
+	// Clear the slot, so the object can be garbage collected
+	Builder.SetInsertPoint(release);
+	Builder.CreateCall(tableSet, { slot, nullRef });
+	Value* freeCount = Builder.CreateLoad(Int32Ty, freeSlots);
+	Builder.CreateStore(Builder.CreateAdd(freeCount, ConstantInt::get(Int32Ty, 1)), freeSlots);
+	Value* first = Builder.CreateLoad(Int32Ty, firstFree);
+	Builder.CreateStore(Builder.CreateSelect(Builder.CreateICmpULT(slot, first), slot, first), firstFree);
+	Builder.CreateBr(exit);
+
+	Builder.SetInsertPoint(exit);
+	Builder.CreateRetVoid();
+	return F;
+}
+
+bool isAllocatorFunction(const Function& F)
+{
+	return F.hasInternalLinkage() && (F.getName() == "__cheerp_externref_table_alloc" ||
+		F.getName() == "__cheerp_externref_table_free");
+}
+
+// The pointer type stored in the table, any of them is an externref in wasm
+PointerType* getTableRefType(const Function& F)
+{
+	switch(F.getIntrinsicID())
+	{
+		case Intrinsic::cheerp_externref_table_get:
+			return cast<PointerType>(F.getReturnType());
+		case Intrinsic::cheerp_externref_table_set:
+			return cast<PointerType>(F.getFunctionType()->getParamType(1));
+		case Intrinsic::cheerp_externref_table_grow:
+		case Intrinsic::cheerp_externref_table_alloc:
+			return cast<PointerType>(F.getFunctionType()->getParamType(0));
+		default:
+			return nullptr;
+	}
+}
+
+}
+
+PreservedAnalyses ExternRefTableLoweringPass::run(Module& M, ModuleAnalysisManager& MAM)
+{
+	SmallVector<CallInst*, 8> allocs;
+	SmallVector<CallInst*, 8> frees;
+	PointerType* refTy = nullptr;
+	for(Function& F: M)
+	{
+		Intrinsic::ID id = F.getIntrinsicID();
+		if(id != Intrinsic::cheerp_externref_table_get && id != Intrinsic::cheerp_externref_table_set &&
+			id != Intrinsic::cheerp_externref_table_size && id != Intrinsic::cheerp_externref_table_grow &&
+			id != Intrinsic::cheerp_externref_table_alloc && id != Intrinsic::cheerp_externref_table_free)
+			continue;
+		for(User* U: F.users())
+		{
+			CallInst* CI = cast<CallInst>(U);
+			if(LinearOutput != Wasm || !WasmAnyref || CI->getFunction()->getSection() != StringRef("asmjs"))
+				report_fatal_error("The externref table is only available in wasm code, with externref support enabled");
+			// Only the allocator can store objects in the table or grow it,
+			// anything else would corrupt its bookkeeping
+			if((id == Intrinsic::cheerp_externref_table_set || id == Intrinsic::cheerp_externref_table_size ||
+				id == Intrinsic::cheerp_externref_table_grow) && !isAllocatorFunction(*CI->getFunction()))
+				report_fatal_error("The externref table can only be modified with __builtin_cheerp_externref_table_alloc and __builtin_cheerp_externref_table_free");
+			if(id == Intrinsic::cheerp_externref_table_alloc)
+				allocs.push_back(CI);
+			else if(id == Intrinsic::cheerp_externref_table_free)
+				frees.push_back(CI);
+		}
+		if(F.use_empty())
+			continue;
+		PointerType* tableRefTy = getTableRefType(F);
+		if(tableRefTy && TypeSupport::isRawPointer(tableRefTy, true))
+			report_fatal_error("The externref table can only store JS objects, not pointers to linear memory");
+		if(!refTy)
+			refTy = tableRefTy;
+	}
+	if(allocs.empty() && frees.empty())
+		return PreservedAnalyses::all();
+
+	// Nothing can be stored in the table, there is nothing to release
+	if(!refTy)
+	{
+		for(CallInst* CI: frees)
+			CI->eraseFromParent();
+		return PreservedAnalyses::none();
+	}
+
+	ExternRefTableAllocator allocator(M, refTy);
+	if(!allocs.empty())
+	{
+		Function* allocFunc = allocator.createAllocFunction();
+		for(CallInst* CI: allocs)
+		{
+			Value* obj = CI->getArgOperand(0);
+			if(obj->getType() != refTy)
+				obj = new BitCastInst(obj, refTy, "", CI);
+			CallInst* newCall = CallInst::Create(allocFunc, { obj }, "", CI);
+			newCall->setDebugLoc(CI->getDebugLoc());
+			CI->replaceAllUsesWith(newCall);
+			CI->eraseFromParent();
+		}
+	}
+	if(!frees.empty())
+	{
+		Function* freeFunc = allocator.createFreeFunction();
+		for(CallInst* CI: frees)
+		{
+			CallInst* newCall = CallInst::Create(freeFunc, { CI->getArgOperand(0) }, "", CI);
+			newCall->setDebugLoc(CI->getDebugLoc());
+			CI->eraseFromParent();
+		}
+	}
+	return PreservedAnalyses::none();
+}
+
+}
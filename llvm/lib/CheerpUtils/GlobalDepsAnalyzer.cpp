@@ -756,6 +756,16 @@ bool GlobalDepsAnalyzer::runOnModule( llvm::Module & module )
 		externals.push_back(BitCastSlot);
 	}
 
+	// The profile counters created by InstrProfLowering are only read as a
+	// whole by the writer. Keep them, and ensure external linkage to prevent
+	// GlobalOpts from splitting them
+	if (GlobalVariable* ProfileCounters = module.getGlobalVariable("__cheerp_prf_cnts"))
+	{
+		SubExprVec vec;
+		visitGlobal(ProfileCounters, visited, vec );
+		externals.push_back(ProfileCounters);
+	}
+
 	auto markAsReachableIfPresent = [this, &visited](Function* F)
 	{
 		if (F) {
@@ -1449,6 +1459,10 @@ void GlobalDepsAnalyzer::visitFunction(const Function* F, VisitedSet& visited)
 		{
 			if (const CallBase* CB = dyn_cast<CallBase>(u))
 			{
+				// Downcasts by a constant 0 offset are compiled as plain casts and don't need the
+				// downcast array. Downcasts from a type to itself are kept, they are used for exceptions
+				if (isNopCast(CB))
+					continue;
 				Type* currElementType = CB->getParamElementType(0);
 				if (!elementType)
 					elementType = currElementType;
@@ -1764,10 +1778,19 @@ llvm::PreservedAnalyses GlobalDepsAnalyzerPass::run(Module& M, ModuleAnalysisMan
 AnalysisKey GlobalDepsAnalysis::Key;
 GlobalDepsAnalyzer* GlobalDepsAnalyzerWrapper::innerPtr{nullptr};
 
+llvm::Module* GlobalDepsAnalysis::analyzedModule{nullptr};
+
 GlobalDepsAnalyzerWrapper GlobalDepsAnalysis::run(Module& M, ModuleAnalysisManager& MAM)
 {
-	static llvm::Module* modulePtr = nullptr;
-	assert(modulePtr != &M);
-	modulePtr = &M;
+	// The state lives in the analyzer built by GlobalDepsAnalyzerPass, it must
+	// never be silently recomputed in the middle of a pipeline
+	assert(analyzedModule != &M);
+	analyzedModule = &M;
 	return GlobalDepsAnalyzerWrapper();
 }
+
+void GlobalDepsAnalysis::release()
+{
+	analyzedModule = nullptr;
+	GlobalDepsAnalyzerWrapper::release();
+}
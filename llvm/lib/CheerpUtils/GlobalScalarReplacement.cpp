@@ -0,0 +1,214 @@
+//===-- GlobalScalarReplacement.cpp - Cheerp optimization pass ------------===//
+//
+//                     Cheerp: The C++ compiler for the Web
+//
+// This file is distributed under the Apache License v2.0 with LLVM Exceptions.
+// See LICENSE.TXT for details.
+//
+// Copyright 2023 Leaning Technologies
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/Cheerp/GlobalScalarReplacement.h"
+#include "llvm/Cheerp/CommandLine.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/ConstantFolding.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Operator.h"
+#include "llvm/IR/ValueHandle.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Transforms/Utils/Local.h"
+
+#include <map>
+
+#define DEBUG_TYPE "CheerpGlobalScalarReplacement"
+STATISTIC(NumSplitGlobals, "Number of aggregate globals split into their fields");
+STATISTIC(NumFieldGlobals, "Number of globals created for the fields of aggregate globals");
+
+using namespace llvm;
+
+static cl::opt<unsigned> GlobalScalarReplacementMaxFields("cheerp-global-sra-max-fields", cl::init(64), cl::Hidden,
+	cl::desc("Maximum number of fields of an aggregate global that are split into separate globals"));
+
+namespace cheerp {
+
+namespace {
+
+// The type accessed at each offset, ordered by offset
+typedef std::map<uint64_t, Type*> FieldsMap;
+
+struct FieldAccess
+{
+	Instruction* I;
+	uint64_t offset;
+};
+
+bool isFieldType(Type* Ty)
+{
+	if(Ty->isIntegerTy())
+	{
+		uint32_t bits = Ty->getIntegerBitWidth();
+		return bits == 8 || bits == 16 || bits == 32 || bits == 64;
+	}
+	return Ty->isFloatTy() || Ty->isDoubleTy() || Ty->isPointerTy();
+}
+
+// Collect the loads and stores reaching the global through bitcasts and
+// constant GEPs, together with the type accessed at each offset. Returns false
+// if the global is used in any other way, like from a constant initializer,
+// llvm.used or metadata, or from outside linear memory code
+bool collectFieldAccesses(GlobalVariable& GV, const DataLayout& DL, FieldsMap& fields, SmallVectorImpl<FieldAccess>& accesses)
+{
+	SmallVector<Use*, 16> worklist;
+	for(Use& U: GV.uses())
+		worklist.push_back(&U);
+	while(!worklist.empty())
+	{
+		Use* U = worklist.pop_back_val();
+		User* user = U->getUser();
+		GEPOperator* GEP = dyn_cast<GEPOperator>(user);
+		if(isa<BitCastOperator>(user) || (GEP && GEP->getPointerOperand() == U->get() && GEP->hasAllConstantIndices()))
+		{
+			// Metadata may refer to the global through a constant expression too
+			if(user->isUsedByMetadata())
+				return false;
+			for(Use& userUse: user->uses())
+				worklist.push_back(&userUse);
+			continue;
+		}
+		Instruction* I = dyn_cast<Instruction>(user);
+		if(!I || I->getFunction()->getSection() != StringRef("asmjs"))
+			return false;
+		Type* accessTy = nullptr;
+		if(LoadInst* LI = dyn_cast<LoadInst>(I))
+		{
+			if(LI->isSimple())
+				accessTy = LI->getType();
+		}
+		else if(StoreInst* SI = dyn_cast<StoreInst>(I))
+		{
+			// Storing the address somewhere is an escape
+			if(SI->isSimple() && U->getOperandNo() == SI->getPointerOperandIndex())
+				accessTy = SI->getValueOperand()->getType();
+		}
+		if(!accessTy || !isFieldType(accessTy))
+			return false;
+		APInt offset(DL.getIndexTypeSizeInBits(U->get()->getType()), 0);
+		const Value* base = U->get()->stripAndAccumulateConstantOffsets(DL, offset, /*AllowNonInbounds*/true);
+		if(base != &GV || offset.isNegative())
+			return false;
+		// Accessing the same offset with different types would need a bitcast
+		auto it = fields.emplace(offset.getZExtValue(), accessTy).first;
+		if(it->second != accessTy)
+			return false;
+		accesses.push_back({I, offset.getZExtValue()});
+	}
+	return true;
+}
+
+bool splitGlobal(GlobalVariable& GV, const DataLayout& DL)
+{
+	GV.removeDeadConstantUsers();
+	FieldsMap fields;
+	SmallVector<FieldAccess, 16> accesses;
+	if(!collectFieldAccesses(GV, DL, fields, accesses) || fields.empty())
+		return false;
+	if(fields.size() > GlobalScalarReplacementMaxFields)
+		return false;
+
+	// The fields must not overlap and must be contained in the global
+	uint64_t end = 0;
+	for(const auto& field: fields)
+	{
+		if(field.first < end)
+			return false;
+		end = field.first + DL.getTypeAllocSize(field.second);
+	}
+	if(end > DL.getTypeAllocSize(GV.getValueType()))
+		return false;
+
+	SmallVector<Constant*, 16> initializers;
+	for(const auto& field: fields)
+	{
+		Constant* init = ConstantFoldLoadFromConst(GV.getInitializer(), field.second, APInt(64, field.first), DL);
+		if(!init)
+			return false;
+		initializers.push_back(init);
+	}
+
+	// Keep the alignment that the field had inside the original global
+	Align startAlign = DL.getValueOrABITypeAlignment(GV.getAlign(), GV.getValueType());
+	std::map<uint64_t, GlobalVariable*> fieldGlobals;
+	uint32_t fieldIndex = 0;
+	for(const auto& field: fields)
+	{
+		GlobalVariable* fieldGV = new GlobalVariable(*GV.getParent(), field.second, GV.isConstant(), GlobalValue::InternalLinkage,
+				initializers[fieldIndex], GV.getName() + "." + Twine(fieldIndex), &GV, GV.getThreadLocalMode(), GV.getAddressSpace());
+		fieldGV->setSection(GV.getSection());
+		Align fieldAlign = commonAlignment(startAlign, field.first);
+		if(fieldAlign > DL.getABITypeAlign(field.second))
+			fieldGV->setAlignment(fieldAlign);
+		fieldGlobals.emplace(field.first, fieldGV);
+		fieldIndex++;
+	}
+
+	SmallVector<WeakTrackingVH, 16> deadInsts;
+	for(const FieldAccess& access: accesses)
+	{
+		unsigned ptrIndex = isa<LoadInst>(access.I) ? LoadInst::getPointerOperandIndex() : StoreInst::getPointerOperandIndex();
+		Value* oldPtr = access.I->getOperand(ptrIndex);
+		Constant* newPtr = fieldGlobals.at(access.offset);
+		if(newPtr->getType() != oldPtr->getType())
+			newPtr = ConstantExpr::getPointerCast(newPtr, oldPtr->getType());
+		access.I->setOperand(ptrIndex, newPtr);
+		if(isa<Instruction>(oldPtr))
+			deadInsts.push_back(oldPtr);
+	}
+	RecursivelyDeleteTriviallyDeadInstructionsPermissive(deadInsts);
+	GV.removeDeadConstantUsers();
+	assert(GV.use_empty());
+	GV.eraseFromParent();
+
+	NumSplitGlobals++;
+	NumFieldGlobals += fields.size();
+	return true;
+}
+
+}
+
+PreservedAnalyses GlobalScalarReplacementPass::run(Module& M, ModuleAnalysisManager& MAM)
+{
+	// The fields are only worth splitting if they can become globals
+	if(WasmNoGlobalization)
+		return PreservedAnalyses::all();
+
+	SmallVector<GlobalVariable*, 16> candidates;
+	for(GlobalVariable& GV: M.globals())
+	{
+		if(GV.getSection() != StringRef("asmjs") || !GV.hasLocalLinkage() || !GV.hasDefinitiveInitializer())
+			continue;
+		if(GV.isThreadLocal() || !GV.getValueType()->isAggregateType())
+			continue;
+		// Created by GlobalDepsAnalyzer and used by name by the lowering passes
+		if(GV.getName() == "cheerpBitCastSlot")
+			continue;
+		// The writer may look the global up through metadata, like the profile
+		// counters. Only instruction users are rewritten to the new fields
+		if(GV.isUsedByMetadata())
+			continue;
+		candidates.push_back(&GV);
+	}
+
+	const DataLayout& DL = M.getDataLayout();
+	bool Changed = false;
+	for(GlobalVariable* GV: candidates)
+		Changed |= splitGlobal(*GV, DL);
+	if(!Changed)
+		return PreservedAnalyses::all();
+	return PreservedAnalyses::none();
+}
+
+}
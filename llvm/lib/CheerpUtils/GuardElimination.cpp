@@ -0,0 +1,402 @@
+//===-- GuardElimination.cpp - Cheerp optimization pass -------------------===//
+//
+//                     Cheerp: The C++ compiler for the Web
+//
+// This file is distributed under the Apache License v2.0 with LLVM Exceptions.
+// See LICENSE.TXT for details.
+//
+// Copyright 2023 Leaning Technologies
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/Cheerp/GuardElimination.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/ADT/StringSwitch.h"
+#include "llvm/Analysis/TargetLibraryInfo.h"
+#include "llvm/IR/CFG.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Operator.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/Evaluator.h"
+#include "llvm/Transforms/Utils/ValueMapper.h"
+
+#include <functional>
+
+#define DEBUG_TYPE "CheerpGuardElimination"
+STATISTIC(NumEliminatedGuards, "Number of static initialization guards removed");
+
+using namespace llvm;
+
+static cl::opt<unsigned> GuardEliminationMaxInstructions("cheerp-guard-elimination-max-instructions", cl::init(4096), cl::Hidden,
+	cl::desc("Maximum number of instructions scanned when evaluating the initializer of a function-local static"));
+
+namespace cheerp {
+
+namespace {
+
+// Initialization regions larger than this are not worth evaluating
+const unsigned MaxRegionBlocks = 64;
+
+enum GuardCallKind { GUARD_ACQUIRE, GUARD_RELEASE, GUARD_ABORT, NOT_A_GUARD_CALL };
+
+GuardCallKind getGuardCallKind(const Instruction* I)
+{
+	const CallInst* CI = dyn_cast<CallInst>(I);
+	if(!CI || !CI->getCalledFunction())
+		return NOT_A_GUARD_CALL;
+	return StringSwitch<GuardCallKind>(CI->getCalledFunction()->getName())
+		.Case("__cxa_guard_acquire", GUARD_ACQUIRE)
+		.Case("__cxa_guard_release", GUARD_RELEASE)
+		.Case("__cxa_guard_abort", GUARD_ABORT)
+		.Default(NOT_A_GUARD_CALL);
+}
+
+// Collect all the instructions using the guard, looking through constant casts.
+// Returns false if the guard is used in any way other than the code generated
+// by ItaniumCXXABI::EmitGuardedInit
+bool collectGuardUses(Value* V, SmallVectorImpl<Instruction*>& uses)
+{
+	for(User* U: V->users())
+	{
+		if(ConstantExpr* CE = dyn_cast<ConstantExpr>(U))
+		{
+			if(CE->isCast() || (isa<GEPOperator>(CE) && cast<GEPOperator>(CE)->hasAllZeroIndices()))
+			{
+				if(!collectGuardUses(CE, uses))
+					return false;
+				continue;
+			}
+			return false;
+		}
+		Instruction* I = dyn_cast<Instruction>(U);
+		if(!I)
+			return false;
+		if(isa<LoadInst>(I))
+		{
+			if(!I->getType()->isIntegerTy())
+				return false;
+		}
+		else if(StoreInst* SI = dyn_cast<StoreInst>(I))
+		{
+			if(SI->getPointerOperand() != V)
+				return false;
+		}
+		else if(getGuardCallKind(I) != NOT_A_GUARD_CALL)
+		{
+			if(cast<CallInst>(I)->getArgOperand(0) != V)
+				return false;
+		}
+		else
+			return false;
+		uses.push_back(I);
+	}
+	return true;
+}
+
+class GuardEliminator
+{
+public:
+	GuardEliminator(Module& M, FunctionAnalysisManager& FAM): M(M), FAM(FAM)
+	{
+	}
+	bool eliminateGuard(GlobalVariable* guard);
+private:
+	// Find the blocks which are only executed when the guard load LI is 0
+	bool findInitRegion(LoadInst* LI, SmallVectorImpl<BasicBlock*>& region, BasicBlock*& initEnd) const;
+	// Check that the region, and any function it may call, only reads mutable
+	// memory from the guard and the static. Evaluator assumes that every
+	// global still holds its initial value, which is only true for those two
+	bool isSelfContained(ArrayRef<BasicBlock*> region, const GlobalVariable* guard, const GlobalVariable* var) const;
+	Constant* evaluateRegion(ArrayRef<BasicBlock*> region, BasicBlock* initEnd, GlobalVariable* guard, GlobalVariable* var);
+
+	Module& M;
+	FunctionAnalysisManager& FAM;
+};
+
+bool GuardEliminator::findInitRegion(LoadInst* LI, SmallVectorImpl<BasicBlock*>& region, BasicBlock*& initEnd) const
+{
+	if(!LI->hasOneUse())
+		return false;
+	ICmpInst* cmp = dyn_cast<ICmpInst>(LI->user_back());
+	if(!cmp || !cmp->isEquality() || !cmp->hasOneUse())
+		return false;
+	Value* other = cmp->getOperand(0) == LI ? cmp->getOperand(1) : cmp->getOperand(0);
+	if(!isa<ConstantInt>(other) || !cast<ConstantInt>(other)->isZero())
+		return false;
+	BranchInst* BI = dyn_cast<BranchInst>(cmp->user_back());
+	if(!BI || !BI->isConditional())
+		return false;
+	bool isEq = cmp->getPredicate() == ICmpInst::ICMP_EQ;
+	BasicBlock* checkBlock = BI->getParent();
+	BasicBlock* initBegin = BI->getSuccessor(isEq ? 0 : 1);
+	initEnd = BI->getSuccessor(isEq ? 1 : 0);
+	if(initBegin == initEnd || initBegin->getSinglePredecessor() != checkBlock)
+		return false;
+
+	SmallPtrSet<const BasicBlock*, 16> visited;
+	region.push_back(initBegin);
+	visited.insert(initBegin);
+	for(unsigned i = 0; i < region.size(); i++)
+	{
+		BasicBlock* BB = region[i];
+		if(BB == checkBlock || BB->isEntryBlock() || isa<ReturnInst>(BB->getTerminator()))
+			return false;
+		for(BasicBlock* succ: successors(BB))
+		{
+			if(succ == initEnd || !visited.insert(succ).second)
+				continue;
+			region.push_back(succ);
+			if(region.size() > MaxRegionBlocks)
+				return false;
+		}
+	}
+	// The region must be entered only from the check and must not depend on values computed outside of it
+	for(BasicBlock* BB: region)
+	{
+		if(BB != initBegin)
+		{
+			for(BasicBlock* pred: predecessors(BB))
+				if(!visited.count(pred))
+					return false;
+		}
+		for(Instruction& I: *BB)
+		{
+			for(Value* op: I.operands())
+			{
+				if(isa<Argument>(op))
+					return false;
+				if(Instruction* opI = dyn_cast<Instruction>(op))
+					if(!visited.count(opI->getParent()))
+						return false;
+			}
+		}
+	}
+	return true;
+}
+
+bool GuardEliminator::isSelfContained(ArrayRef<BasicBlock*> region, const GlobalVariable* guard, const GlobalVariable* var) const
+{
+	SmallPtrSet<const Constant*, 32> visitedConstants;
+	SmallPtrSet<const Function*, 8> visitedFunctions;
+	SmallVector<const Function*, 8> worklist;
+	unsigned scannedInstructions = 0;
+
+	std::function<bool(const Constant*)> checkConstant = [&](const Constant* C) -> bool
+	{
+		if(!visitedConstants.insert(C).second)
+			return true;
+		if(const GlobalVariable* GV = dyn_cast<GlobalVariable>(C))
+		{
+			if(GV == guard || GV == var)
+				return true;
+			if(!GV->isConstant() || !GV->hasDefinitiveInitializer())
+				return false;
+			// Constant tables, like vtables, may contain functions that end up being called
+			return checkConstant(GV->getInitializer());
+		}
+		if(const Function* F = dyn_cast<Function>(C))
+		{
+			if(visitedFunctions.insert(F).second)
+				worklist.push_back(F);
+			return true;
+		}
+		if(isa<GlobalAlias>(C) || isa<GlobalIFunc>(C))
+			return false;
+		for(const Use& op: C->operands())
+			if(!checkConstant(cast<Constant>(op.get())))
+				return false;
+		return true;
+	};
+	auto checkBlock = [&](const BasicBlock& BB) -> bool
+	{
+		for(const Instruction& I: BB)
+		{
+			if(++scannedInstructions > GuardEliminationMaxInstructions)
+				return false;
+			// Memory reached through an integer is not tracked
+			if(isa<IntToPtrInst>(I))
+				return false;
+			for(const Value* op: I.operands())
+				if(const Constant* C = dyn_cast<Constant>(op))
+					if(!checkConstant(C))
+						return false;
+		}
+		return true;
+	};
+
+	for(const BasicBlock* BB: region)
+		if(!checkBlock(*BB))
+			return false;
+	while(!worklist.empty())
+	{
+		const Function* F = worklist.pop_back_val();
+		// Calls to declarations are rejected by the evaluator itself
+		for(const BasicBlock& BB: *F)
+			if(!checkBlock(BB))
+				return false;
+	}
+	return true;
+}
+
+Constant* GuardEliminator::evaluateRegion(ArrayRef<BasicBlock*> region, BasicBlock* initEnd, GlobalVariable* guard, GlobalVariable* var)
+{
+	Function* F = region.front()->getParent();
+	// Clone the region in a standalone function that returns where the original code joins initEnd
+	Function* evalFunc = Function::Create(FunctionType::get(Type::getVoidTy(M.getContext()), false),
+		GlobalValue::InternalLinkage, "", &M);
+	ValueToValueMapTy VMap;
+	SmallVector<BasicBlock*, 16> clones;
+	for(BasicBlock* BB: region)
+	{
+		BasicBlock* clone = CloneBasicBlock(BB, VMap, "", evalFunc);
+		VMap[BB] = clone;
+		clones.push_back(clone);
+	}
+	BasicBlock* exitBlock = BasicBlock::Create(M.getContext(), "", evalFunc);
+	ReturnInst::Create(M.getContext(), exitBlock);
+	VMap[initEnd] = exitBlock;
+	remapInstructionsInBlocks(clones, VMap);
+
+	// We are the only thread around at compile time: acquiring the guard always succeeds
+	for(BasicBlock* BB: clones)
+	{
+		for(Instruction& I: make_early_inc_range(*BB))
+		{
+			if(StoreInst* SI = dyn_cast<StoreInst>(&I))
+			{
+				if(SI->getPointerOperand()->stripPointerCasts() == guard)
+					SI->eraseFromParent();
+				continue;
+			}
+			GuardCallKind kind = getGuardCallKind(&I);
+			if(kind == NOT_A_GUARD_CALL)
+				continue;
+			if(kind == GUARD_ACQUIRE)
+				I.replaceAllUsesWith(ConstantInt::get(I.getType(), 1));
+			I.eraseFromParent();
+		}
+	}
+
+	Constant* result = nullptr;
+	{
+		Evaluator Eval(M.getDataLayout(), &FAM.getResult<TargetLibraryAnalysis>(*F));
+		Constant* retVal = nullptr;
+		SmallVector<Constant*, 0> args;
+		if(Eval.EvaluateFunction(evalFunc, retVal, args))
+		{
+			auto mutated = Eval.getMutatedInitializers();
+			bool onlyVar = true;
+			for(const auto& it: mutated)
+				onlyVar &= it.first == var;
+			if(onlyVar)
+				result = mutated.count(var) ? mutated[var] : var->getInitializer();
+			// Pointers to the temporaries used for allocas would dangle once the evaluator is gone
+			if(result)
+			{
+				SmallVector<const Constant*, 8> constants;
+				SmallPtrSet<const Constant*, 8> visited;
+				constants.push_back(result);
+				while(!constants.empty() && result)
+				{
+					const Constant* C = constants.pop_back_val();
+					if(!visited.insert(C).second)
+						continue;
+					if(const GlobalValue* GV = dyn_cast<GlobalValue>(C))
+					{
+						if(GV->getParent() != &M)
+							result = nullptr;
+						continue;
+					}
+					for(const Use& op: C->operands())
+						constants.push_back(cast<Constant>(op.get()));
+				}
+			}
+		}
+	}
+	evalFunc->dropAllReferences();
+	evalFunc->eraseFromParent();
+	return result;
+}
+
+bool GuardEliminator::eliminateGuard(GlobalVariable* guard)
+{
+	// The guard is named after the static it protects, _ZGV<name> guards _Z<name>
+	GlobalVariable* var = M.getGlobalVariable(("_Z" + guard->getName().drop_front(4)).str(), /*AllowInternal*/true);
+	if(!var || var->isConstant() || var->isThreadLocal() || !var->hasDefinitiveInitializer())
+		return false;
+
+	SmallVector<Instruction*, 8> uses;
+	if(!collectGuardUses(guard, uses))
+		return false;
+
+	// After inlining the same static may be initialized from several places,
+	// and any of them may run first. All of them must compute the same value
+	Constant* init = nullptr;
+	for(Instruction* I: uses)
+	{
+		LoadInst* LI = dyn_cast<LoadInst>(I);
+		if(!LI)
+			continue;
+		SmallVector<BasicBlock*, 16> region;
+		BasicBlock* initEnd = nullptr;
+		if(!findInitRegion(LI, region, initEnd))
+			return false;
+		if(!isSelfContained(region, guard, var))
+			return false;
+		Constant* regionInit = evaluateRegion(region, initEnd, guard, var);
+		if(!regionInit || (init && regionInit != init))
+			return false;
+		init = regionInit;
+	}
+	if(!init)
+		return false;
+
+	var->setInitializer(init);
+	// The guard is now always set, the initialization code becomes unreachable
+	for(Instruction* I: uses)
+	{
+		if(isa<LoadInst>(I))
+			I->replaceAllUsesWith(ConstantInt::get(I->getType(), 1));
+		else if(getGuardCallKind(I) == GUARD_ACQUIRE)
+			I->replaceAllUsesWith(ConstantInt::get(I->getType(), 0));
+		I->eraseFromParent();
+	}
+	guard->removeDeadConstantUsers();
+	if(guard->use_empty())
+		guard->eraseFromParent();
+	NumEliminatedGuards++;
+	return true;
+}
+
+}
+
+PreservedAnalyses GuardEliminationPass::run(Module& M, ModuleAnalysisManager& MAM)
+{
+	SmallVector<GlobalVariable*, 16> guards;
+	for(GlobalVariable& GV: M.globals())
+	{
+		if(!GV.getName().startswith("_ZGV") || !GV.hasDefinitiveInitializer() || GV.isThreadLocal())
+			continue;
+		if(!GV.getInitializer()->isNullValue())
+			continue;
+		guards.push_back(&GV);
+	}
+	if(guards.empty())
+		return PreservedAnalyses::all();
+
+	FunctionAnalysisManager& FAM = MAM.getResult<FunctionAnalysisManagerModuleProxy>(M).getManager();
+	GuardEliminator eliminator(M, FAM);
+	bool Changed = false;
+	for(GlobalVariable* guard: guards)
+		Changed |= eliminator.eliminateGuard(guard);
+	if(!Changed)
+		return PreservedAnalyses::all();
+	return PreservedAnalyses::none();
+}
+
+}
@@ -17,6 +17,7 @@
 #include "llvm/IR/GlobalValue.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/Support/Debug.h"
+#include "llvm/Support/ThreadPool.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Transforms/Utils/BasicBlockUtils.h"
 
@@ -37,15 +38,22 @@ IdenticalCodeFolding::IdenticalCodeFolding()
 
 // This function is based on
 // https://github.com/Microsoft/llvm/commit/6470102728c661adf204d0e361d30faa0a95667f
-uint64_t IdenticalCodeFolding::hashFunction(llvm::Function& F)
+// On top of the structure, it hashes a canonical form of everything that
+// equivalentFunction() compares exactly, so that functions with different
+// hashes are never equivalent and the buckets need fewer comparisons.
+uint64_t IdenticalCodeFolding::hashFunction(const llvm::Function& F)
 {
 	HashAccumulator64 hash;
 
 	hash.add(F.isVarArg());
 	hash.add(F.arg_size());
+	// Use the function type, iterating the arguments may build them lazily
+	for (const Type* paramTy : F.getFunctionType()->params())
+		hashType(hash, paramTy);
+	hashType(hash, F.getReturnType());
 
-	SmallVector<BasicBlock*, 8> blocks;
-	SmallSet<BasicBlock*, 16> visited;
+	SmallVector<const BasicBlock*, 8> blocks;
+	SmallSet<const BasicBlock*, 16> visited;
 
 	// Walk the blocks in the same order as equivalentFunction(), accumulating
 	// the hash of the function "structure." (basic block and opcode sequence)
@@ -63,15 +71,119 @@ uint64_t IdenticalCodeFolding::hashFunction(llvm::Function& F)
 			if (ignoreInstruction(&Inst))
 				continue;
 			hash.add(Inst.getOpcode());
+			hash.add(Inst.use_empty());
 
-			// In order to reduce the number of possible matches, hash the
-			// GEP's constant integer indices.
-			if (auto gep = dyn_cast<GetElementPtrInst>(&Inst)) {
-				hash.add(gep->getNumIndices());
-				if (!gep->hasAllConstantIndices())
-					continue;
-				for (unsigned i = 0; i < gep->getNumIndices(); i++)
-					hash.add(cast<ConstantInt>(gep->idx_begin() + i)->getZExtValue());
+			switch (Inst.getOpcode()) {
+				case Instruction::GetElementPtr:
+				{
+					// In order to reduce the number of possible matches, hash the
+					// GEP's constant integer indices.
+					auto gep = cast<GetElementPtrInst>(&Inst);
+					hash.add(gep->getNumIndices());
+					if (!gep->hasAllConstantIndices())
+						break;
+					for (unsigned i = 0; i < gep->getNumIndices(); i++)
+						hash.add(cast<ConstantInt>(gep->idx_begin() + i)->getZExtValue());
+					break;
+				}
+				case Instruction::Alloca:
+				{
+					auto alloca = cast<AllocaInst>(&Inst);
+					hashType(hash, alloca->getAllocatedType());
+					hash.add(alloca->getAlign().value());
+					hashOperand(hash, alloca->getArraySize());
+					break;
+				}
+				case Instruction::FCmp:
+				case Instruction::ICmp:
+					hash.add(cast<CmpInst>(&Inst)->getPredicate());
+					[[clang::fallthrough]];
+				case Instruction::Add:
+				case Instruction::And:
+				case Instruction::AShr:
+				case Instruction::LShr:
+				case Instruction::Mul:
+				case Instruction::Or:
+				case Instruction::Shl:
+				case Instruction::Sub:
+				case Instruction::SDiv:
+				case Instruction::UDiv:
+				case Instruction::SRem:
+				case Instruction::URem:
+				case Instruction::Xor:
+				case Instruction::FAdd:
+				case Instruction::FDiv:
+				case Instruction::FMul:
+				case Instruction::FSub:
+				case Instruction::FRem:
+					hashOperand(hash, Inst.getOperand(0));
+					hashOperand(hash, Inst.getOperand(1));
+					break;
+				case Instruction::SIToFP:
+				case Instruction::UIToFP:
+				case Instruction::SExt:
+				case Instruction::ZExt:
+					hash.add(Inst.getOperand(0)->getType()->getScalarSizeInBits());
+					[[clang::fallthrough]];
+				case Instruction::PtrToInt:
+				case Instruction::IntToPtr:
+				case Instruction::BitCast:
+				case Instruction::Trunc:
+				case Instruction::FPToSI:
+				case Instruction::FPToUI:
+				case Instruction::FPTrunc:
+				case Instruction::FPExt:
+				case Instruction::FNeg:
+					hashOperand(hash, Inst.getOperand(0));
+					break;
+				case Instruction::Br:
+				{
+					auto br = cast<BranchInst>(&Inst);
+					hash.add(br->isConditional());
+					if (br->isConditional())
+						hashOperand(hash, br->getCondition());
+					break;
+				}
+				case Instruction::Switch:
+					hashOperand(hash, cast<SwitchInst>(&Inst)->getCondition());
+					break;
+				case Instruction::Load:
+					hashType(hash, Inst.getType());
+					hashOperand(hash, cast<LoadInst>(&Inst)->getPointerOperand());
+					break;
+				case Instruction::Store:
+					hashOperand(hash, cast<StoreInst>(&Inst)->getPointerOperand());
+					hashOperand(hash, cast<StoreInst>(&Inst)->getValueOperand());
+					break;
+				case Instruction::Ret:
+				{
+					const Value* retVal = cast<ReturnInst>(&Inst)->getReturnValue();
+					hash.add(retVal != nullptr);
+					if (retVal)
+						hashOperand(hash, retVal);
+					break;
+				}
+				case Instruction::Call:
+				{
+					auto ci = cast<CallInst>(&Inst);
+					// Direct calls, calls through a cast of a function and
+					// indirect calls are never equivalent to each other
+					if (const Function* calledFunc = ci->getCalledFunction()) {
+						hash.add(1);
+						hash.add(calledFunc->getIntrinsicID());
+						if (calledFunc->isIntrinsic())
+							break;
+					} else {
+						hash.add(isStaticIndirectFunction(ci->getCalledOperand()) ? 2 : 3);
+					}
+					hash.add(ci->getFunctionType()->getNumParams());
+					for (unsigned i = 0; i < ci->getFunctionType()->getNumParams(); i++)
+						hashOperand(hash, ci->getArgOperand(i));
+					hash.add(ci->getType()->isVoidTy());
+					break;
+				}
+				default:
+					break;
 			}
 		}
 
@@ -86,6 +198,58 @@ uint64_t IdenticalCodeFolding::hashFunction(llvm::Function& F)
 	return hash.getHash();
 }
 
+// Hash the parts of an operand that equivalentOperand() compares exactly
+void IdenticalCodeFolding::hashOperand(HashAccumulator64& hash, const llvm::Value* V)
+{
+	hashType(hash, V->getType());
+	if (const ConstantExpr* CE = dyn_cast<ConstantExpr>(V)) {
+		hash.add(1);
+		if (CE->isCast())
+			hashOperand(hash, CE->getOperand(0));
+	} else if (const ConstantInt* CI = dyn_cast<ConstantInt>(V)) {
+		hash.add(2);
+		if (CI->getBitWidth() <= 64)
+			hash.add(CI->getZExtValue());
+	} else if (const ConstantFP* CF = dyn_cast<ConstantFP>(V)) {
+		hash.add(3);
+		APInt bits = CF->getValueAPF().bitcastToAPInt();
+		if (bits.getBitWidth() <= 64)
+			hash.add(bits.getZExtValue());
+	} else if (const Function* F = dyn_cast<Function>(V)) {
+		hash.add(4);
+		hash.add(hash_value(F->getName()));
+	} else if (isa<Constant>(V)) {
+		hash.add(5);
+	} else if (const Instruction* I = dyn_cast<Instruction>(V)) {
+		hash.add(6);
+		hash.add(I->getOpcode());
+	} else if (const Argument* A = dyn_cast<Argument>(V)) {
+		hash.add(7);
+		hash.add(A->getArgNo());
+	}
+}
+
+// Hash the parts of a type that equivalentType() compares exactly
+void IdenticalCodeFolding::hashType(HashAccumulator64& hash, const llvm::Type* T)
+{
+	if (T->isPointerTy() || T->isIntegerTy(32)) {
+		hash.add(Type::PointerTyID);
+	} else if (const ArrayType* AT = dyn_cast<ArrayType>(T)) {
+		hash.add(Type::ArrayTyID);
+		hash.add(AT->getNumElements());
+		hashType(hash, AT->getElementType());
+	} else if (const StructType* ST = dyn_cast<StructType>(T)) {
+		hash.add(Type::StructTyID);
+		hash.add(ST->getNumElements());
+		for (const Type* elementTy : ST->elements())
+			hashType(hash, elementTy);
+	} else {
+		hash.add(T->getTypeID());
+		if (T->isIntegerTy())
+			hash.add(T->getIntegerBitWidth());
+	}
+}
+
 bool IdenticalCodeFolding::equivalentFunction(const llvm::Function* A, const llvm::Function* B)
 {
 #if DEBUG_VERBOSE
@@ -466,8 +630,8 @@ bool IdenticalCodeFolding::equivalentInstruction(const llvm::Instruction* A, con
 		case Instruction::SExt:
 		case Instruction::ZExt:
 		{
-			uint32_t bitsA = A->getOperand(0)->getType()->getIntegerBitWidth();
-			uint32_t bitsB = B->getOperand(0)->getType()->getIntegerBitWidth();
+			uint32_t bitsA = A->getOperand(0)->getType()->getScalarSizeInBits();
+			uint32_t bitsB = B->getOperand(0)->getType()->getScalarSizeInBits();
 			return CacheAndReturn(bitsA == bitsB &&
 				equivalentOperand(A->getOperand(0), B->getOperand(0)));
 		}
@@ -877,8 +1041,9 @@ bool IdenticalCodeFolding::runOnModule(llvm::Module& module)
 {
 	DL = &module.getDataLayout();
 
-	// First, compute an hash of each function.
-	std::unordered_map<uint64_t, std::vector<Function*>> functionHashes;
+	// First, compute an hash of each function. Hashing only reads the IR, so
+	// it is done in parallel on large modules.
+	std::vector<Function*> candidates;
 	for (Function& F : module.getFunctionList()) {
 		if (F.isDeclaration() || F.getSection() != StringRef("asmjs"))
 			continue;
@@ -889,19 +1054,39 @@ bool IdenticalCodeFolding::runOnModule(llvm::Module& module)
 			F.getName() == wasmNullptrName) {
 			continue;
 		}
+		candidates.push_back(&F);
+	}
+
+	std::vector<uint64_t> hashes(candidates.size());
+	const size_t chunkSize = 256;
+	if (candidates.size() <= chunkSize) {
+		for (size_t i = 0; i < candidates.size(); i++)
+			hashes[i] = hashFunction(*candidates[i]);
+	} else {
+		ThreadPool pool(hardware_concurrency());
+		for (size_t begin = 0; begin < candidates.size(); begin += chunkSize) {
+			size_t end = std::min(begin + chunkSize, candidates.size());
+			pool.async([&candidates, &hashes, begin, end]() {
+				for (size_t i = begin; i < end; i++)
+					hashes[i] = hashFunction(*candidates[i]);
+			});
+		}
+		pool.wait();
+	}
 
-		uint64_t hash = hashFunction(F);
-		const auto& found = functionHashes.find(hash);
-		if (found != functionHashes.end())
-			found->second.push_back(&F);
-		else
-			functionHashes.insert({hash, {&F}});
+	// Group the functions with the same hash. Both the buckets and their
+	// members are kept in module order, so that folding is deterministic.
+	std::vector<std::vector<Function*>> buckets;
+	std::unordered_map<uint64_t, size_t> bucketIndex;
+	for (size_t i = 0; i < candidates.size(); i++) {
+		auto it = bucketIndex.insert({hashes[i], buckets.size()});
+		if (it.second)
+			buckets.emplace_back();
+		buckets[it.first->second].push_back(candidates[i]);
 	}
 
 	// Second, compare the functions that have the same hash value.
-	for (auto item : functionHashes) {
-		auto& functions = item.second;
-
+	for (auto& functions : buckets) {
 		if (functions.size() < 2)
 			continue;
 
@@ -0,0 +1,144 @@
+//===-- InstrProfLowering.cpp - Cheerp profile counters lowering ----------===//
+//
+//                     Cheerp: The C++ compiler for the Web
+//
+// This file is distributed under the Apache License v2.0 with LLVM Exceptions.
+// See LICENSE.TXT for details.
+//
+// Copyright 2023 Leaning Technologies
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/Cheerp/InstrProfLowering.h"
+#include "llvm/ADT/MapVector.h"
+#include "llvm/ADT/SetVector.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/Metadata.h"
+#include "llvm/IR/Module.h"
+
+#define DEBUG_TYPE "CheerpInstrProfLowering"
+
+STATISTIC(NumInstrumentedFunctions, "Number of functions with profile counters");
+STATISTIC(NumCounters, "Number of profile counters");
+
+using namespace llvm;
+
+namespace cheerp {
+
+namespace {
+
+struct ProfiledFunction
+{
+	uint64_t hash;
+	uint32_t firstCounter;
+	uint32_t numCounters;
+};
+
+}
+
+PreservedAnalyses InstrProfLoweringPass::run(Module& M, ModuleAnalysisManager&)
+{
+	std::vector<InstrProfInstBase*> intrinsics;
+	bool anyLinearMemory = false;
+	for(Function& F: M)
+	{
+		bool instrumented = false;
+		for(Instruction& I: instructions(F))
+		{
+			if(InstrProfInstBase* P = dyn_cast<InstrProfInstBase>(&I))
+			{
+				intrinsics.push_back(P);
+				instrumented = true;
+			}
+		}
+		if(instrumented && F.getSection() == StringRef("asmjs"))
+			anyLinearMemory = true;
+	}
+	if(intrinsics.empty())
+		return PreservedAnalyses::all();
+
+	// Assign a slice of the counters to every profiled function, keyed by the
+	// PGO name since the name variables may have been duplicated by linking
+	MapVector<StringRef, ProfiledFunction> functions;
+	SmallSetVector<GlobalVariable*, 16> nameVars;
+	uint32_t totalCounters = 0;
+	for(InstrProfInstBase* P: intrinsics)
+	{
+		GlobalVariable* nameVar = P->getName();
+		nameVars.insert(nameVar);
+		if(!isa<InstrProfIncrementInst>(P))
+			continue;
+		StringRef name = cast<ConstantDataSequential>(nameVar->getInitializer())->getAsString();
+		auto it = functions.insert(std::make_pair(name, ProfiledFunction{P->getHash()->getZExtValue(), totalCounters, 0}));
+		if(it.second)
+		{
+			uint32_t numCounters = P->getNumCounters()->getZExtValue();
+			it.first->second.numCounters = numCounters;
+			totalCounters += numCounters;
+		}
+	}
+
+	// Counters are 64-bit in linear memory, but 32-bit in genericjs to keep
+	// them in an Int32Array without requiring BigInts
+	LLVMContext& Ctx = M.getContext();
+	Type* counterTy = anyLinearMemory ? Type::getInt64Ty(Ctx) : Type::getInt32Ty(Ctx);
+	ArrayType* countersTy = ArrayType::get(counterTy, totalCounters);
+	// The writer dumps the counters as a whole, through the metadata below.
+	// Keep them external, so that they are not split into separate globals
+	GlobalVariable* counters = new GlobalVariable(M, countersTy, /*isConstant*/false, GlobalValue::ExternalLinkage,
+		ConstantAggregateZero::get(countersTy), "__cheerp_prf_cnts");
+	if(anyLinearMemory)
+		counters->setSection("asmjs");
+
+	for(InstrProfInstBase* P: intrinsics)
+	{
+		if(InstrProfIncrementInst* Inc = dyn_cast<InstrProfIncrementInst>(P))
+		{
+			StringRef name = cast<ConstantDataSequential>(Inc->getName()->getInitializer())->getAsString();
+			const ProfiledFunction& PF = functions.find(name)->second;
+			uint32_t index = Inc->getIndex()->getZExtValue();
+			assert(index < PF.numCounters);
+			IRBuilder<> Builder(Inc);
+			Value* addr = Builder.CreateConstInBoundsGEP2_32(countersTy, counters, 0, PF.firstCounter + index);
+			Value* step = Builder.CreateZExtOrTrunc(Inc->getStep(), counterTy);
+			Value* count = Builder.CreateLoad(counterTy, addr);
+			Builder.CreateStore(Builder.CreateAdd(count, step), addr);
+		}
+		// Value profiling and coverage are not supported, only drop them
+		P->eraseFromParent();
+	}
+	for(GlobalVariable* nameVar: nameVars)
+	{
+		nameVar->removeDeadConstantUsers();
+		if(nameVar->use_empty() && nameVar->isDiscardableIfUnused())
+			nameVar->eraseFromParent();
+	}
+
+	NamedMDNode* countersMD = M.getOrInsertNamedMetadata("cheerp_profile_counters");
+	countersMD->addOperand(MDNode::get(Ctx, ConstantAsMetadata::get(counters)));
+	NamedMDNode* functionsMD = M.getOrInsertNamedMetadata("cheerp_profile_functions");
+	Type* Int32Ty = Type::getInt32Ty(Ctx);
+	for(const auto& it: functions)
+	{
+		Metadata* ops[] = {
+			MDString::get(Ctx, it.first),
+			ConstantAsMetadata::get(ConstantInt::get(Type::getInt64Ty(Ctx), it.second.hash)),
+			ConstantAsMetadata::get(ConstantInt::get(Int32Ty, it.second.firstCounter)),
+			ConstantAsMetadata::get(ConstantInt::get(Int32Ty, it.second.numCounters)),
+		};
+		functionsMD->addOperand(MDNode::get(Ctx, ops));
+	}
+
+	NumInstrumentedFunctions += functions.size();
+	NumCounters += totalCounters;
+
+	PreservedAnalyses PA;
+	PA.preserveSet<CFGAnalyses>();
+	return PA;
+}
+
+}
@@ -0,0 +1,487 @@
+//===-- LazyLinker.cpp - Demand-driven linking of bitcode libraries -------===//
+//
+//                     Cheerp: The C++ compiler for the Web
+//
+// This file is distributed under the Apache License v2.0 with LLVM Exceptions.
+// See LICENSE.TXT for details.
+//
+// Copyright 2023 Leaning Technologies
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/Cheerp/LazyLinker.h"
+#include "llvm/Cheerp/BuiltinInstructions.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringSwitch.h"
+#include "llvm/BinaryFormat/Magic.h"
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/IR/AutoUpgrade.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Intrinsics.h"
+#include "llvm/IR/Metadata.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IRReader/IRReader.h"
+#include "llvm/Linker/Linker.h"
+#include "llvm/Object/Archive.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+
+namespace cheerp {
+
+// A module from a lazy library, either a whole bitcode file or an archive
+// member. It is only parsed when one of its symbols is needed
+struct LazyLibraryLinker::Member
+{
+	Member(std::string Name, MemoryBufferRef Buffer): Name(std::move(Name)), Buffer(Buffer)
+	{
+	}
+	std::string Name;
+	MemoryBufferRef Buffer;
+	std::unique_ptr<Module> M;
+	// Global values reachable from the program, including declarations
+	SmallPtrSet<GlobalValue*, 32> Reached;
+	DenseMap<const Comdat*, SmallVector<GlobalValue*, 2>> ComdatMembers;
+	// Set once any definition of the member is needed
+	bool Pulled{false};
+};
+
+// Functions which the Cheerp passes may introduce calls to after linking, so
+// they must be available even if nothing references them yet
+static void addRuntimeRoots(std::vector<std::string>& Roots)
+{
+	static const char* const RuntimeFunctions[] = {
+		// CallConstructors
+		"_start", "__syscall_main_args", "__syscall_exit",
+		// Allocations, mem intrinsics, exceptions and i128 arithmetic
+		"malloc", "calloc", "realloc", "free", "__genericjs__free",
+		"memcpy", "memmove", "memset", "__cxa_resume",
+		"__divti3", "__modti3", "__udivti3", "__umodti3",
+	};
+	Roots.insert(Roots.end(), std::begin(RuntimeFunctions), std::end(RuntimeFunctions));
+	// The optimizer may synthesize these intrinsics from plain arithmetic, and
+	// -cheerp-no-native-math lowers them to library calls
+#define WASM_INTRINSIC(opcode, Fname, builtin) \
+	if (*Fname) \
+		Roots.push_back(Fname);
+WASM_INTRINSIC_LIST_BUILTIN(WASM_INTRINSIC)
+#undef WASM_INTRINSIC
+}
+
+// Library calls which a use of F may be turned into after linking, either by
+// SimplifyLibCalls (see LibCallSimplifier) or by GlobalDepsAnalyzer lowering
+// math intrinsics. They are only kept if F is used, so that printf does not
+// pull puts into programs which never call printf
+static void addCompanionSymbols(const Function& F, std::vector<std::string>& Symbols)
+{
+	if(F.isIntrinsic())
+	{
+		if(F.getReturnType()->isVectorTy())
+			return;
+		const bool floatType = F.getReturnType()->isFloatTy();
+		switch(F.getIntrinsicID())
+		{
+			case Intrinsic::exp2:
+				// GlobalDepsAnalyzer expands exp2 to pow
+				Symbols.push_back(floatType ? "powf" : "pow");
+				return;
+#define TO_BE_LOWERED_INTO(builtin, FNameFloat, FNameDouble) \
+			case builtin: \
+				Symbols.push_back(floatType ? FNameFloat : FNameDouble); \
+				return;
+LLVM_BUILTINS_TO_LOWER_LIST(TO_BE_LOWERED_INTO)
+#undef TO_BE_LOWERED_INTO
+			default:
+				break;
+		}
+		const auto builtin = TypedBuiltinInstr::getMathTypedBuiltin(F);
+		if(builtin != TypedBuiltinInstr::NONE && builtin != TypedBuiltinInstr::UNSUPPORTED &&
+			!TypedBuiltinInstr::isAlwaysExactNatively(builtin))
+			Symbols.push_back(TypedBuiltinInstr::functionName(builtin));
+		return;
+	}
+
+	static const char* const Printf[] = { "putchar", "puts" };
+	static const char* const FPrintf[] = { "fputc", "fputs", "fwrite" };
+	static const char* const SPrintf[] = { "strcpy", "stpcpy", "strlen" };
+	static const char* const Puts[] = { "putchar" };
+	static const char* const FPuts[] = { "fwrite" };
+	static const char* const FWrite[] = { "fputc" };
+	static const char* const StpCpy[] = { "strcpy", "strlen" };
+	static const char* const StrLen[] = { "strlen" };
+	static const char* const StrChr[] = { "memchr", "strlen" };
+	static const char* const StrRChr[] = { "strchr", "memrchr" };
+	static const char* const StrPBrk[] = { "strchr" };
+	static const char* const StrStr[] = { "strchr", "strlen", "strncmp" };
+	static const char* const StrCmp[] = { "memcmp", "bcmp" };
+	static const char* const MemCmp[] = { "bcmp" };
+	static const char* const StrNDup[] = { "strdup" };
+	static const char* const Pow[] = { "exp2", "exp10", "exp", "sqrt", "ldexp" };
+	static const char* const PowF[] = { "exp2f", "exp10f", "expf", "sqrtf", "ldexpf" };
+	// exp2 may also become the intrinsic, which is expanded to pow
+	static const char* const Exp2[] = { "ldexp", "pow" };
+	static const char* const Exp2F[] = { "ldexpf", "powf" };
+	ArrayRef<const char*> Companions = StringSwitch<ArrayRef<const char*>>(F.getName())
+		.Case("printf", Printf)
+		.Case("fprintf", FPrintf)
+		.Case("sprintf", SPrintf)
+		.Case("puts", Puts)
+		.Case("fputs", FPuts)
+		.Case("fwrite", FWrite)
+		.Case("stpcpy", StpCpy)
+		.Cases("strcat", "strncat", "strcspn", "strlcpy", StrLen)
+		.Case("strchr", StrChr)
+		.Case("strrchr", StrRChr)
+		.Case("strpbrk", StrPBrk)
+		.Case("strstr", StrStr)
+		.Cases("strcmp", "strncmp", StrCmp)
+		.Case("memcmp", MemCmp)
+		.Case("strndup", StrNDup)
+		.Case("pow", Pow)
+		.Case("powf", PowF)
+		.Case("exp2", Exp2)
+		.Case("exp2f", Exp2F)
+		.Default(None);
+	Symbols.insert(Symbols.end(), Companions.begin(), Companions.end());
+}
+
+LazyLibraryLinker::LazyLibraryLinker(LLVMContext& Context, Module& Composite, bool Verbose, bool IgnoreNonBitcode):
+	Context(Context), Composite(Composite), Verbose(Verbose), IgnoreNonBitcode(IgnoreNonBitcode)
+{
+}
+
+LazyLibraryLinker::~LazyLibraryLinker() = default;
+
+Error LazyLibraryLinker::addLibrary(std::unique_ptr<MemoryBuffer> Buffer)
+{
+	MemoryBufferRef Ref = Buffer->getMemBufferRef();
+	Buffers.push_back(std::move(Buffer));
+	if(identify_magic(Ref.getBuffer()) != file_magic::archive)
+	{
+		Members.push_back(std::make_unique<Member>(Ref.getBufferIdentifier().str(), Ref));
+		return load(*Members.back()).takeError();
+	}
+
+	StringRef ArchiveName = Ref.getBufferIdentifier();
+	Expected<std::unique_ptr<object::Archive>> ArchiveOrErr = object::Archive::create(Ref);
+	if(!ArchiveOrErr)
+		return ArchiveOrErr.takeError();
+	object::Archive& Archive = **ArchiveOrErr;
+	DenseMap<const char*, Member*> MemberByData;
+	size_t FirstMember = Members.size();
+	Error Err = Error::success();
+	for(const object::Archive::Child& C: Archive.children(Err))
+	{
+		Expected<StringRef> ChildName = C.getName();
+		if(!ChildName)
+			return joinErrors(std::move(Err), ChildName.takeError());
+		Expected<MemoryBufferRef> MemBuf = C.getMemoryBufferRef();
+		if(!MemBuf)
+			return joinErrors(std::move(Err), MemBuf.takeError());
+		if(identify_magic(MemBuf->getBuffer()) != file_magic::bitcode)
+		{
+			if(IgnoreNonBitcode)
+				continue;
+			consumeError(std::move(Err));
+			return createStringError(inconvertibleErrorCode(), "member of archive is not a bitcode file: '" + *ChildName + "'");
+		}
+		Members.push_back(std::make_unique<Member>((ArchiveName + "(" + *ChildName + ")").str(), *MemBuf));
+		MemberByData[MemBuf->getBufferStart()] = Members.back().get();
+	}
+	if(Err)
+		return Err;
+
+	// Without a symbol table every member has to be parsed to index it
+	if(!Archive.hasSymbolTable())
+	{
+		for(size_t i = FirstMember; i < Members.size(); i++)
+			if(Error E = load(*Members[i]).takeError())
+				return E;
+		return Error::success();
+	}
+	for(const object::Archive::Symbol& Sym: Archive.symbols())
+	{
+		Expected<object::Archive::Child> C = Sym.getMember();
+		if(!C)
+			return C.takeError();
+		Expected<MemoryBufferRef> MemBuf = C->getMemoryBufferRef();
+		if(!MemBuf)
+			return MemBuf.takeError();
+		auto it = MemberByData.find(MemBuf->getBufferStart());
+		if(it == MemberByData.end())
+			continue;
+		Member* Mem = it->second;
+		// A loaded member has already indexed its definitions
+		if(Mem->M)
+			continue;
+		auto Indexed = SymbolIndex.find(Sym.getName());
+		if(Indexed == SymbolIndex.end())
+		{
+			// The symbol table does not tell weak definitions apart, assume a
+			// strong one until the member is parsed
+			SymbolIndex.try_emplace(Sym.getName(), IndexedSymbol{Mem, /*Weak*/false});
+		}
+		else if(Indexed->second.Mem != Mem)
+		{
+			// Parse the member to find out if it overrides a weak definition
+			if(Error E = load(*Mem).takeError())
+				return E;
+		}
+	}
+	return Error::success();
+}
+
+Expected<Module*> LazyLibraryLinker::load(Member& Mem)
+{
+	if(Mem.M)
+		return Mem.M.get();
+	if(Verbose)
+		errs() << "Loading '" << Mem.Name << "'\n";
+	SMDiagnostic Diag;
+	Mem.M = getLazyIRModule(MemoryBuffer::getMemBuffer(Mem.Buffer, false), Diag, Context);
+	if(!Mem.M)
+		return createStringError(inconvertibleErrorCode(), Mem.Name + ": " + Diag.getMessage());
+	if(Error E = Mem.M->materializeMetadata())
+		return std::move(E);
+	UpgradeDebugInfo(*Mem.M);
+
+	for(GlobalValue& GV: Mem.M->global_values())
+	{
+		if(const Comdat* C = GV.getComdat())
+			Mem.ComdatMembers[C].push_back(&GV);
+		if(GV.isDeclaration() || GV.hasLocalLinkage() || GV.hasAppendingLinkage())
+			continue;
+		if(Error E = indexSymbol(GV.getName(), Mem, GV.isWeakForLinker()))
+			return std::move(E);
+	}
+	// Definitions listed in named metadata are exported to the outside world
+	for(NamedMDNode& NMD: Mem.M->named_metadata())
+	{
+		for(const MDNode* N: NMD.operands())
+		{
+			for(const MDOperand& Op: N->operands())
+			{
+				auto* CAM = dyn_cast_or_null<ConstantAsMetadata>(Op.get());
+				auto* GV = CAM ? dyn_cast<GlobalValue>(CAM->getValue()) : nullptr;
+				if(GV && !GV->isDeclaration())
+					PendingRoots.push_back(std::make_pair(&Mem, GV));
+			}
+		}
+	}
+	return Mem.M.get();
+}
+
+Error LazyLibraryLinker::indexSymbol(StringRef Name, Member& Mem, bool Weak)
+{
+	auto it = SymbolIndex.try_emplace(Name, IndexedSymbol{&Mem, Weak});
+	if(it.second)
+		return Error::success();
+	if(it.first->second.Mem == &Mem)
+	{
+		// Indexed from the archive symbol table, now the linkage is known
+		it.first->second.Weak = Weak;
+		return Error::success();
+	}
+	// As with llvm-link, a strong definition overrides a weak one, otherwise
+	// the first definition wins
+	Member& Indexed = *it.first->second.Mem;
+	if(!Indexed.M)
+	{
+		if(Error E = load(Indexed).takeError())
+			return E;
+	}
+	// Loading may have grown the index
+	IndexedSymbol& Current = SymbolIndex.find(Name)->second;
+	if(Current.Weak && !Weak)
+		Current = IndexedSymbol{&Mem, Weak};
+	return Error::success();
+}
+
+Error LazyLibraryLinker::require(StringRef Name)
+{
+	GlobalValue* DGV = Composite.getNamedValue(Name);
+	if(DGV && !DGV->isDeclarationForLinker())
+		return Error::success();
+	// Symbols not found anywhere are left undefined, as with the eager link
+	auto it = SymbolIndex.find(Name);
+	if(it == SymbolIndex.end())
+		return Error::success();
+	Member& Mem = *it->second.Mem;
+	Expected<Module*> M = load(Mem);
+	if(!M)
+		return M.takeError();
+	GlobalValue* GV = (*M)->getNamedValue(Name);
+	if(!GV || GV->isDeclaration())
+		return Error::success();
+	return reach(Mem, GV);
+}
+
+Error LazyLibraryLinker::reach(Member& Mem, GlobalValue* Root)
+{
+	SmallVector<GlobalValue*, 16> Worklist;
+	Worklist.push_back(Root);
+	if(!Mem.Pulled)
+	{
+		Mem.Pulled = true;
+		// Constructors and llvm.used entries come along with the member
+		for(GlobalVariable& GV: Mem.M->globals())
+			if(GV.hasAppendingLinkage())
+				Worklist.push_back(&GV);
+	}
+	while(!Worklist.empty())
+	{
+		GlobalValue* GV = Worklist.pop_back_val();
+		if(!Mem.Reached.insert(GV).second)
+			continue;
+		if(auto* F = dyn_cast<Function>(GV))
+			addCompanionSymbols(*F, PendingSymbols);
+		if(GV->isDeclaration())
+		{
+			if(!GV->getName().startswith("llvm."))
+				PendingSymbols.push_back(GV->getName().str());
+			continue;
+		}
+		// Comdat groups are linked as a whole
+		if(const Comdat* C = GV->getComdat())
+		{
+			auto& members = Mem.ComdatMembers[C];
+			Worklist.append(members.begin(), members.end());
+		}
+		if(Error E = GV->materialize())
+			return E;
+		// Initializers, aliasees and personality functions
+		for(const Use& Op: GV->operands())
+			if(auto* C = dyn_cast_or_null<Constant>(Op.get()))
+				reachConstant(C, Worklist);
+		if(auto* F = dyn_cast<Function>(GV))
+			for(const Instruction& I: instructions(F))
+				for(const Use& Op: I.operands())
+					if(auto* C = dyn_cast<Constant>(Op.get()))
+						reachConstant(C, Worklist);
+	}
+	return Error::success();
+}
+
+void LazyLibraryLinker::reachConstant(const Constant* C, SmallVectorImpl<GlobalValue*>& Worklist)
+{
+	if(auto* GV = dyn_cast<GlobalValue>(C))
+	{
+		Worklist.push_back(const_cast<GlobalValue*>(GV));
+		return;
+	}
+	if(!VisitedConstants.insert(C).second)
+		return;
+	for(const Use& Op: C->operands())
+		if(auto* OpC = dyn_cast<Constant>(Op.get()))
+			reachConstant(OpC, Worklist);
+}
+
+void LazyLibraryLinker::stripUnreached(Member& Mem)
+{
+	Module& M = *Mem.M;
+	// Named metadata referring to stripped globals would be linked as null
+	for(NamedMDNode& NMD: M.named_metadata())
+	{
+		SmallVector<MDNode*, 8> Kept;
+		for(MDNode* N: NMD.operands())
+		{
+			bool isLive = llvm::all_of(N->operands(), [&](const MDOperand& Op) {
+				auto* CAM = dyn_cast_or_null<ConstantAsMetadata>(Op.get());
+				auto* GV = CAM ? dyn_cast<GlobalValue>(CAM->getValue()) : nullptr;
+				return !GV || Mem.Reached.count(GV);
+			});
+			if(isLive)
+				Kept.push_back(N);
+		}
+		if(Kept.size() == NMD.getNumOperands())
+			continue;
+		NMD.clearOperands();
+		for(MDNode* N: Kept)
+			NMD.addOperand(N);
+	}
+
+	SmallVector<GlobalObject*, 32> DeadObjects;
+	SmallVector<GlobalValue*, 8> DeadIndirect;
+	for(GlobalValue& GV: M.global_values())
+	{
+		if(Mem.Reached.count(&GV))
+			continue;
+		if(auto* GO = dyn_cast<GlobalObject>(&GV))
+			DeadObjects.push_back(GO);
+		else
+			DeadIndirect.push_back(&GV);
+	}
+	// Drop all the bodies and initializers first, so that globals only used by
+	// other unreachable globals lose all their uses
+	for(GlobalObject* GO: DeadObjects)
+	{
+		if(auto* F = dyn_cast<Function>(GO))
+			F->deleteBody();
+		else if(auto* Var = dyn_cast<GlobalVariable>(GO))
+		{
+			Var->setInitializer(nullptr);
+			Var->setLinkage(GlobalValue::ExternalLinkage);
+		}
+		GO->setComdat(nullptr);
+	}
+	for(GlobalValue* GV: DeadIndirect)
+	{
+		GV->removeDeadConstantUsers();
+		if(GV->use_empty())
+			GV->eraseFromParent();
+	}
+	for(GlobalObject* GO: DeadObjects)
+	{
+		GO->removeDeadConstantUsers();
+		if(GO->use_empty())
+			GO->eraseFromParent();
+	}
+}
+
+Error LazyLibraryLinker::link(Linker& L, ArrayRef<std::string> Roots)
+{
+	for(const GlobalValue& GV: Composite.global_values())
+		if(GV.isDeclaration() && !GV.getName().startswith("llvm."))
+			PendingSymbols.push_back(GV.getName().str());
+	for(const Function& F: Composite)
+		if(F.isDeclaration())
+			addCompanionSymbols(F, PendingSymbols);
+	PendingSymbols.insert(PendingSymbols.end(), Roots.begin(), Roots.end());
+	addRuntimeRoots(PendingSymbols);
+	while(!PendingSymbols.empty() || !PendingRoots.empty())
+	{
+		if(!PendingRoots.empty())
+		{
+			auto Root = PendingRoots.back();
+			PendingRoots.pop_back();
+			if(Error E = reach(*Root.first, Root.second))
+				return E;
+			continue;
+		}
+		std::string Name = std::move(PendingSymbols.back());
+		PendingSymbols.pop_back();
+		if(Error E = require(Name))
+			return E;
+	}
+
+	for(std::unique_ptr<Member>& Mem: Members)
+	{
+		if(!Mem->Pulled)
+		{
+			if(Verbose)
+				errs() << "Skipping '" << Mem->Name << "'\n";
+			continue;
+		}
+		stripUnreached(*Mem);
+		if(Verbose)
+			errs() << "Linking in '" << Mem->Name << "'\n";
+		if(L.linkInModule(std::move(Mem->M)))
+			return createStringError(inconvertibleErrorCode(), "failed to link '" + Mem->Name + "'");
+	}
+	return Error::success();
+}
+
+}
@@ -434,11 +434,19 @@ void LinearMemoryHelper::addGlobals()
 	}
 }
 
+bool LinearMemoryHelper::canGlobalizeAsmJS(const GlobalVariable& GV)
+{
+	Type* Ty = GV.getValueType();
+	if(!Ty->isIntegerTy(32) && !Ty->isPointerTy() && !Ty->isFloatTy() && !Ty->isDoubleTy())
+		return false;
+	const Constant* init = GV.getInitializer();
+	if(const ConstantFP* CF = dyn_cast<ConstantFP>(init))
+		return CF->getValueAPF().isFinite();
+	return isa<ConstantInt>(init) || init->isNullValue() || isa<UndefValue>(init);
+}
+
 void LinearMemoryHelper::generateGlobalizedGlobalsUsage()
 {
-	// TODO: add globalizedGlobals in the JS writer
-	if (mode == FunctionAddressMode::AsmJS)
-		return;
 	if (WasmNoGlobalization)
 		return;
 	// Identify all globals which are only ever accessed with with load/store, we can promote those to globals
@@ -447,6 +455,10 @@ void LinearMemoryHelper::generateGlobalizedGlobalsUsage()
 		// Don't deal with undefined variables
 		if(!GV.hasInitializer())
 			continue;
+		// asm.js module variables are declared with a literal initializer, and small integers
+		// would need the same truncation that the heap views implicitly provide
+		if(mode == FunctionAddressMode::AsmJS && !canGlobalizeAsmJS(GV))
+			continue;
 		uint32_t useCount = 0;
 		for(const Use& U: GV.uses())
 		{
@@ -15,6 +15,8 @@
 #include "llvm/Transforms/Utils/LowerSwitch.h"
 #include "llvm/Cheerp/CFGPasses.h"
 #include "llvm/IR/Constants.h"
+#include "llvm/IR/MDBuilder.h"
+#include "llvm/IR/ProfDataUtils.h"
 #include <unordered_map>
 #include <unordered_set>
 
@@ -85,24 +87,25 @@ bool CheerpLowerSwitch::keepSwitch(const SwitchInst* si)
 class RangeDest
 {
 public:
-	RangeDest(int64_t low, int64_t high, BasicBlock* dest)
-		: low(low), high(high), dest(dest)
+	RangeDest(int64_t low, int64_t high, BasicBlock* dest, uint64_t weight = 0)
+		: low(low), high(high), weight(weight), dest(dest)
 	{
 		assert(dest);
 		assert(low <= high);
 	}
-	RangeDest(int64_t val, BasicBlock* dest)
-		: RangeDest(val, val, dest)
+	RangeDest(int64_t val, BasicBlock* dest, uint64_t weight)
+		: RangeDest(val, val, dest, weight)
 	{
 	}
 	bool couldExtend(int64_t x) const
 	{
 		return (high+1 == x);
 	}
-	void extend(int64_t x)
+	void extend(int64_t x, uint64_t extraWeight)
 	{
 		assert(couldExtend(x));
 		high = x;
+		weight += extraWeight;
 	}
 	BasicBlock* getDest() const
 	{
@@ -114,6 +117,8 @@ public:
 	}
 	int64_t low;
 	int64_t high;
+	// Profile weight of the values in the range, 0 if unknown
+	uint64_t weight;
 private:
 	BasicBlock* dest;
 };
@@ -137,53 +142,85 @@ public:
 	{
 		return orderedRanges.size();
 	}
+	bool hasWeights() const
+	{
+		return !caseWeights.empty();
+	}
 private:
 	bool hasDefault() const
 	{
 		return SI->getDefaultDest();
 	}
+	uint64_t getCaseWeight(uint32_t caseIndex) const
+	{
+		if (!hasWeights())
+			return 0;
+		return caseWeights[caseIndex + 1];
+	}
 	void populateOrderedCases()
 	{
+		// Weight 0 is the default destination, then the cases in order
+		if (!extractBranchWeights(*SI, caseWeights) || caseWeights.size() != SI->getNumSuccessors())
+			caseWeights.clear();
 		for (auto& c: SI->cases())
 		{
 			int64_t curr = getCaseValue(c.getCaseValue(), bitWidth);
-			orderedCases.push_back({curr, c.getCaseSuccessor()});
+			orderedCases.push_back({curr, c.getCaseSuccessor(), getCaseWeight(c.getCaseIndex())});
 		}
 
-		std::sort(orderedCases.begin(), orderedCases.end());
+		std::sort(orderedCases.begin(), orderedCases.end(), [](const CaseInfo& a, const CaseInfo& b)
+		{
+			return a.value < b.value;
+		});
 	}
 	void populateRanges()
 	{
 		//TODO: Check overflow undetermined??
 		int64_t minimum = (((uint64_t)1)<<63);
 		const int64_t maximum = (((uint64_t)1)<<63) - 1;
+		SmallVector<uint32_t, 4> defaultRanges;
 		for (const auto& p : orderedCases)
 		{
-			if (!orderedRanges.empty() && orderedRanges.back().getDest() == p.second)
+			if (!orderedRanges.empty() && orderedRanges.back().getDest() == p.dest)
 			{
-				if (orderedRanges.back().couldExtend(p.first) || !hasDefault())
+				if (orderedRanges.back().couldExtend(p.value) || !hasDefault())
 				{
-					minimum = p.first+1;
-					orderedRanges.back().extend(p.first);
+					minimum = p.value+1;
+					orderedRanges.back().extend(p.value, p.weight);
 					continue;
 				}
 			}
-			if (hasDefault() && minimum < p.first)
+			if (hasDefault() && minimum < p.value)
 			{
-				orderedRanges.push_back(RangeDest(minimum, p.first-1, SI->getDefaultDest()));
+				defaultRanges.push_back(orderedRanges.size());
+				orderedRanges.push_back(RangeDest(minimum, p.value-1, SI->getDefaultDest()));
 			}
-			minimum = p.first + 1;
-			orderedRanges.push_back(RangeDest(p.first, p.second));
+			minimum = p.value + 1;
+			orderedRanges.push_back(RangeDest(p.value, p.dest, p.weight));
 		}
 		if (hasDefault() && minimum < maximum)
 		{
+			defaultRanges.push_back(orderedRanges.size());
 			orderedRanges.push_back(RangeDest(minimum, maximum, SI->getDefaultDest()));
 		}
+		// We don't know which values reach the default destination, split its weight evenly
+		if (hasWeights())
+		{
+			for (uint32_t i : defaultRanges)
+				orderedRanges[i].weight += caseWeights[0] / defaultRanges.size();
+		}
 	}
+	struct CaseInfo
+	{
+		int64_t value;
+		BasicBlock* dest;
+		uint64_t weight;
+	};
 	SwitchInst* SI;
 	const uint32_t bitWidth;
 	std::vector<RangeDest> orderedRanges;
-	std::vector<std::pair<int64_t, BasicBlock*>> orderedCases;
+	std::vector<CaseInfo> orderedCases;
+	SmallVector<uint32_t, 8> caseWeights;
 };
 
 //Class to compute all relevant informations about a SwitchInst and be able to answer queries given a bitset representation
@@ -234,6 +271,20 @@ struct DataOnSwitch
 	{
 		return orderedRanges.getRange(i);
 	}
+	bool hasWeights() const
+	{
+		return orderedRanges.hasWeights();
+	}
+	uint64_t getWeight(const int64_t representation) const
+	{
+		uint64_t weight = 0;
+		for (int64_t pow = 1, id = 0; pow <= representation; pow *=2, id++)
+		{
+			if (representation & pow)
+				weight += getRange(id).weight;
+		}
+		return weight;
+	}
 	uint64_t startingRepresentation() const
 	{
 		int64_t sum = 0;
@@ -573,8 +624,19 @@ private:
 		//Add comparison
 		ICmpInst* test = generateComparison(*currBB, incoming, t);
 
-		//Add Branch
-		BranchInst::Create(success, failure, test, currBB);
+		//Add Branch, carrying over the profile of the original switch
+		BranchInst* branch = BranchInst::Create(success, failure, test, currBB);
+		if (data.hasWeights())
+		{
+			uint64_t successWeight = data.getWeight(t.representation_success);
+			uint64_t failureWeight = data.getWeight(t.representation_failure);
+			while (successWeight > UINT32_MAX || failureWeight > UINT32_MAX)
+			{
+				successWeight >>= 1;
+				failureWeight >>= 1;
+			}
+			branch->setMetadata(LLVMContext::MD_prof, MDBuilder(branch->getContext()).createBranchWeights(successWeight, failureWeight));
+		}
 
 		return currBB;
 	}
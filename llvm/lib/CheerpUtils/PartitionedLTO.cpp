@@ -0,0 +1,509 @@
+//===-- PartitionedLTO.cpp - Parallel link time optimization --------------===//
+//
+//                     Cheerp: The C++ compiler for the Web
+//
+// This file is distributed under the Apache License v2.0 with LLVM Exceptions.
+// See LICENSE.TXT for details.
+//
+// Copyright 2023 Leaning Technologies
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/Cheerp/PartitionedLTO.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/EquivalenceClasses.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/DebugInfo.h"
+#include "llvm/IR/DebugInfoMetadata.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Linker/Linker.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/ErrorHandling.h"
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Support/Threading.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/ValueMapper.h"
+
+#include <algorithm>
+
+#define DEBUG_TYPE "CheerpPartitionedLTO"
+STATISTIC(NumPartitions, "Number of partitions optimized in parallel");
+STATISTIC(NumImportedCallees, "Number of callees imported in the partitions calling them");
+STATISTIC(NumPromotedGlobals, "Number of globals made external while optimizing the partitions");
+
+using namespace llvm;
+
+static cl::opt<unsigned> PartitionCount("cheerp-lto-partitions", cl::init(0),
+	cl::desc("Number of partitions optimized in parallel at link time, 0 uses one per hardware thread"));
+
+static cl::opt<unsigned> ImportInstrLimit("cheerp-lto-import-instr-limit", cl::init(64), cl::Hidden,
+	cl::desc("Maximum number of instructions of the callees imported across partitions"));
+
+namespace cheerp {
+
+namespace {
+
+// Collect the functions whose instructions use V, looking through constant
+// expressions. Returns false if anything else uses V, e.g. a global initializer
+bool collectUserFunctions(const Value* V, SmallPtrSetImpl<const Function*>& users)
+{
+	for(const User* U: V->users())
+	{
+		if(const Instruction* I = dyn_cast<Instruction>(U))
+			users.insert(I->getFunction());
+		else if(!isa<ConstantExpr>(U) || !collectUserFunctions(U, users))
+			return false;
+	}
+	return true;
+}
+
+unsigned getInstructionCount(const Function& F)
+{
+	unsigned count = 0;
+	for(const BasicBlock& BB: F)
+		count += BB.size();
+	return count;
+}
+
+const Function* getDirectCallee(const Instruction& I)
+{
+	const CallBase* CB = dyn_cast<CallBase>(&I);
+	if(!CB)
+		return nullptr;
+	return dyn_cast<Function>(CB->getCalledOperand()->stripPointerCasts());
+}
+
+struct PromotedGlobal
+{
+	std::string name;
+	GlobalValue::LinkageTypes linkage;
+	GlobalValue::VisibilityTypes visibility;
+};
+
+class ModulePartitioner
+{
+public:
+	ModulePartitioner(Module& M, unsigned maxPartitions);
+	unsigned getNumPartitions() const { return numPartitions; }
+	// Make external the globals which are referenced across partitions
+	void promoteGlobals();
+	// Clone the given partition and write it as bitcode
+	void writePartition(unsigned partition, SmallVectorImpl<char>& buffer) const;
+	// Link back the optimized partition, replacing the original definitions
+	void mergePartition(unsigned partition, MemoryBufferRef buffer);
+	// Restore the original linkage of the promoted globals, and remove the ones left unused
+	void restoreGlobals();
+private:
+	bool isImportable(const Function* F) const;
+	// Discardable globals which are not referenced across partitions keep their linkage
+	bool needsPromotion(const GlobalValue& GV) const;
+
+	Module& M;
+	unsigned numPartitions{0};
+	DenseMap<const Function*, unsigned> partitionOf;
+	std::vector<std::vector<std::string>> partitionFunctions;
+	std::vector<DenseSet<const Function*>> imports;
+	std::vector<PromotedGlobal> promoted;
+};
+
+ModulePartitioner::ModulePartitioner(Module& M, unsigned maxPartitions): M(M)
+{
+	// Build the clusters of functions which must be optimized together
+	EquivalenceClasses<const Function*> clusters;
+	DenseMap<const Comdat*, const Function*> comdatLeaders;
+	std::vector<const Function*> functions;
+	for(const Function& F: M)
+	{
+		if(F.isDeclaration() || F.hasAvailableExternallyLinkage())
+			continue;
+		// The partitions are merged back by name, and block addresses can't
+		// refer to a function in another module
+		if(!F.hasName())
+			return;
+		for(const BasicBlock& BB: F)
+			if(BB.hasAddressTaken())
+				return;
+		functions.push_back(&F);
+		clusters.insert(&F);
+		if(const Comdat* C = F.getComdat())
+		{
+			auto it = comdatLeaders.insert(std::make_pair(C, &F)).first;
+			clusters.unionSets(it->second, &F);
+		}
+	}
+	for(const Function* F: functions)
+	{
+		// Keep local functions with a single caller next to it, so that they stay local
+		if(!F->hasLocalLinkage())
+			continue;
+		SmallPtrSet<const Function*, 4> users;
+		if(collectUserFunctions(F, users) && users.size() == 1 && *users.begin() != F)
+			clusters.unionSets(F, *users.begin());
+	}
+
+	std::vector<std::pair<const Function*, unsigned>> leaders;
+	DenseMap<const Function*, unsigned> leaderIndex;
+	for(const Function* F: functions)
+	{
+		const Function* leader = clusters.getLeaderValue(F);
+		auto it = leaderIndex.insert(std::make_pair(leader, leaders.size())).first;
+		if(it->second == leaders.size())
+			leaders.push_back(std::make_pair(leader, 0u));
+		leaders[it->second].second += getInstructionCount(*F);
+	}
+	numPartitions = std::min<size_t>(maxPartitions, leaders.size());
+	if(numPartitions < 2)
+	{
+		numPartitions = 0;
+		return;
+	}
+
+	// Balance the partitions by assigning the biggest clusters first to the smallest partition
+	std::stable_sort(leaders.begin(), leaders.end(),
+		[](const std::pair<const Function*, unsigned>& a, const std::pair<const Function*, unsigned>& b)
+		{
+			return a.second > b.second;
+		});
+	std::vector<uint64_t> partitionSizes(numPartitions, 0);
+	DenseMap<const Function*, unsigned> leaderPartition;
+	for(const auto& leader: leaders)
+	{
+		unsigned smallest = std::min_element(partitionSizes.begin(), partitionSizes.end()) - partitionSizes.begin();
+		partitionSizes[smallest] += leader.second;
+		leaderPartition[leader.first] = smallest;
+	}
+	partitionFunctions.resize(numPartitions);
+	for(const Function* F: functions)
+	{
+		unsigned partition = leaderPartition[clusters.getLeaderValue(F)];
+		partitionOf[F] = partition;
+		partitionFunctions[partition].push_back(F->getName().str());
+	}
+
+	// Import the small direct callees defined in other partitions
+	imports.resize(numPartitions);
+	for(const Function* F: functions)
+	{
+		unsigned partition = partitionOf[F];
+		for(const BasicBlock& BB: *F)
+		{
+			for(const Instruction& I: BB)
+			{
+				const Function* callee = getDirectCallee(I);
+				if(!callee || !isImportable(callee))
+					continue;
+				auto it = partitionOf.find(callee);
+				if(it == partitionOf.end() || it->second == partition)
+					continue;
+				if(imports[partition].insert(callee).second)
+					NumImportedCallees++;
+			}
+		}
+	}
+	NumPartitions += numPartitions;
+}
+
+bool ModulePartitioner::isImportable(const Function* F) const
+{
+	if(F->isDeclaration() || F->isInterposable() || F->hasFnAttribute(Attribute::NoInline))
+		return false;
+	// Local functions are only imported if they need to be promoted anyway
+	if(F->hasLocalLinkage() && !needsPromotion(*F))
+		return false;
+	return getInstructionCount(*F) <= ImportInstrLimit;
+}
+
+bool ModulePartitioner::needsPromotion(const GlobalValue& GV) const
+{
+	if(!GV.isDiscardableIfUnused() || GV.hasAvailableExternallyLinkage() || GV.use_empty())
+		return false;
+	// Global variables are only defined in the original module
+	const Function* F = dyn_cast<Function>(&GV);
+	if(!F)
+		return true;
+	auto it = partitionOf.find(F);
+	if(it == partitionOf.end())
+		return true;
+	SmallPtrSet<const Function*, 4> users;
+	if(!collectUserFunctions(F, users))
+		return true;
+	for(const Function* user: users)
+	{
+		auto userIt = partitionOf.find(user);
+		if(userIt == partitionOf.end() || userIt->second != it->second)
+			return true;
+	}
+	return false;
+}
+
+void ModulePartitioner::promoteGlobals()
+{
+	SmallVector<GlobalValue*, 32> toPromote;
+	for(GlobalValue& GV: M.global_values())
+	{
+		if(!GV.hasAppendingLinkage() && needsPromotion(GV))
+			toPromote.push_back(&GV);
+	}
+	// Decide everything before changing linkages, since the checks above depend on them
+	for(GlobalValue* GV: toPromote)
+	{
+		if(!GV->hasName())
+			GV->setName("__cheerp_lto_promoted");
+		promoted.push_back({GV->getName().str(), GV->getLinkage(), GV->getVisibility()});
+		GV->setLinkage(GlobalValue::ExternalLinkage);
+		GV->setVisibility(GlobalValue::HiddenVisibility);
+		NumPromotedGlobals++;
+	}
+}
+
+void ModulePartitioner::writePartition(unsigned partition, SmallVectorImpl<char>& buffer) const
+{
+	const DenseSet<const Function*>& partitionImports = imports[partition];
+	auto shouldCloneDefinition = [&](const GlobalValue* GV)
+	{
+		if(const Function* F = dyn_cast<Function>(GV))
+		{
+			auto it = partitionOf.find(F);
+			return (it != partitionOf.end() && it->second == partition) || partitionImports.count(F);
+		}
+		// Constant initializers are visible to the optimizer, but only the original module defines them
+		if(const GlobalVariable* GVar = dyn_cast<GlobalVariable>(GV))
+			return GVar->isConstant() && GVar->hasInitializer() && !GVar->hasLocalLinkage() &&
+				!GVar->hasAppendingLinkage() && !GVar->isInterposable();
+		return false;
+	};
+	ValueToValueMapTy VMap;
+	std::unique_ptr<Module> part = CloneModule(M, VMap, shouldCloneDefinition);
+
+	// Duplicates have already been resolved when linking the program, and
+	// comdats would make the linker drop the optimized definitions later
+	for(GlobalObject& GO: part->global_objects())
+		GO.setComdat(nullptr);
+	for(const Function* F: partitionImports)
+		cast<Function>(VMap[F])->setLinkage(GlobalValue::AvailableExternallyLinkage);
+	SmallVector<GlobalVariable*, 8> intrinsicGlobals;
+	for(GlobalVariable& GV: part->globals())
+	{
+		if(GV.isDeclaration())
+		{
+			// llvm.used, llvm.global_ctors and the like are only meaningful in the original module
+			if(GV.getName().startswith("llvm.") && GV.use_empty())
+				intrinsicGlobals.push_back(&GV);
+			continue;
+		}
+		GV.setLinkage(GlobalValue::AvailableExternallyLinkage);
+	}
+	for(GlobalVariable* GV: intrinsicGlobals)
+		GV->eraseFromParent();
+
+	raw_svector_ostream OS(buffer);
+	WriteBitcodeToFile(*part, OS);
+}
+
+void prepareForMerge(Module& part)
+{
+	// The imported definitions are discarded, the original module already has them
+	SmallVector<GlobalValue*, 32> unused;
+	for(Function& F: part)
+	{
+		if(F.hasAvailableExternallyLinkage())
+			F.deleteBody();
+		if(F.isDeclaration() && F.use_empty())
+			unused.push_back(&F);
+	}
+	for(GlobalVariable& GV: part.globals())
+	{
+		if(GV.hasAvailableExternallyLinkage())
+		{
+			GV.setInitializer(nullptr);
+			GV.setLinkage(GlobalValue::ExternalLinkage);
+		}
+	}
+	for(GlobalValue* GV: unused)
+		GV->eraseFromParent();
+	for(GlobalVariable& GV: make_early_inc_range(part.globals()))
+	{
+		GV.removeDeadConstantUsers();
+		if(GV.isDeclaration() && GV.use_empty())
+			GV.eraseFromParent();
+	}
+	// The named metadata would be appended again to the original one. Debug info
+	// is kept since every compile unit must be listed in llvm.dbg.cu, otherwise
+	// the debug info is stripped when reading the partition back. The duplicate
+	// units are folded again by mergeCompileUnits
+	SmallVector<NamedMDNode*, 8> namedMetadata;
+	for(NamedMDNode& NMD: part.named_metadata())
+	{
+		if(NMD.getName() != "llvm.module.flags" && NMD.getName() != "llvm.dbg.cu")
+			namedMetadata.push_back(&NMD);
+	}
+	for(NamedMDNode* NMD: namedMetadata)
+		NMD->eraseFromParent();
+}
+
+// Linking a partition appends its copies of the compile units to llvm.dbg.cu,
+// in the same order as the original ones. Point the merged subprograms back to
+// the original units and drop the copies
+void mergeCompileUnits(Module& M, unsigned numUnits)
+{
+	NamedMDNode* units = M.getNamedMetadata("llvm.dbg.cu");
+	if(!units || units->getNumOperands() == numUnits)
+		return;
+	if(units->getNumOperands() != 2 * numUnits)
+		report_fatal_error("unexpected compile units in a linked back partition");
+	DenseMap<const MDNode*, DICompileUnit*> originalUnits;
+	for(unsigned i = 0; i < numUnits; i++)
+		originalUnits[units->getOperand(numUnits + i)] = cast<DICompileUnit>(units->getOperand(i));
+	DebugInfoFinder finder;
+	finder.processModule(M);
+	for(DISubprogram* SP: finder.subprograms())
+	{
+		auto it = originalUnits.find(SP->getUnit());
+		if(it != originalUnits.end())
+			SP->replaceUnit(it->second);
+	}
+	SmallVector<MDNode*, 8> keep;
+	for(unsigned i = 0; i < numUnits; i++)
+		keep.push_back(units->getOperand(i));
+	units->clearOperands();
+	for(MDNode* unit: keep)
+		units->addOperand(unit);
+}
+
+void ModulePartitioner::mergePartition(unsigned partition, MemoryBufferRef buffer)
+{
+	SmallVector<Function*, 32> discardable;
+	for(const std::string& name: partitionFunctions[partition])
+	{
+		Function* F = M.getFunction(name);
+		assert(F && !F->isDeclaration());
+		if(F->isDiscardableIfUnused())
+			discardable.push_back(F);
+		F->deleteBody();
+		F->setComdat(nullptr);
+	}
+	// Functions that kept their discardable linkage were only used from this
+	// partition. The others stay, since metadata like jsexport may refer to them
+	for(Function* F: discardable)
+	{
+		F->removeDeadConstantUsers();
+		if(F->use_empty())
+			F->eraseFromParent();
+	}
+
+	Expected<std::unique_ptr<Module>> part = parseBitcodeFile(buffer, M.getContext());
+	if(!part)
+		report_fatal_error(Twine("cannot read back an optimized partition: ") + toString(part.takeError()));
+	NamedMDNode* units = M.getNamedMetadata("llvm.dbg.cu");
+	unsigned numUnits = units ? units->getNumOperands() : 0;
+	if(Linker::linkModules(M, std::move(*part)))
+		report_fatal_error("cannot link back an optimized partition");
+	mergeCompileUnits(M, numUnits);
+}
+
+void ModulePartitioner::restoreGlobals()
+{
+	for(const PromotedGlobal& P: promoted)
+	{
+		GlobalValue* GV = M.getNamedValue(P.name);
+		if(!GV || GV->isDeclaration())
+			continue;
+		GV->setVisibility(P.visibility);
+		GV->setLinkage(P.linkage);
+	}
+	// Remove the promoted globals which became unused once inlined in the other
+	// partitions. The other globals were either unused to begin with, or have
+	// been optimized together with all their users
+	bool changed = true;
+	while(changed)
+	{
+		changed = false;
+		for(const PromotedGlobal& P: promoted)
+		{
+			GlobalValue* GV = M.getNamedValue(P.name);
+			if(!GV || !GV->isDiscardableIfUnused())
+				continue;
+			GV->removeDeadConstantUsers();
+			if(!GV->use_empty())
+				continue;
+			GV->eraseFromParent();
+			changed = true;
+		}
+	}
+}
+
+}
+
+PreservedAnalyses PartitionedLTOPass::run(Module& M, ModuleAnalysisManager& MAM)
+{
+	// Both paths replace or remove functions, drop the cached function analyses
+	MAM.getResult<FunctionAnalysisManagerModuleProxy>(M).getManager().clear();
+
+	unsigned maxPartitions = PartitionCount;
+	if(maxPartitions == 0)
+		maxPartitions = hardware_concurrency().compute_thread_count();
+	ModulePartitioner partitioner(M, maxPartitions);
+	unsigned numPartitions = partitioner.getNumPartitions();
+	if(numPartitions == 0)
+	{
+		pipeline(M, /*isPartition*/false);
+		return PreservedAnalyses::none();
+	}
+
+	partitioner.promoteGlobals();
+	std::vector<SmallVector<char, 0>> inputs(numPartitions);
+	for(unsigned i = 0; i < numPartitions; i++)
+		partitioner.writePartition(i, inputs[i]);
+
+	std::vector<SmallVector<char, 0>> outputs(numPartitions);
+	std::vector<std::string> errors(numPartitions);
+	{
+		ThreadPool pool(hardware_concurrency(numPartitions));
+		for(unsigned i = 0; i < numPartitions; i++)
+		{
+			pool.async([&, i]()
+			{
+				LLVMContext Context;
+				MemoryBufferRef buffer(StringRef(inputs[i].data(), inputs[i].size()), M.getModuleIdentifier());
+				Expected<std::unique_ptr<Module>> part = parseBitcodeFile(buffer, Context);
+				if(!part)
+				{
+					errors[i] = toString(part.takeError());
+					return;
+				}
+				inputs[i].clear();
+				pipeline(**part, /*isPartition*/true);
+				prepareForMerge(**part);
+				raw_svector_ostream OS(outputs[i]);
+				WriteBitcodeToFile(**part, OS);
+			});
+		}
+		pool.wait();
+	}
+	for(const std::string& error: errors)
+	{
+		if(!error.empty())
+			report_fatal_error(Twine("cannot read a partition: ") + error);
+	}
+
+	// Merge in a fixed order, so that the output is deterministic
+	for(unsigned i = 0; i < numPartitions; i++)
+	{
+		MemoryBufferRef buffer(StringRef(outputs[i].data(), outputs[i].size()), M.getModuleIdentifier());
+		partitioner.mergePartition(i, buffer);
+		outputs[i].clear();
+	}
+	partitioner.restoreGlobals();
+	return PreservedAnalyses::none();
+}
+
+}
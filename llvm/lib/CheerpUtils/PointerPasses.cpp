@@ -28,6 +28,7 @@
 #include "llvm/Transforms/Utils/BasicBlockUtils.h"
 #include "llvm/Transforms/Utils/ValueMapper.h"
 #include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Support/CommandLine.h"
 #include "llvm/Support/raw_ostream.h"
 #include <set>
 #include <map>
@@ -35,6 +36,10 @@
 #define DEBUG_TYPE "CheerpPointerPasses"
 
 STATISTIC(NumAllocasTransformedToArrays, "Number of allocas of values transformed to allocas of arrays");
+STATISTIC(NumAllocationsReplacedWithAllocas, "Number of non escaping genericjs allocations replaced with allocas");
+
+static llvm::cl::opt<unsigned> AllocateToAllocaMaxElements("cheerp-allocate-to-alloca-max-elements", llvm::cl::init(16), llvm::cl::Hidden,
+	llvm::cl::desc("Maximum number of elements of a non escaping genericjs allocation replaced with an alloca"));
 
 namespace cheerp {
 using namespace llvm;
@@ -64,6 +69,16 @@ public:
 	bool runOnModule(llvm::Module &M); 
 };
 
+class AllocateToAlloca
+{
+private:
+	bool allocationEscapes(llvm::Instruction* alloc, llvm::SmallVectorImpl<llvm::CallInst*>& frees) const;
+	bool replaceAllocation(llvm::CallInst* alloc);
+public:
+	explicit AllocateToAlloca() { }
+	bool runOnFunction(llvm::Function &F);
+};
+
 bool AllocaArrays::replaceAlloca(AllocaInst* ai, cheerp::GlobalDepsAnalyzer& gda)
 {
 	const ConstantInt * ci = dyn_cast<ConstantInt>(ai->getArraySize());
@@ -735,6 +750,138 @@ PreservedAnalyses FreeAndDeleteRemovalPass::run(Module& M, ModuleAnalysisManager
 	return PreservedAnalyses::none();
 }
 
+// Returns true if a pointer derived from the allocation may be observed outside
+// of the function, or in a way that an alloca would not support. The calls
+// freeing the allocation are collected, since they become no-ops
+bool AllocateToAlloca::allocationEscapes(Instruction* alloc, SmallVectorImpl<CallInst*>& frees) const
+{
+	SmallVector<Use*, 16> worklist;
+	for(Use& U: alloc->uses())
+		worklist.push_back(&U);
+	while(!worklist.empty())
+	{
+		Use* U = worklist.pop_back_val();
+		Instruction* I = cast<Instruction>(U->getUser());
+		switch(I->getOpcode())
+		{
+			case Instruction::GetElementPtr:
+			case Instruction::BitCast:
+			{
+				for(Use& derivedUse: I->uses())
+					worklist.push_back(&derivedUse);
+				break;
+			}
+			case Instruction::Load:
+				break;
+			case Instruction::Store:
+			{
+				// Storing the pointer itself is an escape
+				if(U->getOperandNo() != StoreInst::getPointerOperandIndex())
+					return true;
+				break;
+			}
+			case Instruction::Call:
+			{
+				CallInst* CI = cast<CallInst>(I);
+				if(isa<MemIntrinsic>(CI) || isa<DbgInfoIntrinsic>(CI) || CI->isLifetimeStartOrEnd())
+					break;
+				Function* F = CI->getCalledFunction();
+				if(F && (F->getIntrinsicID() == Intrinsic::cheerp_deallocate || isFreeFunctionName(F->getName()) ||
+					F->getName() == StringRef("__genericjs__free")))
+				{
+					frees.push_back(CI);
+					break;
+				}
+				return true;
+			}
+			default:
+				// PHIs, selects, comparisons, returns and calls may all let the pointer escape
+				return true;
+		}
+	}
+	return false;
+}
+
+bool AllocateToAlloca::replaceAllocation(CallInst* alloc)
+{
+	Function& F = *alloc->getFunction();
+	const DataLayout& DL = F.getParent()->getDataLayout();
+	Type* Ty = alloc->getParamElementType(0);
+	if(!Ty || !Ty->isSized() || TypeSupport::isAsmJSPointed(Ty) || TypeSupport::isClientType(Ty))
+		return false;
+	// Instances of exported classes are created with their JS constructor
+	if(StructType* STy = dyn_cast<StructType>(Ty))
+	{
+		if(TypeSupport::isJSExportedType(STy, *F.getParent()))
+			return false;
+	}
+	ConstantInt* size = dyn_cast<ConstantInt>(alloc->getArgOperand(1));
+	uint64_t elemSize = DL.getTypeAllocSize(Ty);
+	if(!size || elemSize == 0 || size->getZExtValue() % elemSize != 0)
+		return false;
+	uint64_t numElems = size->getZExtValue() / elemSize;
+	if(numElems == 0 || numElems > AllocateToAllocaMaxElements)
+		return false;
+	SmallVector<CallInst*, 4> frees;
+	if(allocationEscapes(alloc, frees))
+		return false;
+
+	// SROA only considers allocas in the entry block. An allocation in a loop
+	// can reuse the same storage, since no pointer crosses the iterations
+	Type* allocaTy = numElems == 1 ? Ty : ArrayType::get(Ty, numElems);
+	IRBuilder<> IRB(&*F.getEntryBlock().getFirstInsertionPt());
+	AllocaInst* AI = IRB.CreateAlloca(allocaTy, nullptr, alloc->getName());
+	Value* ptr = AI;
+	if(numElems != 1)
+		ptr = IRB.CreateConstInBoundsGEP2_32(allocaTy, AI, 0, 0);
+
+	// Allocations are zero initialized in genericjs, a new object is
+	// expected every time the allocation is executed
+	IRB.SetInsertPoint(alloc);
+	IRB.CreateMemSet(ptr, IRB.getInt8(0), size->getZExtValue(), AI->getAlign(), /*isVolatile*/false,
+		nullptr, nullptr, nullptr, IRBuilderBase::CheerpTypeInfo::get(DL.isByteAddressable(), Ty));
+	if(ptr->getType() != alloc->getType())
+		ptr = IRB.CreateBitCast(ptr, alloc->getType());
+
+	for(CallInst* CI: frees)
+		CI->eraseFromParent();
+	alloc->replaceAllUsesWith(ptr);
+	alloc->eraseFromParent();
+	NumAllocationsReplacedWithAllocas++;
+	return true;
+}
+
+bool AllocateToAlloca::runOnFunction(Function& F)
+{
+	if(F.getSection() == StringRef("asmjs"))
+		return false;
+	SmallVector<CallInst*, 8> allocations;
+	for(BasicBlock& BB: F)
+	{
+		for(Instruction& I: BB)
+		{
+			CallInst* CI = dyn_cast<CallInst>(&I);
+			if(!CI || !CI->getCalledFunction() || CI->getCalledFunction()->getIntrinsicID() != Intrinsic::cheerp_allocate)
+				continue;
+			allocations.push_back(CI);
+		}
+	}
+	bool Changed = false;
+	for(CallInst* CI: allocations)
+		Changed |= replaceAllocation(CI);
+	return Changed;
+}
+
+PreservedAnalyses AllocateToAllocaPass::run(Function& F, FunctionAnalysisManager& FAM)
+{
+	AllocateToAlloca inner;
+	if (!inner.runOnFunction(F))
+		return PreservedAnalyses::all();
+	PreservedAnalyses PA;
+	PA.preserveSet<CFGAnalyses>();
+	return PA;
+}
+
 uint32_t DelayInsts::countInputRegisters(const Instruction* I, cheerp::InlineableCache& cache) const
 {
 	uint32_t count = 0;
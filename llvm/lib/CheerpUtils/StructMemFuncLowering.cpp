@@ -427,6 +427,10 @@ bool StructMemFuncLowering::runOnBlock(BasicBlock& BB, bool asmjs)
 			bool isByteLayout = isa<StructType>(pointedType) && cast<StructType>(pointedType)->hasByteLayout();
 			if(isByteLayout)
 				continue;
+			// In genericjs copies between typed arrays are done in bulk with TypedArray.set
+			bool isTypedArray = !asmjs && cheerp::TypeSupport::isTypedArrayType(pointedType, ForceTypedArrays);
+			if(isTypedArray && CI->getOperand(0)->getType() == CI->getOperand(1)->getType())
+				continue;
 			MemTransferInst* MTI = cast<MemTransferInst>(CI);
 			alignInt = std::min(MTI->getSourceAlignment(), MTI->getDestAlignment());
 		}
@@ -18,6 +18,7 @@
 #include "llvm/IR/Dominators.h"
 #include "llvm/Cheerp/Writer.h"
 #include "llvm/Cheerp/Utility.h"
+#include "llvm/Cheerp/CommandLine.h"
 
 using namespace llvm;
 using namespace cheerp;
@@ -130,7 +131,7 @@ bool TokenListVerifier::verify() const
 					llvm::errs() << "Error: Match for ELSE Token is not a END Token\n";
 					return false;
 				}
-				if (T.getMatch()->getMatch()->getKind() != Token::TK_If)
+				if ((T.getMatch()->getMatch()->getKind() & (Token::TK_If|Token::TK_IfNot)) == 0)
 				{
 					llvm::errs() << "Error: Match for END after ELSE Token is not a IF Token\n";
 					return false;
@@ -739,10 +740,11 @@ class TokenListOptimizer {
 	const Registerize& R;
 	const PointerAnalyzer& PA;
 	CFGStackifier::Mode Mode;
+	const BranchProbabilityInfo* BPI;
 public:
 	TokenListOptimizer(TokenList& Tokens, const Registerize& R, const PointerAnalyzer& PA,
-		CFGStackifier::Mode Mode)
-		: Tokens(Tokens), R(R), PA(PA), Mode(Mode) {}
+		CFGStackifier::Mode Mode, const BranchProbabilityInfo* BPI)
+		: Tokens(Tokens), R(R), PA(PA), Mode(Mode), BPI(BPI) {}
 	void runAll();
 	void removeRedundantBranches(const bool removeAlsoBlockAndEnd = false);
 	void removeEmptyBasicBlocks();
@@ -756,6 +758,7 @@ public:
 	void adjustLoopEnds();
 	void adjustBranchTarget();
 	void removeRedundantBlocks();
+	void orderIfArmsByProbability();
 private:
 	// Helper function for iterating on one or more kinds of tokens
 	// The closure `f` must use the `erase` function defined below if it needs
@@ -839,6 +842,8 @@ void TokenListOptimizer::runAll()
 		createBrIfsFromIfs();
 	}
 	removeRedundantBranches(/*removeAlsoBlockAndEnd*/false);
+	if (Mode == CFGStackifier::GenericJS && BPI)
+		orderIfArmsByProbability();
 }
 
 static bool isNaturalFlow(TokenList::iterator From, TokenList::iterator To, const bool allowBranches)
@@ -1330,9 +1335,50 @@ void TokenListOptimizer::removeRedundantBlocks()
 	});
 }
 
+void TokenListOptimizer::orderIfArmsByProbability()
+{
+	passStart();
+	// JS engines lay out the code in source order, so put the likely arm of
+	// an If/Else first, mirroring the branch hints we emit for wasm
+	for_each_kind<Token::TK_If>([&](Token* If)
+	{
+		Token* Else = If->getMatch();
+		if (Else->getKind() != Token::TK_Else)
+			return;
+		const BranchInst* BI = cast<BranchInst>(If->getBB()->getTerminator());
+		if (getBranchHint(BI, *BPI, /*IfNot*/false) != BranchHint::Unlikely)
+			return;
+		Token* End = Else->getMatch();
+		Token* ThenFirst = If->getNextNode();
+		Token* ElseFirst = Else->getNextNode();
+		// Removing redundant branches may have left an arm empty
+		if (ThenFirst == Else || ElseFirst == End)
+			return;
+		Tokens.moveAfter(If->getIter(), ElseFirst->getIter(), End->getIter());
+		Tokens.moveAfter(Else->getIter(), ThenFirst->getIter(), Else->getIter());
+		Token* IfNot = Token::createIfNot(If->getBB());
+		IfNot->setMatch(Else);
+		End->setMatch(IfNot);
+		Tokens.insert(If->getIter(), IfNot);
+		erase(If);
+	});
+}
+
+BranchHint cheerp::getBranchHint(const BranchInst* BI, const BranchProbabilityInfo& BPI, bool IfNot)
+{
+	assert(BI->isConditional());
+	const BranchProbability Threshold(std::min(BranchHintThreshold.getValue(), 100u), 100);
+	const BranchProbability Taken = BPI.getEdgeProbability(BI->getParent(), IfNot ? 1u : 0u);
+	if (Taken > Threshold)
+		return BranchHint::Likely;
+	if (Taken.getCompl() > Threshold)
+		return BranchHint::Unlikely;
+	return BranchHint::Neutral;
+}
+
 CFGStackifier::CFGStackifier(const llvm::Function &F, const llvm::LoopInfo& LI,
 	const llvm::DominatorTree& DT, const Registerize& R, const PointerAnalyzer& PA,
-	Mode M)
+	Mode M, const llvm::BranchProbabilityInfo* BPI)
 {
 	TokenListBuilder Builder(F, Tokens, LI, DT, M != Mode::Wasm);
 #ifndef NDEBUG
@@ -1344,7 +1390,7 @@ CFGStackifier::CFGStackifier(const llvm::Function &F, const llvm::LoopInfo& LI,
 #ifdef TOKEN_OPT_DUMP
 	llvm::errs() << F.getName() << "\n";
 #endif
-	TokenListOptimizer Opt(Tokens, R, PA, M);
+	TokenListOptimizer Opt(Tokens, R, PA, M, BPI);
 	Opt.runAll();
 #ifndef NDEBUG
 	{
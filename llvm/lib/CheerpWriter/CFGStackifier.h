@@ -15,6 +15,7 @@
 #include "llvm/Cheerp/TokenList.h"
 
 #include "llvm/IR/Module.h"
+#include "llvm/Analysis/BranchProbabilityInfo.h"
 #include "llvm/Analysis/LoopInfo.h"
 #include "llvm/IR/Dominators.h"
 
@@ -24,6 +25,18 @@
 namespace cheerp
 {
 
+enum class BranchHint
+{
+	Likely,
+	Unlikely,
+	Neutral,
+};
+
+// Hint for the branch taken when the condition of BI is true (false if IfNot).
+// The probabilities come from the !prof weights when available and from the
+// static heuristics of BranchProbabilityInfo otherwise.
+BranchHint getBranchHint(const llvm::BranchInst* BI, const llvm::BranchProbabilityInfo& BPI, bool IfNot);
+
 class CFGStackifier
 {
 public:
@@ -34,7 +47,8 @@ public:
 	};
 	CFGStackifier(const llvm::Function &F, const llvm::LoopInfo& LI,
 		const llvm::DominatorTree& DT, const Registerize& R,
-		const PointerAnalyzer& PA, Mode M);
+		const PointerAnalyzer& PA, Mode M,
+		const llvm::BranchProbabilityInfo* BPI = nullptr);
 
 	TokenList Tokens;
 	std::vector<const llvm::BasicBlock*> selectBasicBlocksWithPossibleIncomingResult() const;
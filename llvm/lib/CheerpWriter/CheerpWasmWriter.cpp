@@ -19,12 +19,15 @@
 #include "llvm/Cheerp/CommandLine.h"
 #include "llvm/Cheerp/PHIHandler.h"
 #include "llvm/Cheerp/NameGenerator.h"
+#include "llvm/Cheerp/MethodCache.h"
 #include "llvm/Cheerp/WasmWriter.h"
 #include "llvm/Cheerp/Writer.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/StringExtras.h"
 #include "llvm/IR/IntrinsicsWebAssembly.h"
-#include "llvm/IR/ProfDataUtils.h"
 #include "llvm/IR/Type.h"
 #include "llvm/Support/LEB128.h"
+#include "llvm/Support/SHA1.h"
 
 using namespace cheerp;
 using namespace llvm;
@@ -140,39 +143,6 @@ std::string string_to_hex(StringRef input)
 	return output;
 }
 
-enum class BranchHint
-{
-	Likely,
-	Unlikely,
-	Neutral,
-};
-
-static BranchHint shouldBranchBeHinted(const llvm::BranchInst* bi, const bool IfNot)
-{
-	uint64_t weight_false = 0;
-	uint64_t weight_true = 0;
-	if (extractBranchWeights(*bi, weight_true, weight_false))
-	{
-		if (IfNot)
-			std::swap(weight_false, weight_true);
-
-		const uint64_t total = weight_true + weight_false;
-		if (total == 0)
-			return BranchHint::Neutral;
-
-		auto isConvenientToHint = [](uint64_t part, uint64_t total) -> bool {
-			return (part*1.0 / total) > 0.8;
-		};
-
-		if (isConvenientToHint(weight_true, total))
-			return BranchHint::Likely;
-
-		if (isConvenientToHint(weight_false, total))
-			return BranchHint::Unlikely;
-	}
-	return BranchHint::Neutral;
-}
-
 Section::Section(uint32_t sectionId, const char* sectionName, CheerpWasmWriter* writer)
 	: hasName(sectionName), name(hasName ? (sectionName) : ""), sectionId(sectionId), writer(writer)
 {
@@ -544,6 +514,13 @@ void CheerpWasmWriter::encodeInst(WasmU32U32Opcode opcode, uint32_t i1, uint32_t
 	encodeULEB128(i2, code);
 }
 
+void CheerpWasmWriter::encodeInst(WasmMiscU32Opcode opcode, uint32_t immediate, WasmBuffer& code)
+{
+	code << static_cast<char>(WasmOpcode::MISC);
+	encodeULEB128(static_cast<uint64_t>(opcode), code);
+	encodeULEB128(immediate, code);
+}
+
 void CheerpWasmWriter::encodeInst(WasmSIMDOpcode opcode, WasmBuffer& code)
 {
 	code << static_cast<char>(WasmOpcode::SIMD);
@@ -913,7 +890,11 @@ void CheerpWasmWriter::encodeStoringShuffle(WasmBuffer& code, const llvm::FixedV
 
 void CheerpWasmWriter::encodeBranchHint(const llvm::BranchInst* BI, const bool IfNot, WasmBuffer& code)
 {
-	auto branchHint = shouldBranchBeHinted(BI, IfNot);
+	// Avoid computing the probabilities if they are not going to be used
+	if (!WasmBranchHints)
+		return;
+	const BranchProbabilityInfo& BPI = FAM.getResult<BranchProbabilityAnalysis>(const_cast<Function&>(*BI->getFunction()));
+	auto branchHint = getBranchHint(BI, BPI, IfNot);
 
 	if (branchHint == BranchHint::Likely)
 		encodeInst(WasmInvalidOpcode::BRANCH_LIKELY, code);
@@ -1491,7 +1472,10 @@ void CheerpWasmWriter::compileConstant(WasmBuffer& code, const Constant* c, bool
 	}
 	else if(isa<ConstantPointerNull>(c))
 	{
-		encodeInst(WasmS32Opcode::I32_CONST, 0, code);
+		if(TypeSupport::isRawPointer(c->getType(), true))
+			encodeInst(WasmS32Opcode::I32_CONST, 0, code);
+		else
+			encodeInst(WasmU32Opcode::REF_NULL, 0x6f, code);
 	}
 	else if(isa<Function>(c))
 	{
@@ -1665,7 +1649,22 @@ void CheerpWasmWriter::compileICmp(const Value* op0, const Value* op1, const Cmp
 		if(isa<Constant>(op1) && cast<Constant>(op1)->isNullValue())
 			useEqz = true;
 	}
-	if(op0->getType()->isPointerTy())
+	if(op0->getType()->isPointerTy() && !TypeSupport::isRawPointer(op0->getType(), true))
+	{
+		// Externrefs can only be compared with null
+		if(p != CmpInst::ICMP_EQ && p != CmpInst::ICMP_NE)
+			llvm::report_fatal_error("Invalid comparison of externref values");
+		if(isa<Constant>(op0))
+			std::swap(op0, op1);
+		if(!isa<Constant>(op1) || !cast<Constant>(op1)->isNullValue())
+			llvm::report_fatal_error("Externref values can only be compared with null in wasm");
+		compileOperand(code, op0);
+		encodeInst(WasmOpcode::REF_IS_NULL, code);
+		if(p == CmpInst::ICMP_NE)
+			encodeInst(WasmOpcode::I32_EQZ, code);
+		return;
+	}
+	else if(op0->getType()->isPointerTy())
 	{
 		compileOperand(code, op0);
 		if(useEqz)
@@ -2094,17 +2093,39 @@ bool CheerpWasmWriter::compileInstruction(WasmBuffer& code, const Instruction& I
 
 bool CheerpWasmWriter::isTailCall(const CallInst& ci) const
 {
+	// musttail is a guarantee, not a hint. Threaded code relies on it to
+	// run in constant stack space, so it is an error if it can't be honoured.
+	if(ci.isMustTailCall() && !WasmReturnCalls)
+	{
+		llvm::report_fatal_error(Twine("musttail call in function '") + currentFun->getName() +
+			"' requires the 'returncalls' wasm feature");
+	}
 	if(!WasmReturnCalls || !ci.isTailCall())
 		return false;
 	const Instruction* nextI = ci.getNextNode();
+	const Value* retVal = &ci;
+	// The returned pointer may be bitcasted, which is a no-op in wasm
+	if(isNoOpTailCallBitCast(*nextI) && nextI->getOperand(0) == &ci)
+	{
+		retVal = nextI;
+		nextI = nextI->getNextNode();
+	}
+	bool canReturnCall;
 	// The next inst must be a return
 	if(!isa<ReturnInst>(nextI))
-		return false;
+		canReturnCall = false;
 	// Both call and return are void
-	if(currentFun->getReturnType()->isVoidTy())
-		return ci.getType()->isVoidTy();
+	else if(currentFun->getReturnType()->isVoidTy())
+		canReturnCall = ci.getType()->isVoidTy();
 	// The return uses the call
-	return nextI->getOperand(0) == &ci;
+	else
+		canReturnCall = nextI->getOperand(0) == retVal;
+	if(!canReturnCall && ci.isMustTailCall())
+	{
+		llvm::report_fatal_error(Twine("musttail call in function '") + currentFun->getName() +
+			"' is not followed by a return of its value. This is a bug");
+	}
+	return canReturnCall;
 }
 
 bool CheerpWasmWriter::isReturnPartOfTailCall(const Instruction& ti) const
@@ -2114,12 +2135,23 @@ bool CheerpWasmWriter::isReturnPartOfTailCall(const Instruction& ti) const
 	if(&*BB->begin() == &ti)
 		return false;
 	const Instruction* TermPrev = ti.getPrevNode();
+	// Skip the bitcast of the returned value, isTailCall checks it
+	if(isNoOpTailCallBitCast(*TermPrev) && &*BB->begin() != TermPrev)
+		TermPrev = TermPrev->getPrevNode();
 	// Make sure the previous instruction is a call
 	if(!isa<CallInst>(TermPrev))
 		return false;
 	return isTailCall(*cast<CallInst>(TermPrev));
 }
 
+bool CheerpWasmWriter::isNoOpTailCallBitCast(const Instruction& I)
+{
+	// Pointers are either i32 or externref, casts between the same kind are free
+	if(!isa<BitCastInst>(I) || !I.getType()->isPointerTy())
+		return false;
+	return TypeSupport::isRawPointer(I.getType(), true) == TypeSupport::isRawPointer(I.getOperand(0)->getType(), true);
+}
+
 void CheerpWasmWriter::checkAndSanitizeDependencies(InstructionToDependenciesMap& dependencies) const
 {
 	for (auto& pair : dependencies)
@@ -2424,6 +2456,53 @@ bool CheerpWasmWriter::compileInlineInstruction(WasmBuffer& code, const Instruct
 						}
 						return false;
 					}
+					case Intrinsic::cheerp_externref_table_get:
+					{
+						compileOperand(code, ci.getOperand(0));
+						encodeInst(WasmU32Opcode::TABLE_GET, getExternRefTableIndex(), code);
+						if(useTailCall)
+						{
+							encodeInst(WasmOpcode::RETURN, code);
+							return true;
+						}
+						return false;
+					}
+					case Intrinsic::cheerp_externref_table_set:
+					{
+						compileOperand(code, ci.getOperand(0));
+						compileOperand(code, ci.getOperand(1));
+						encodeInst(WasmU32Opcode::TABLE_SET, getExternRefTableIndex(), code);
+						if(useTailCall)
+							encodeInst(WasmOpcode::RETURN, code);
+						return true;
+					}
+					case Intrinsic::cheerp_externref_table_size:
+					{
+						encodeInst(WasmMiscU32Opcode::TABLE_SIZE, getExternRefTableIndex(), code);
+						if(useTailCall)
+						{
+							encodeInst(WasmOpcode::RETURN, code);
+							return true;
+						}
+						return false;
+					}
+					case Intrinsic::cheerp_externref_table_grow:
+					{
+						compileOperand(code, ci.getOperand(0));
+						compileOperand(code, ci.getOperand(1));
+						encodeInst(WasmMiscU32Opcode::TABLE_GROW, getExternRefTableIndex(), code);
+						if(useTailCall)
+						{
+							encodeInst(WasmOpcode::RETURN, code);
+							return true;
+						}
+						return false;
+					}
+					case Intrinsic::cheerp_externref_table_alloc:
+					case Intrinsic::cheerp_externref_table_free:
+					{
+						llvm::report_fatal_error("Externref table allocations should be removed in the ExternRefTableLowering pass. This is a bug");
+					}
 					case Intrinsic::flt_rounds:
 					{
 						// Rounding mode 1: nearest
@@ -3136,10 +3215,16 @@ bool CheerpWasmWriter::compileInlineInstruction(WasmBuffer& code, const Instruct
 			if(retVal)
 			{
 				// NOTE: If the retValue is inlineable we must render it here
-				//       If 'isReturnPartOfTailCall' return true then retVal must be a CallInst
-				//       so blindly casting it to Instruction is safe
-				if(isReturnPartOfTailCall(ri) && !isInlineable(*cast<Instruction>(retVal)))
-					break;
+				//       If 'isReturnPartOfTailCall' return true then retVal must be a CallInst,
+				//       or a no-op bitcast of one, so blindly casting it to Instruction is safe
+				if(isReturnPartOfTailCall(ri))
+				{
+					const Instruction* retI = cast<Instruction>(retVal);
+					if(!isInlineable(*retI))
+						break;
+					if(isa<BitCastInst>(retI) && !isInlineable(*cast<Instruction>(retI->getOperand(0))))
+						break;
+				}
 				compileOperand(code, I.getOperand(0));
 			}
 			break;
@@ -3891,7 +3976,17 @@ void CheerpWasmWriter::compileCondition(WasmBuffer& code, const llvm::Value* con
 				cast<Constant>(op1)->isNullValue() &&
 				!op0->getType()->isIntegerTy(64))
 		{
-			if(op0->getType()->isPointerTy())
+			if(op0->getType()->isPointerTy() && !TypeSupport::isRawPointer(op0->getType(), true))
+			{
+				// An externref can't be used as a condition directly
+				compileOperand(code, op0);
+				encodeInst(WasmOpcode::REF_IS_NULL, code);
+				if(p == CmpInst::ICMP_NE)
+					encodeInst(WasmOpcode::I32_EQZ, code);
+				teeLocals.removeConsumed();
+				return;
+			}
+			else if(op0->getType()->isPointerTy())
 				compileOperand(code, op0);
 			else if(op0->getType()->isIntegerTy(32))
 				compileSignedInteger(code, op0, /*forComparison*/true);
@@ -4506,37 +4601,70 @@ void CheerpWasmWriter::compileFunctionSection()
 }
 
 
+bool CheerpWasmWriter::usesExternRefTable(const Module& m)
+{
+	for (const Function& F : m)
+	{
+		switch (F.getIntrinsicID())
+		{
+			case Intrinsic::cheerp_externref_table_get:
+			case Intrinsic::cheerp_externref_table_set:
+			case Intrinsic::cheerp_externref_table_size:
+			case Intrinsic::cheerp_externref_table_grow:
+				if (!F.use_empty())
+					return true;
+				break;
+			default:
+				break;
+		}
+	}
+	return false;
+}
+
 void CheerpWasmWriter::compileTableSection()
 {
-	if (linearHelper.getFunctionTables().empty())
+	const bool hasFunctionTable = !linearHelper.getFunctionTables().empty();
+	if (!hasFunctionTable && !externRefTable)
 		return;
 
-	uint32_t count = 0;
-	for (const auto& table : linearHelper.getFunctionTables())
-		count += table.second.functions.size();
-	count = std::min(count, COMPILE_METHOD_LIMIT); // TODO
-
 	Section section(0x04, "Table", this);
 
-	// Encode number of function tables in the table section.
-	encodeULEB128(1, section);
-
-	// Encode element type 'anyfunc'.
-	encodeULEB128(0x70, section);
+	// Encode number of tables in the table section.
+	encodeULEB128(uint32_t(hasFunctionTable) + uint32_t(externRefTable), section);
 
-	// Encode function tables in the table section.
-	if (exportedTable)
+	if (hasFunctionTable)
 	{
-		// Use a 'open ended limit' (= 0x00) with only a minimum value.
-		encodeULEB128(0x00, section);
-		encodeULEB128(count, section);
+		uint32_t count = 0;
+		for (const auto& table : linearHelper.getFunctionTables())
+			count += table.second.functions.size();
+		count = std::min(count, COMPILE_METHOD_LIMIT); // TODO
+
+		// Encode element type 'anyfunc'.
+		encodeULEB128(0x70, section);
+
+		// Encode function tables in the table section.
+		if (exportedTable)
+		{
+			// Use a 'open ended limit' (= 0x00) with only a minimum value.
+			encodeULEB128(0x00, section);
+			encodeULEB128(count, section);
+		}
+		else
+		{
+			// Use 'range limit' (= 0x01) with equal minimum and maximum value (the table is static).
+			encodeULEB128(0x01, section);
+			encodeULEB128(count, section);
+			encodeULEB128(count, section);
+		}
 	}
-	else
+
+	if (externRefTable)
 	{
-		// Use 'range limit' (= 0x01) with equal minimum and maximum value (the table is static).
-		encodeULEB128(0x01, section);
-		encodeULEB128(count, section);
-		encodeULEB128(count, section);
+		// Encode element type 'externref'. The table starts with slot 0, which
+		// always holds null, and grows on demand with table.grow
+		encodeULEB128(0x6f, section);
+		encodeULEB128(0x00, section);
+		encodeULEB128(1, section);
 	}
 
 	section.encode();
@@ -4837,6 +4965,120 @@ void CheerpWasmWriter::compileElementSection()
 	section.encode();
 }
 
+std::string CheerpWasmWriter::computeCodegenConfigKey() const
+{
+	std::string config;
+	raw_string_ostream os(config);
+	// Bump the version whenever the encoding of the methods changes
+	os << "cheerp-wasm-method-v2\n";
+	printCompilerIdentityForKey(os);
+	os << module.getTargetTriple() << '\n' << module.getDataLayoutStr() << '\n';
+	const bool flags[] = { useWasmLoader, prettyCode, sharedMemory, noGrowMemory, exportedTable,
+		AvoidWasmTraps, BoundsCheck, UseBigInts, KeepInvokes, FixWrongFuncCasts, NoNativeJavaScriptMath,
+		WasmReturnCalls, WasmBranchHints, WasmAnyref, WasmNoSIMD, WasmNoGlobalization, WasmNoUnalignedMem,
+		WasmSharedMemory, WasmExportedMemory };
+	for(bool flag: flags)
+		os << (flag ? '1' : '0');
+	os << ' ' << BranchHintThreshold << '\n';
+	os << numberOfImportedFunctions << ' ' << stackTopGlobal << ' ' << usedGlobals << ' ';
+	os << linearHelper.getStackStart() << ' ' << linearHelper.getHeapStart() << ' ' << getExternRefTableIndex() << '\n';
+	for(uint32_t b = BuiltinInstr::NONE + 1; b < BuiltinInstr::MAX_BUILTIN; b++)
+	{
+		if(linearHelper.hasBuiltinId((BuiltinInstr::BUILTIN)b))
+			os << b << ':' << linearHelper.getBuiltinId((BuiltinInstr::BUILTIN)b) << ' ';
+	}
+	os << '\n';
+	// Functions which are called by name when lowering intrinsics
+	for(const char* name: { "memmove", "memcpy", "memset", "malloc", "realloc", "free" })
+	{
+		const Function* f = module.getFunction(name);
+		auto it = f ? linearHelper.getFunctionIds().find(f) : linearHelper.getFunctionIds().end();
+		if(it != linearHelper.getFunctionIds().end())
+			os << name << ':' << it->second << ' ';
+	}
+	SHA1 hasher;
+	hasher.update(os.str());
+	return toHex(hasher.final(), /*LowerCase*/true);
+}
+
+std::string CheerpWasmWriter::computeMethodCacheKey(const Function& F, StringRef configKey, ModuleSlotTracker& MST) const
+{
+	std::string text;
+	raw_string_ostream os(text);
+	os << configKey << '\n';
+	F.getFunctionType()->print(os);
+	os << '\n';
+	// Encode the indices and addresses assigned to the referenced globals,
+	// they are not part of the IR
+	SmallPtrSet<const Constant*, 32> visited;
+	std::function<void(const Constant*)> encodeReferences = [&](const Constant* C)
+	{
+		if(!visited.insert(C).second)
+			return;
+		if(const Function* f = dyn_cast<Function>(C))
+		{
+			os << " fn";
+			auto it = linearHelper.getFunctionIds().find(f);
+			if(it != linearHelper.getFunctionIds().end())
+				os << ':' << it->second;
+			if(linearHelper.functionHasAddress(f))
+				os << '@' << linearHelper.getFunctionAddress(f);
+			// The static branch probabilities depend on these
+			if(f->hasFnAttribute(Attribute::Cold))
+				os << 'c';
+			if(f->hasFnAttribute(Attribute::NoReturn))
+				os << 'n';
+		}
+		else if(const GlobalVariable* GV = dyn_cast<GlobalVariable>(C))
+		{
+			os << " gv";
+			auto it = globalizedGlobalsIDs.find(GV);
+			if(it != globalizedGlobalsIDs.end())
+				os << ':' << it->second;
+			if(linearHelper.hasGlobalVariableAddress(GV))
+				os << '@' << linearHelper.getGlobalVariableAddress(GV);
+		}
+		else if(!isa<GlobalValue>(C))
+		{
+			for(const Use& U: C->operands())
+				encodeReferences(cast<Constant>(U.get()));
+		}
+	};
+	const std::vector<Registerize::RegisterInfo>& regsInfo = registerize.getRegistersForFunction(&F);
+	for(const Registerize::RegisterInfo& regInfo: regsInfo)
+		os << (int)regInfo.regKind;
+	os << '\n';
+	for(const BasicBlock& BB: F)
+	{
+		BB.printAsOperand(os, false, MST);
+		os << ":\n";
+		for(const Instruction& I: BB)
+		{
+			printInstructionForKey(I, os, MST);
+			if(registerize.hasRegisters(&I))
+			{
+				for(uint32_t regId: registerize.getAllRegisterIds(&I, EdgeContext()))
+					os << " r" << regId;
+			}
+			if(const CallBase* CB = dyn_cast<CallBase>(&I))
+			{
+				auto it = linearHelper.getFunctionTables().find(CB->getFunctionType());
+				if(!CB->getCalledFunction() && it != linearHelper.getFunctionTables().end())
+					os << " table:" << it->second.typeIndex;
+			}
+			for(const Use& U: I.operands())
+			{
+				if(const Constant* C = dyn_cast<Constant>(U.get()))
+					encodeReferences(C);
+			}
+			os << '\n';
+		}
+	}
+	SHA1 hasher;
+	hasher.update(os.str());
+	return toHex(hasher.final(), /*LowerCase*/true);
+}
+
 void CheerpWasmWriter::compileCodeSection()
 {
 	Section codeSection(0x0a, "Code", this);
@@ -4853,21 +5095,51 @@ void CheerpWasmWriter::compileCodeSection()
 
 	size_t i = 0;
 
+	std::unique_ptr<MethodCache> methodCache;
+	std::unique_ptr<ModuleSlotTracker> slotTracker;
+	std::string configKey;
+	if(!WasmCodegenCache.empty())
+	{
+		methodCache.reset(new MethodCache(WasmCodegenCache, ".wasmfn"));
+		slotTracker.reset(new ModuleSlotTracker(&module, /*ShouldInitializeAllMetadata*/false));
+		configKey = computeCodegenConfigKey();
+	}
+
 	for (const Function* F: linearHelper.functions())
 	{
 		Chunk<128> method;
 #if WASM_DUMP_METHODS
 		llvm::errs() << i << " method name: " << F->getName() << '\n';
 #endif
-		compileMethod(method, *F);
+		std::string cacheKey;
+		MethodCache::Entry cached;
+		if(methodCache)
+			cacheKey = computeMethodCacheKey(*F, configKey, *slotTracker);
 
 		std::vector<std::pair<uint32_t, bool>> branchHintsVec;
 
-		filterNop(method.buf(), [&branchHintsVec](uint32_t location, char byte)->void{
-			const bool dir = (byte == (char)WasmInvalidOpcode::BRANCH_LIKELY);
-			branchHintsVec.push_back({location, dir});
-		});
-		nopLocations.clear();
+		if(methodCache && methodCache->lookup(cacheKey, cached))
+		{
+			method << cached.body;
+			branchHintsVec = std::move(cached.branchHints);
+		}
+		else
+		{
+			compileMethod(method, *F);
+
+			filterNop(method.buf(), [&branchHintsVec](uint32_t location, char byte)->void{
+				const bool dir = (byte == (char)WasmInvalidOpcode::BRANCH_LIKELY);
+				branchHintsVec.push_back({location, dir});
+			});
+			nopLocations.clear();
+
+			if(methodCache)
+			{
+				cached.body = method.str();
+				cached.branchHints = branchHintsVec;
+				methodCache->store(cacheKey, cached);
+			}
+		}
 
 		if (!branchHintsVec.empty())
 		{
@@ -10,8 +10,10 @@
 //===----------------------------------------------------------------------===//
 
 #include "CFGStackifier.h"
+#include "llvm/ADT/SmallPtrSet.h"
 #include "llvm/ADT/StringExtras.h"
 #include "llvm/Analysis/ValueTracking.h"
+#include "llvm/Cheerp/CommandLine.h"
 #include "llvm/Cheerp/Demangler.h"
 #include "llvm/Cheerp/NameGenerator.h"
 #include "llvm/Cheerp/PHIHandler.h"
@@ -21,11 +23,13 @@
 #include "llvm/IR/IntrinsicInst.h"
 #include "llvm/IR/Intrinsics.h"
 #include "llvm/IR/InstIterator.h"
+#include "llvm/IR/TypeFinder.h"
 #include "llvm/IR/Dominators.h"
 #include "llvm/CodeGen/Analysis.h"
 #include "llvm/Analysis/LoopInfo.h"
 #include "llvm/IR/DebugInfo.h"
 #include "llvm/Support/ErrorHandling.h"
+#include "llvm/Support/SHA1.h"
 #include "llvm/IR/Verifier.h"
 
 #include "llvm/Cheerp/GlobalDepsAnalyzer.h"
@@ -434,9 +438,39 @@ void CheerpWriter::compileMemFunc(const Value* dest, Type* destElementType, cons
 	// Handle the case for multiple elements, it assumes that we can use TypedArray.set
 	if(!constantNumElements)
 		stream << "if(__numElem__>1)" << NewLine << '{';
-	if(!constantNumElements || numElem>1)
+	bool destByteLayout = PA.getPointerKindAssert(dest) == BYTE_LAYOUT;
+	bool srcByteLayout = PA.getPointerKindAssert(src) == BYTE_LAYOUT;
+	if((!constantNumElements || numElem>1) && typeSize>1 && (destByteLayout || srcByteLayout))
+	{
+		// Typed elements inside byte layout structs, like arrays in unions, are
+		// accessed through a DataView. Copy the bytes through Int8Array views of
+		// both sides, since the other side may be a regular typed array
+		auto compileByteView = [&](const Value* p, bool byteLayout)
+		{
+			stream << "new Int8Array(";
+			compilePointerBaseTyped(p, pointedType);
+			stream << ".buffer,";
+			compilePointerBaseTyped(p, pointedType);
+			stream << ".byteOffset+";
+			if(byteLayout)
+				compilePointerOffset(p, ADD_SUB);
+			else
+			{
+				compilePointerOffset(p, MUL_DIV);
+				stream << '*' << typeSize;
+			}
+			stream << ')';
+		};
+		compileByteView(dest, destByteLayout);
+		stream << ".set(";
+		compileByteView(src, srcByteLayout);
+		stream << ".subarray(0,";
+		compileOperand(size, LOWEST);
+		stream << "));" << NewLine;
+	}
+	else if(!constantNumElements || numElem>1)
 	{
-		bool byteLayout = PA.getPointerKindAssert(dest) == BYTE_LAYOUT;
+		bool byteLayout = destByteLayout;
 		// The semantics of TypedArray.set is memmove-like, no need to care about direction
 		if(byteLayout)
 			stream << "(new Int8Array(";
@@ -2888,13 +2922,14 @@ void CheerpWriter::compilePHIOfBlockFromOtherBlock(const BasicBlock* to, const B
 	WriterPHIHandler(*this, from->getParent()).runOnEdge(registerize, from, to);
 }
 
-void CheerpWriter::compileMethodArgs(User::const_op_iterator it, User::const_op_iterator itE, const CallBase& callV, bool forceBoolean)
+void CheerpWriter::compileMethodArgs(User::const_op_iterator it, User::const_op_iterator itE, const CallBase& callV, bool forceBoolean, bool asArray)
 {
 	assert(callV.arg_begin() <= it && it <= callV.arg_end() && "compileMethodArgs, it out of range!");
 	assert(callV.arg_begin() <= itE && itE <= callV.arg_end() && "compileMethodArgs, itE out of range!");
 	assert(it <= itE);
 
-	stream << '(';
+	const char closing = asArray ? ']' : ')';
+	stream << (asArray ? '[' : '(');
 
 	const Function* F = callV.getCalledFunction();
 	bool asmjs = callV.getCaller()->getSection() == StringRef("asmjs");
@@ -2903,7 +2938,7 @@ void CheerpWriter::compileMethodArgs(User::const_op_iterator it, User::const_op_
 	// If the function is only declared and not in client namespace, skip arguments altogether
 	if (F && F->empty() && !TypeSupport::isClientFunc(F) && !TypeSupport::isClientConstructorName(F->getName()))
 	{
-		stream << ')';
+		stream << closing;
 		return;
 	}
 
@@ -3032,7 +3067,7 @@ void CheerpWriter::compileMethodArgs(User::const_op_iterator it, User::const_op_
 			++arg_it;
 		}
 	}
-	stream << ')';
+	stream << closing;
 }
 
 /*
@@ -4449,7 +4484,12 @@ void CheerpWriter::compileLoadElem(const Value* ptrOp, Type* Ty, StructType* STy
 			const StructLayout* SL = targetData.getStructLayout(STy);
 			offset =  SL->getElementOffset(structElemIdx);
 		}
-		if(PTy && (loadKind == REGULAR || loadKind == SPLIT_REGULAR))
+		if(asmjs && isGlobalized(ptrOp))
+		{
+			assert(!STy);
+			stream << getName(ptrOp, 0);
+		}
+		else if(PTy && (loadKind == REGULAR || loadKind == SPLIT_REGULAR))
 		{
 			switch(loadKind)
 			{
@@ -4609,7 +4649,13 @@ void CheerpWriter::compileStoreElem(const StoreInst& si, Type* Ty, StructType* S
 			const StructLayout* SL = targetData.getStructLayout(STy);
 			offset =  SL->getElementOffset(structElemIdx);
 		}
-		compileHeapAccess(ptrOp, Ty, offset);
+		if(asmjs && isGlobalized(ptrOp))
+		{
+			assert(!STy);
+			stream << getName(ptrOp, 0);
+		}
+		else
+			compileHeapAccess(ptrOp, Ty, offset);
 	}
 	else if (ptrKind == BYTE_LAYOUT)
 	{
@@ -4687,11 +4733,12 @@ void CheerpWriter::compileStoreElem(const StoreInst& si, Type* Ty, StructType* S
 		else
 		{
 			PARENT_PRIORITY storePrio = LOWEST;
-			if(asmjs)
+			if(asmjs && !isGlobalized(ptrOp))
 			{
 				// On asm.js we can pretend the store will add a |0
 				// This is not necessarily true in genericjs
 				// As we might be storing in an object member or a plain array
+				// Globalized variables are assigned directly and need the full coercion
 				if(regKind == Registerize::INTEGER)
 					storePrio = BIT_OR;
 				// The same applies for fround
@@ -4703,6 +4750,22 @@ void CheerpWriter::compileStoreElem(const StoreInst& si, Type* Ty, StructType* S
 	}
 }
 
+// genericjs musttail calls are executed by a trampoline, unless the callee is
+// a builtin or an asmjs function. Indirect calls always go through it, the
+// trampoline calls functions without a $tc member directly
+static bool isTrampolinedTailCall(const CallBase& ci)
+{
+	const CallInst* call = dyn_cast<CallInst>(&ci);
+	if(!call || !call->isMustTailCall() || call->isInlineAsm())
+		return false;
+	if(call->getCaller()->getSection() == StringRef("asmjs"))
+		return false;
+	const Value* calledValue = call->getCalledOperand()->stripPointerCasts();
+	if(const Function* F = dyn_cast<Function>(calledValue))
+		return !F->empty() && !F->isIntrinsic() && F->getSection() != StringRef("asmjs");
+	return true;
+}
+
 CheerpWriter::COMPILE_INSTRUCTION_FEEDBACK CheerpWriter::compileCallInstruction(const CallBase& ci, PARENT_PRIORITY parentPrio)
 {
 	bool asmjs = currentFun->getSection() == StringRef("asmjs");
@@ -4719,6 +4782,7 @@ CheerpWriter::COMPILE_INSTRUCTION_FEEDBACK CheerpWriter::compileCallInstruction(
 	// NOTE: if the type is void, OBJECT is returned, but we explicitly
 	// check the void case later
 	Registerize::REGISTER_KIND kind = registerize.getRegKindFromType(retTy, asmjs);
+	const bool trampolined = isTrampolinedTailCall(ci);
 
 	// If the caller is genericjs, the callee is asmjs, and a SPLIT_REGULAR is returned,
 	// the function is returning the offset, not the object. So assign the main name now
@@ -4765,6 +4829,8 @@ CheerpWriter::COMPILE_INSTRUCTION_FEEDBACK CheerpWriter::compileCallInstruction(
 			}
 			return cf;
 		}
+		if(trampolined)
+			stream << namegen.getBuiltinName(NameGenerator::Builtin::TAIL_CALL) << '(';
 		stream << getName(calledFunc, 0);
 	}
 	else if (ci.isInlineAsm())
@@ -4823,6 +4889,8 @@ CheerpWriter::COMPILE_INSTRUCTION_FEEDBACK CheerpWriter::compileCallInstruction(
 	else
 	{
 		//Indirect call, normal mode
+		if(trampolined)
+			stream << namegen.getBuiltinName(NameGenerator::Builtin::TAIL_CALL) << '(';
 		compilePointerAs(calledValue, COMPLETE_OBJECT);
 	}
 
@@ -4830,7 +4898,16 @@ CheerpWriter::COMPILE_INSTRUCTION_FEEDBACK CheerpWriter::compileCallInstruction(
 		// In calling asmjs functions the varargs are passed on the stack
 		bool asmJSCallingConvention = asmjs || (calledFunc && calledFunc->getSection() == StringRef("asmjs"));
 		size_t n = asmJSCallingConvention ? fTy->getNumParams() : ci.arg_size();
-		compileMethodArgs(ci.op_begin(),ci.op_begin()+n, ci, /*forceBoolean*/ false);
+		if(trampolined)
+		{
+			// The arguments are evaluated before the tail call is scheduled,
+			// the trampoline of the caller's caller executes it
+			stream << ',';
+			compileMethodArgs(ci.op_begin(),ci.op_begin()+n, ci, /*forceBoolean*/ false, /*asArray*/ true);
+			stream << ')';
+		}
+		else
+			compileMethodArgs(ci.op_begin(),ci.op_begin()+n, ci, /*forceBoolean*/ false);
 	}
 	if(!retTy->isVoidTy())
 	{
@@ -5509,18 +5586,36 @@ void CheerpWriter::compileMethod(const Function& F)
 		}
 	}
 	currentFun = &F;
-	stream << "function " << getName(&F, 0) << '(';
 	const Function::const_arg_iterator A=F.arg_begin();
 	const Function::const_arg_iterator AE=F.arg_end();
-	for(Function::const_arg_iterator curArg=A;curArg!=AE;++curArg)
+	auto compileParams = [&]()
 	{
-		if(curArg!=A)
-			stream << ',';
-		if(curArg->getType()->isPointerTy() && PA.getPointerKindForArgument(&*curArg) == SPLIT_REGULAR && !PA.getConstantOffsetForPointer(&*curArg))
-			stream << getName(&*curArg, 0) << ',' << getName(&*curArg, 1);
-		else
-			stream << getName(&*curArg, 0);
+		for(Function::const_arg_iterator curArg=A;curArg!=AE;++curArg)
+		{
+			if(curArg!=A)
+				stream << ',';
+			if(curArg->getType()->isPointerTy() && PA.getPointerKindForArgument(&*curArg) == SPLIT_REGULAR && !PA.getConstantOffsetForPointer(&*curArg))
+				stream << getName(&*curArg, 0) << ',' << getName(&*curArg, 1);
+			else
+				stream << getName(&*curArg, 0);
+		}
+	};
+	// The body of functions with trampolined tail calls is stored in the $tc
+	// member, so tail calls skip the trampoline. Every other caller goes through
+	// the wrapper, which runs the scheduled tail calls to completion
+	const bool trampolined = trampolinedFunctions.count(&F);
+	if(trampolined)
+	{
+		stream << "function " << getName(&F, 0) << '(';
+		compileParams();
+		stream << "){return " << namegen.getBuiltinName(NameGenerator::Builtin::TRAMPOLINE) << '(' << getName(&F, 0) << ".$tc(";
+		compileParams();
+		stream << "));}" << NewLine;
+		stream << getName(&F, 0) << ".$tc=function(";
 	}
+	else
+		stream << "function " << getName(&F, 0) << '(';
+	compileParams();
 	stream << "){" << NewLine;
 	if (measureTimeToMain && (&F == (globalDeps.getEntryPoint())))
 	{
@@ -5574,7 +5669,11 @@ void CheerpWriter::compileMethod(const Function& F)
 			DominatorTree &DT = FAM.getResult<DominatorTreeAnalysis>(const_cast<Function&>(F));
 			LoopInfo &LI = FAM.getResult<LoopAnalysis>(const_cast<Function&>(F));
 			CFGStackifier::Mode Mode = asmjs ? CFGStackifier::AsmJS : CFGStackifier::GenericJS;
-			CFGStackifier CN(F, LI, DT, registerize, PA, Mode);
+			// The likely arm of a branch is only laid out first when branch hinting is enabled
+			const BranchProbabilityInfo* BPI = nullptr;
+			if(!asmjs && WasmBranchHints)
+				BPI = &FAM.getResult<BranchProbabilityAnalysis>(const_cast<Function&>(F));
+			CFGStackifier CN(F, LI, DT, registerize, PA, Mode, BPI);
 			compileTokens(CN.Tokens);
 		}
 	}
@@ -5613,11 +5712,215 @@ void CheerpWriter::compileMethod(const Function& F)
 			stream << ';' << NewLine;
 		}
 	}
-	stream << '}' << NewLine;
+	stream << (trampolined ? "};" : "}") << NewLine;
 	currentFun = NULL;
 	typeIdMap.clear();
 }
 
+std::string CheerpWriter::computeCodegenConfigKey()
+{
+	std::string config;
+	raw_string_ostream os(config);
+	// Bump the version whenever the encoding of the methods changes
+	os << "cheerp-js-method-v1\n";
+	printCompilerIdentityForKey(os);
+	os << module.getTargetTriple() << '\n' << module.getDataLayoutStr() << '\n';
+	const bool flags[] = { useNativeJavaScriptMath, useMathImul, useMathFround, measureTimeToMain,
+		noGrowMemory, checkBounds, forceTypedArrays, symbolicGlobalsAsmJS, isRootNeeded, wasmFile.empty(),
+		UseBigInts, KeepInvokes, globalDeps.needAsmJSCode(), globalDeps.needAsmJSMemory(), globalDeps.usesAsmJSMalloc(), WasmBranchHints };
+	for(bool flag: flags)
+		os << (flag ? '1' : '0');
+	os << ' ' << (int)LinearOutput << ' ' << (int)makeModule << ' ' << heapSize << ' ' << BranchHintThreshold << '\n';
+	for(uint32_t b = BuiltinInstr::NONE + 1; b < BuiltinInstr::MAX_BUILTIN; b++)
+		os << (globalDeps.needsBuiltin((BuiltinInstr::BUILTIN)b) ? '1' : '0');
+	os << '\n';
+	namegen.printGlobalNamesForKey(os);
+	// The layout of the types and the kinds of the pointer members are not
+	// part of the code of the functions
+	TypeFinder structTypes;
+	structTypes.run(module, /*onlyNamed*/false);
+	for(StructType* st: structTypes)
+	{
+		st->print(os);
+		os << " = ";
+		if(st->isOpaque())
+		{
+			os << "opaque\n";
+			continue;
+		}
+		os << (st->isPacked() ? "packed" : "") << '{';
+		for(Type* elementType: st->elements())
+		{
+			elementType->print(os);
+			os << ',';
+		}
+		os << '}';
+		if(st->getDirectBase())
+			os << " base " << st->getDirectBase()->getName();
+		if(globalDeps.needsDowncastArray(st))
+			os << " downcast";
+		if(globalDeps.classesWithBaseInfo().count(st))
+			os << " baseinfo";
+		for(uint32_t i = 0; i < st->getNumElements(); i++)
+		{
+			if(!st->getElementType(i)->isPointerTy())
+				continue;
+			TypeAndIndex b(st, i, TypeAndIndex::STRUCT_MEMBER);
+			os << ' ' << i << ':' << (int)PA.getPointerKindForMemberPointer(b);
+			if(const ConstantInt* offset = PA.getConstantOffsetForMember(b))
+				os << '+' << offset->getSExtValue();
+		}
+		os << '\n';
+	}
+	for(const NamedMDNode& md: module.named_metadata())
+	{
+		if(md.getName().startswith("llvm."))
+			continue;
+		md.print(os);
+	}
+	SHA1 hasher;
+	hasher.update(os.str());
+	return toHex(hasher.final(), /*LowerCase*/true);
+}
+
+std::string CheerpWriter::computeMethodCacheKey(const Function& F, StringRef configKey, ModuleSlotTracker& MST) const
+{
+	std::string text;
+	raw_string_ostream os(text);
+	os << configKey << '\n';
+	F.getFunctionType()->print(os);
+	os << ' ' << (&F == globalDeps.getEntryPoint()) << trampolinedFunctions.count(&F) << '\n';
+	namegen.printLocalNamesForKey(F, os);
+	auto encodePointer = [&](const Value* v)
+	{
+		if(!v->getType()->isPointerTy())
+			return;
+		os << " pk" << (int)PA.getPointerKind(v);
+		if(const ConstantInt* offset = PA.getConstantOffsetForPointer(v))
+			os << '+' << offset->getSExtValue();
+	};
+	for(const Argument& arg: F.args())
+		encodePointer(&arg);
+	if(F.getReturnType()->isPointerTy())
+		os << " ret" << (int)PA.getPointerKindForReturn(&F);
+	os << '\n';
+	// Encode the names, the kinds and the addresses of the referenced globals,
+	// they are not part of the IR
+	SmallPtrSet<const Constant*, 32> visited;
+	std::function<void(const Constant*)> encodeReferences = [&](const Constant* C)
+	{
+		if(!visited.insert(C).second)
+			return;
+		encodePointer(C);
+		if(const GlobalValue* GV = dyn_cast<GlobalValue>(C))
+		{
+			os << ' ' << namegen.findGlobalName(GV, 0) << ',' << namegen.findGlobalName(GV, 1);
+			os << ' ' << GV->getValueType()->isStructTy() << GV->getSection();
+			if(const Function* f = dyn_cast<Function>(GV))
+			{
+				os << (f->empty() ? 'd' : 'f');
+				if(f->getReturnType()->isPointerTy())
+					os << " ret" << (int)PA.getPointerKindForReturn(f);
+				for(const Argument& arg: f->args())
+					encodePointer(&arg);
+				if(linearHelper.functionHasAddress(f))
+					os << '@' << linearHelper.getFunctionAddress(f);
+			}
+			else if(const GlobalVariable* gv = dyn_cast<GlobalVariable>(GV))
+			{
+				if(linearHelper.hasGlobalVariableAddress(gv))
+					os << '@' << linearHelper.getGlobalVariableAddress(gv);
+			}
+			return;
+		}
+		for(const Use& U: C->operands())
+			encodeReferences(cast<Constant>(U.get()));
+	};
+	for(const BasicBlock& BB: F)
+	{
+		BB.printAsOperand(os, false, MST);
+		os << ":\n";
+		for(const Instruction& I: BB)
+		{
+			printInstructionForKey(I, os, MST);
+			if(registerize.hasRegisters(&I))
+			{
+				for(uint32_t regId: registerize.getAllRegisterIds(&I, EdgeContext()))
+					os << " r" << regId;
+			}
+			encodePointer(&I);
+			for(const Use& U: I.operands())
+			{
+				encodePointer(U.get());
+				if(const Constant* C = dyn_cast<Constant>(U.get()))
+					encodeReferences(C);
+			}
+			if(const CallBase* CB = dyn_cast<CallBase>(&I))
+			{
+				if(!CB->getCalledFunction())
+				{
+					for(uint32_t i = 0; i < CB->arg_size(); i++)
+					{
+						if(CB->getArgOperand(i)->getType()->isPointerTy())
+						{
+							TypeAndIndex typeAndIndex(CB->getFunctionType(), i, TypeAndIndex::ARGUMENT);
+							os << " ak" << (int)PA.getPointerKindForArgumentTypeAndIndex(typeAndIndex);
+						}
+					}
+				}
+			}
+			else if(const AllocaInst* AI = dyn_cast<AllocaInst>(&I))
+			{
+				// The stores to the alloca which have been removed from the IR
+				if(const AllocaStoresExtractor::OffsetToValueMap* values = allocaStoresExtractor.getValuesForAlloca(AI))
+				{
+					std::vector<std::pair<uint32_t, const Value*>> sorted(values->begin(), values->end());
+					std::sort(sorted.begin(), sorted.end(), [](const std::pair<uint32_t, const Value*>& a, const std::pair<uint32_t, const Value*>& b)
+					{
+						return a.first < b.first;
+					});
+					for(const auto& it: sorted)
+					{
+						os << " [" << it.first << "]=";
+						it.second->printAsOperand(os, false, MST);
+						encodePointer(it.second);
+						if(const Constant* C = dyn_cast<Constant>(it.second))
+							encodeReferences(C);
+					}
+				}
+			}
+			os << '\n';
+		}
+	}
+	SHA1 hasher;
+	hasher.update(os.str());
+	return toHex(hasher.final(), /*LowerCase*/true);
+}
+
+void CheerpWriter::compileMethodCached(const Function& F, const MethodCache& methodCache, StringRef configKey, ModuleSlotTracker& MST)
+{
+	std::string cacheKey = computeMethodCacheKey(F, configKey, MST);
+	MethodCache::Entry cached;
+	if(methodCache.lookup(cacheKey, cached))
+	{
+		stream << StringRef(cached.body);
+		heapNames.setUsedMask(heapNames.getUsedMask() | cached.usedHeaps);
+		return;
+	}
+	// Track the heaps used by this function only
+	uint32_t usedHeaps = heapNames.getUsedMask();
+	heapNames.setUsedMask(0);
+	raw_string_ostream body(cached.body);
+	raw_ostream& out = stream.redirect(body);
+	compileMethod(F);
+	stream.redirect(out);
+	body.flush();
+	out << cached.body;
+	cached.usedHeaps = heapNames.getUsedMask();
+	heapNames.setUsedMask(usedHeaps | cached.usedHeaps);
+	methodCache.store(cacheKey, cached);
+}
+
 CheerpWriter::GlobalSubExprInfo CheerpWriter::compileGlobalSubExpr(const GlobalDepsAnalyzer::SubExprVec& subExpr)
 {
 	for ( auto it = std::next(subExpr.begin()); it != subExpr.end(); ++it )
@@ -5795,6 +6098,43 @@ void CheerpWriter::compileGlobalAsmJS(const GlobalVariable& G)
 #endif
 		return;
 	}
+	if (isGlobalized(&G))
+	{
+		// The global lives in a module variable, the declaration must be a literal of the right type
+		stream << "var " << getName(&G, 0) << '=';
+		const Constant* init = G.getInitializer();
+		if (const ConstantFP* CF = dyn_cast<ConstantFP>(init))
+		{
+			bool isFloat = CF->getType()->isFloatTy();
+			double value = isFloat ? CF->getValueAPF().convertToFloat() : CF->getValueAPF().convertToDouble();
+			char buf[32];
+			snprintf(buf, sizeof(buf), "%.17g", value);
+			std::string literal(buf);
+			// NOTE: V8 requires the `.` to identify it as a double in asm.js
+			if (literal.find('.') == std::string::npos)
+			{
+				size_t exponent = literal.find('e');
+				if (exponent == std::string::npos)
+					literal += '.';
+				else
+					literal.insert(exponent, ".");
+			}
+			if (isFloat)
+				stream << namegen.getBuiltinName(NameGenerator::Builtin::FROUND) << '(' << literal << ')';
+			else
+				stream << literal;
+		}
+		else if (const ConstantInt* CI = dyn_cast<ConstantInt>(init))
+			stream << CI->getSExtValue();
+		else if (G.getValueType()->isFloatTy())
+			stream << namegen.getBuiltinName(NameGenerator::Builtin::FROUND) << "(0.)";
+		else if (G.getValueType()->isDoubleTy())
+			stream << "0.";
+		else
+			stream << '0';
+		stream << ';' << NewLine;
+		return;
+	}
 	if (symbolicGlobalsAsmJS)
 	{
 		stream << "var " << getName(&G, 0) << '=';
@@ -5812,7 +6152,7 @@ void CheerpWriter::compileGlobalsInitAsmJS()
 		BinaryBytesWriter bytesWriter(os);
 		uint32_t last_address = linearHelper.getStackStart();
 		uint32_t last_size = 0;
-		for ( const GlobalVariable* GV : linearHelper.globals() )
+		for ( const GlobalVariable* GV : linearHelper.addressableGlobals() )
 		{
 			if (GV->hasInitializer())
 			{
@@ -5836,7 +6176,7 @@ void CheerpWriter::compileGlobalsInitAsmJS()
 	}
 	else
 	{
-		for ( const GlobalVariable* GV : linearHelper.globals() )
+		for ( const GlobalVariable* GV : linearHelper.addressableGlobals() )
 		{
 			if (GV->hasInitializer())
 			{
@@ -5908,6 +6248,13 @@ void CheerpWriter::compileHandleVAArg()
 	stream << "function " << namegen.getBuiltinName(NameGenerator::Builtin::HANDLE_VAARG) << "(ptr){var ret=ptr.d[ptr.o];ptr.o++;return ret;}" << NewLine;
 }
 
+void CheerpWriter::compileTailCallHelpers()
+{
+	StringRef tailCall = namegen.getBuiltinName(NameGenerator::Builtin::TAIL_CALL);
+	stream << "function " << tailCall << "(f,a){" << tailCall << ".f=f.$tc||f;" << tailCall << ".a=a;}" << NewLine;
+	stream << "function " << namegen.getBuiltinName(NameGenerator::Builtin::TRAMPOLINE) << "(r){var t=" << tailCall << ";while(t.f){var f=t.f;t.f=null;r=f.apply(null,t.a);}return r;}" << NewLine;
+}
+
 void CheerpWriter::compileCheerpException()
 {
 	stream << "function CheerpException(m){" << NewLine;
@@ -6031,6 +6378,59 @@ void CheerpWriter::compileGrowMem()
 	stream << "}" << NewLine;
 }
 
+void CheerpWriter::compileProfileDump()
+{
+	// See InstrProfLowering for the layout of the counters
+	const NamedMDNode* countersMD = module.getNamedMetadata("cheerp_profile_counters");
+	const NamedMDNode* functionsMD = module.getNamedMetadata("cheerp_profile_functions");
+	if(!countersMD || !functionsMD || countersMD->getNumOperands() == 0)
+		return;
+	const ConstantAsMetadata* countersCM = dyn_cast_or_null<ConstantAsMetadata>(countersMD->getOperand(0)->getOperand(0));
+	// The counters have been removed if no instrumented code is left
+	if(!countersCM)
+		return;
+	const GlobalVariable* counters = cast<GlobalVariable>(countersCM->getValue());
+	const bool linearMemory = counters->getSection() == StringRef("asmjs");
+	if(linearMemory && !linearHelper.hasGlobalVariableAddress(counters))
+		return;
+
+	// The storage is bound through an arrow function, so that it is read from
+	// the outer scope and after the heaps have been (re)assigned
+	stream << "globalThis.__cheerpProfileDump=function(h,ret,i){" << NewLine;
+	stream << "h=h();ret='';" << NewLine;
+	for(const MDNode* node: functionsMD->operands())
+	{
+		StringRef name = cast<MDString>(node->getOperand(0))->getString();
+		uint64_t hash = mdconst::extract<ConstantInt>(node->getOperand(1))->getZExtValue();
+		uint32_t first = mdconst::extract<ConstantInt>(node->getOperand(2))->getZExtValue();
+		uint32_t num = mdconst::extract<ConstantInt>(node->getOperand(3))->getZExtValue();
+		stream << "ret+=\"";
+		auto& rawStream = stream.getRawStream();
+		uint64_t beginVal = rawStream.tell();
+		compileEscapedString(rawStream, name, /*forJSON*/false);
+		stream.syncRawStream(beginVal);
+		stream << "\\n# Func Hash:\\n" << hash << "\\n# Num Counters:\\n" << num << "\\n# Counter Values:\\n\";" << NewLine;
+		stream << "for(i=" << first << ";i<" << first + num << ";i++)ret+=";
+		if(linearMemory)
+		{
+			// 64-bit counters, read as two 32-bit halves
+			uint32_t base = linearHelper.getGlobalVariableAddress(counters) >> 2;
+			stream << "(h[" << base << "+2*i]>>>0)+(h[" << base << "+2*i+1]>>>0)*4294967296";
+		}
+		else
+			stream << "(h[i]>>>0)";
+		stream << "+'\\n';" << NewLine;
+		stream << "ret+='\\n';" << NewLine;
+	}
+	stream << "return ret;" << NewLine;
+	stream << "}.bind(null,()=>";
+	if(linearMemory)
+		stream << getHeapName(HEAP32);
+	else
+		compileCompleteObject(counters);
+	stream << ");" << NewLine;
+}
+
 void CheerpWriter::compileMathDeclAsmJS()
 {
 	stream << "var Infinity=stdlib.Infinity;" << NewLine;
@@ -6408,6 +6808,18 @@ void CheerpWriter::compileGenericJS()
 		prependRootToNames(decls);
 	normalizeDeclList(std::move(decls));
 
+	// The cached output would be out of sync with the source maps, and the
+	// readable names are not stable
+	std::unique_ptr<MethodCache> methodCache;
+	std::unique_ptr<ModuleSlotTracker> slotTracker;
+	std::string configKey;
+	if(!JSCodegenCache.empty() && !sourceMapGenerator && !readableOutput)
+	{
+		methodCache.reset(new MethodCache(JSCodegenCache, ".jsfn"));
+		slotTracker.reset(new ModuleSlotTracker(&module, /*ShouldInitializeAllMetadata*/false));
+		configKey = computeCodegenConfigKey();
+	}
+
 	for (const Function& F: module.functions())
 	{
 		if (F.getSection() == "asmjs")
@@ -6417,7 +6829,10 @@ void CheerpWriter::compileGenericJS()
 #ifdef CHEERP_DEBUG_POINTERS
 			dumpAllPointers(F, PA);
 #endif //CHEERP_DEBUG_POINTERS
-			compileMethod(F);
+			if(methodCache)
+				compileMethodCached(F, *methodCache, configKey, *slotTracker);
+			else
+				compileMethod(F);
 		}
 	}
 	for ( const GlobalVariable & GV : module.getGlobalList() )
@@ -6455,6 +6870,10 @@ void CheerpWriter::compileGenericJS()
 	if( globalDeps.needHandleVAArg() )
 		compileHandleVAArg();
 
+	//Compile the tail call trampoline if needed
+	if( !trampolinedFunctions.empty() )
+		compileTailCallHelpers();
+
 	//Compile CheerpException if needed
 	if(globalDeps.needCheerpException())
 		compileCheerpException();
@@ -6462,6 +6881,8 @@ void CheerpWriter::compileGenericJS()
 	//Compile growLinearMemory if needed
 	if (globalDeps.needsBuiltin(BuiltinInstr::BUILTIN::GROW_MEM))
 		compileGrowMem();
+
+	compileProfileDump();
 }
 
 void CheerpWriter::compileDummies()
@@ -6808,6 +7229,30 @@ void CheerpWriter::compileFileEnd(const OptionsSet& options)
 		compileModuleClosureEnd();
 }
 
+void CheerpWriter::collectTrampolinedFunctions()
+{
+	for(const Function& F: module.functions())
+	{
+		const bool asmjs = F.getSection() == StringRef("asmjs");
+		// Wasm functions are compiled by the wasm writer
+		if(F.empty() || (asmjs && LinearOutput == Wasm))
+			continue;
+		for(const BasicBlock& BB: F)
+		{
+			for(const Instruction& I: BB)
+			{
+				const CallInst* ci = dyn_cast<CallInst>(&I);
+				if(!ci || !ci->isMustTailCall())
+					continue;
+				if(isTrampolinedTailCall(*ci))
+					trampolinedFunctions.insert(&F);
+				else
+					llvm::errs() << "warning: musttail call in function '" << F.getName() << "' is compiled as a regular call\n";
+			}
+		}
+	}
+}
+
 void CheerpWriter::makeJS()
 {
 	const bool needWasmLoader = !wasmFile.empty();
@@ -6829,6 +7274,7 @@ void CheerpWriter::makeJS()
 
 	compileFileBegin(options);
 
+	collectTrampolinedFunctions();
 	compileHelpers();
 	compileGenericJS();
 
@@ -0,0 +1,153 @@
+//===-- MethodCache.cpp - Cache of compiled functions ----------------------===//
+//
+//                     Cheerp: The C++ compiler for the Web
+//
+// This file is distributed under the Apache License v2.0 with LLVM Exceptions.
+// See LICENSE.TXT for details.
+//
+// Copyright 2023 Leaning Technologies
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/Cheerp/MethodCache.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/InstrTypes.h"
+#include "llvm/IR/Metadata.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/LEB128.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/VCSRevision.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+
+namespace cheerp {
+
+// Entries are the magic, the used heaps, the number of branch hints followed
+// by the hints as offset and direction pairs, then the body
+static const char EntryMagic[4] = { 'C', 'M', 'C', '1' };
+
+MethodCache::MethodCache(StringRef directory, StringRef extension): directory(directory.str()), extension(extension.str())
+{
+	sys::fs::create_directories(directory);
+}
+
+std::string MethodCache::getEntryPath(StringRef key) const
+{
+	SmallString<128> path(directory);
+	sys::path::append(path, key + extension);
+	return path.str().str();
+}
+
+bool MethodCache::lookup(StringRef key, Entry& entry) const
+{
+	ErrorOr<std::unique_ptr<MemoryBuffer>> buffer = MemoryBuffer::getFile(getEntryPath(key));
+	if(!buffer)
+		return false;
+	StringRef data = (*buffer)->getBuffer();
+	if(!data.startswith(StringRef(EntryMagic, sizeof(EntryMagic))))
+		return false;
+	const uint8_t* cur = data.bytes_begin() + sizeof(EntryMagic);
+	const uint8_t* end = data.bytes_end();
+	const char* error = nullptr;
+	unsigned size = 0;
+	uint64_t usedHeaps = decodeULEB128(cur, &size, end, &error);
+	if(error)
+		return false;
+	cur += size;
+	entry.usedHeaps = usedHeaps;
+	uint64_t numHints = decodeULEB128(cur, &size, end, &error);
+	if(error)
+		return false;
+	cur += size;
+	entry.branchHints.clear();
+	for(uint64_t i = 0; i < numHints; i++)
+	{
+		uint64_t offset = decodeULEB128(cur, &size, end, &error);
+		if(error || cur + size >= end)
+			return false;
+		cur += size;
+		entry.branchHints.push_back(std::make_pair(offset, *cur++ != 0));
+	}
+	entry.body.assign(reinterpret_cast<const char*>(cur), end - cur);
+	return true;
+}
+
+void MethodCache::store(StringRef key, const Entry& entry) const
+{
+	SmallString<128> tempPath;
+	int FD;
+	if(sys::fs::createUniqueFile(getEntryPath(key) + ".%%%%%%.tmp", FD, tempPath))
+		return;
+	{
+		raw_fd_ostream out(FD, /*shouldClose*/true);
+		out.write(EntryMagic, sizeof(EntryMagic));
+		encodeULEB128(entry.usedHeaps, out);
+		encodeULEB128(entry.branchHints.size(), out);
+		for(const auto& hint: entry.branchHints)
+		{
+			encodeULEB128(hint.first, out);
+			out << (char)(hint.second ? 1 : 0);
+		}
+		out << entry.body;
+		out.close();
+		if(out.has_error())
+		{
+			out.clear_error();
+			sys::fs::remove(tempPath);
+			return;
+		}
+	}
+	// Readers either see the complete entry or none at all
+	if(sys::fs::rename(tempPath, getEntryPath(key)))
+		sys::fs::remove(tempPath);
+}
+
+void printCompilerIdentityForKey(raw_ostream& os)
+{
+	os << LLVM_VERSION_STRING;
+#ifdef LLVM_REVISION
+	os << ' ' << LLVM_REVISION;
+#endif
+	os << '\n';
+}
+
+void printInstructionForKey(const Instruction& I, raw_ostream& os, ModuleSlotTracker& MST)
+{
+	std::string inst;
+	raw_string_ostream instOs(inst);
+	I.print(instOs, MST);
+	// Drop the metadata and attribute group slots outside of string literals
+	bool inString = false;
+	for(size_t i = 0; i < inst.size(); i++)
+	{
+		char c = inst[i];
+		if(c == '"')
+			inString = !inString;
+		else if(!inString && (c == '!' || c == '#') && i + 1 < inst.size() && isDigit(inst[i + 1]))
+		{
+			while(i + 1 < inst.size() && isDigit(inst[i + 1]))
+				i++;
+			continue;
+		}
+		os << c;
+	}
+	if(const CallBase* CB = dyn_cast<CallBase>(&I))
+		os << ' ' << CB->getAttributes().getAsString(AttributeList::FunctionIndex);
+	if(const MDNode* prof = I.getMetadata(LLVMContext::MD_prof))
+	{
+		for(const MDOperand& op: prof->operands())
+		{
+			if(const MDString* str = dyn_cast_or_null<MDString>(op.get()))
+				os << ' ' << str->getString();
+			else if(const ConstantAsMetadata* CM = dyn_cast_or_null<ConstantAsMetadata>(op.get()))
+				CM->getValue()->printAsOperand(os, false);
+		}
+	}
+}
+
+}
@@ -17,6 +17,10 @@
 #include "llvm/Cheerp/Utility.h"
 #include "llvm/IR/Function.h"
 #include "llvm/IR/InlineAsm.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringSet.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
 #include <functional>
 #include <set>
 
@@ -24,14 +28,29 @@ using namespace llvm;
 
 namespace cheerp {
 
+// The keys of the builtins in the stable name map. The map is persisted across
+// builds, so they must not depend on the order of the Builtin enum
+static const char* const builtinMapKeys[] = {
+	"IMUL", "FROUND", "ABS", "ACOS", "ASIN", "ATAN", "ATAN2", "CEIL", "COS",
+	"EXP", "FLOOR", "LOG", "POW", "SIN", "SQRT", "TAN", "CLZ32", "CREATE_CLOSURE",
+	"CREATE_CLOSURE_SPLIT", "CREATE_POINTER_ARRAY", "STACKPTR", "GROW_MEM",
+	"ASSIGN_HEAPS", "DUMMY", "HANDLE_VAARG", "EXCEPTION", "FETCHBUFFER",
+	"TAIL_CALL", "TRAMPOLINE", "MEMORY", "HEAP8", "HEAP16", "HEAP32", "HEAP64",
+	"HEAPF32", "HEAPF64",
+};
+static_assert(sizeof(builtinMapKeys) / sizeof(builtinMapKeys[0]) == NameGenerator::END,
+	"Every builtin needs a key in the stable name map");
+
 NameGenerator::NameGenerator(const Module& M, const GlobalDepsAnalyzer& gda, Registerize& r,
 				const PointerAnalyzer& PA,  LinearMemoryHelper& linearHelper,
 				const std::vector<std::string>& rn, bool makeReadableNames,
-				bool exportedMemory):
+				bool exportedMemory, StringRef nameMapFile):
 				registerize(r), PA(PA), reservedNames(buildReservedNamesList(M, rn))
 {
 	if ( makeReadableNames )
 		generateReadableNames(M, gda, linearHelper);
+	else if ( !nameMapFile.empty() )
+		generateStableNames(M, gda, linearHelper, exportedMemory, nameMapFile);
 	else
 		generateCompressedNames(M, gda, linearHelper, exportedMemory);
 }
@@ -104,25 +123,8 @@ SmallString< 4 > NameGenerator::filterLLVMName(StringRef s, NAME_FILTER_MODE fil
 	return ans;
 }
 
-void NameGenerator::generateCompressedNames(const Module& M, const GlobalDepsAnalyzer& gda, LinearMemoryHelper& linearHelper, bool exportedMemory)
+NameGenerator::useLocalVec NameGenerator::collectFunctionLocals(const Function& f)
 {
-	typedef std::pair<unsigned, const GlobalValue *> useGlobalPair;
-	// We either encode arguments in the Value or a pair of (Function, register id)
-	// This will be unified to the second case when we registerize args
-	struct localData
-	{
-		const llvm::Value* argOrFunc;
-		uint32_t regId;
-		bool needsSecondaryName;
-	};
-	typedef std::pair<unsigned, localData> useLocalPair;
-	typedef std::pair<unsigned, std::vector<localData>> useLocalsPair;
-	typedef std::vector<useLocalPair> useLocalVec;
-	typedef std::vector<useLocalsPair> useLocalsVec;
-	typedef std::pair<unsigned, Type*> useTypesPair;
-
-	typedef std::set<useTypesPair, std::greater<useTypesPair>> useTypesSet;
-        
 	// Class to handle giving names to temporary variables needed for recursively dependent PHIs
 	class CompressedPHIHandler: public PHIHandlerUsingTemp
 	{
@@ -151,6 +153,68 @@ void NameGenerator::generateCompressedNames(const Module& M, const GlobalDepsAna
 			// Nothing to do here, we have already given names to all PHIs
 		}
 	};
+
+	// The first part of this vector is for register based locals, after those there are arguments
+	useLocalVec thisFunctionLocals;
+	const std::vector<Registerize::RegisterInfo>& regsInfo = registerize.getRegistersForFunction(&f);
+	thisFunctionLocals.reserve(regsInfo.size());
+	for(unsigned regId = 0; regId < regsInfo.size(); regId++)
+	{
+		thisFunctionLocals.emplace_back(0, localData{&f, regId, false});
+	}
+
+	// Insert all the instructions
+	for (const BasicBlock & bb : f)
+	{
+		for (const Instruction & I : bb)
+		{
+			if ( needsName(I, PA) )
+			{
+				auto registerIds = registerize.getAllRegisterIds(&I, EdgeContext::emptyContext());
+				for(uint32_t registerId: registerIds)
+				{
+					assert(registerId < thisFunctionLocals.size());
+					useLocalPair& regData = thisFunctionLocals[registerId];
+					// Add the uses for this instruction to the total count for the register
+					regData.first+=I.getNumUses();
+					assert(regData.second.argOrFunc);
+				}
+			}
+		}
+		// Handle the special names required for the edges between blocks
+		const Instruction* term=bb.getTerminator();
+		for(uint32_t i=0;i<term->getNumSuccessors();i++)
+		{
+			EdgeContext localEdgeContext;
+			const BasicBlock* succBB=term->getSuccessor(i);
+			CompressedPHIHandler(*this, localEdgeContext, thisFunctionLocals).runOnEdge(registerize, &bb, succBB);
+		}
+	}
+
+	uint32_t currentArgPos=thisFunctionLocals.size();
+	thisFunctionLocals.resize(currentArgPos+f.arg_size());
+	// Insert the arguments
+	for ( auto& arg: f.args())
+	{
+		thisFunctionLocals[currentArgPos].first = f.getNumUses();
+		bool needsTwoNames = arg.getType()->isPointerTy() && PA.getPointerKindForArgument(&arg) == SPLIT_REGULAR;
+		thisFunctionLocals[currentArgPos].second = localData{&arg, 0, needsTwoNames};
+		currentArgPos++;
+	}
+
+	std::sort(thisFunctionLocals.begin(),thisFunctionLocals.end(), [](const useLocalPair& lhs, const useLocalPair& rhs) { return lhs.first < rhs.first; });
+	return thisFunctionLocals;
+}
+
+void NameGenerator::generateCompressedNames(const Module& M, const GlobalDepsAnalyzer& gda, LinearMemoryHelper& linearHelper, bool exportedMemory)
+{
+	typedef std::pair<unsigned, const GlobalValue *> useGlobalPair;
+	typedef std::pair<unsigned, std::vector<localData>> useLocalsPair;
+	typedef std::vector<useLocalsPair> useLocalsVec;
+	typedef std::pair<unsigned, Type*> useTypesPair;
+
+	typedef std::set<useTypesPair, std::greater<useTypesPair>> useTypesSet;
+
 	/**
 	 * Collect the types that need a constructor.
 	 * 
@@ -212,59 +276,12 @@ void NameGenerator::generateCompressedNames(const Module& M, const GlobalDepsAna
 		if ( f.empty() ) 
 			continue;
 
-		// The first part of this vector is for register based locals, after those there are arguments
-		useLocalVec thisFunctionLocals;
-		const std::vector<Registerize::RegisterInfo>& regsInfo = registerize.getRegistersForFunction(&f);
-		thisFunctionLocals.reserve(regsInfo.size());
-		for(unsigned regId = 0; regId < regsInfo.size(); regId++)
-		{
-			thisFunctionLocals.emplace_back(0, localData{&f, regId, false});
-		}
-
-		// Insert all the instructions
-		for (const BasicBlock & bb : f)
-		{
-			for (const Instruction & I : bb)
-			{
-				if ( needsName(I, PA) )
-				{
-					auto registerIds = registerize.getAllRegisterIds(&I, EdgeContext::emptyContext());
-					for(uint32_t registerId: registerIds)
-					{
-						assert(registerId < thisFunctionLocals.size());
-						useLocalPair& regData = thisFunctionLocals[registerId];
-						// Add the uses for this instruction to the total count for the register
-						regData.first+=I.getNumUses();
-						assert(regData.second.argOrFunc);
-					}
-				}
-			}
-			// Handle the special names required for the edges between blocks
-			const Instruction* term=bb.getTerminator();
-			for(uint32_t i=0;i<term->getNumSuccessors();i++)
-			{
-				EdgeContext localEdgeContext;
-				const BasicBlock* succBB=term->getSuccessor(i);
-				CompressedPHIHandler(*this, localEdgeContext, thisFunctionLocals).runOnEdge(registerize, &bb, succBB);
-			}
-		}
-
-		uint32_t currentArgPos=thisFunctionLocals.size();
-		thisFunctionLocals.resize(currentArgPos+f.arg_size());
-		// Insert the arguments
-		for ( auto& arg: f.args())
-		{
-			thisFunctionLocals[currentArgPos].first = f.getNumUses();
-			bool needsTwoNames = arg.getType()->isPointerTy() && PA.getPointerKindForArgument(&arg) == SPLIT_REGULAR;
-			thisFunctionLocals[currentArgPos].second = localData{&arg, 0, needsTwoNames};
-			currentArgPos++;
-		}
+		useLocalVec thisFunctionLocals = collectFunctionLocals(f);
 
 		// Resize allLocalValues so that we have empty useValuesPair at the end of the container
 		if ( thisFunctionLocals.size() > allLocalValues.size() )
 			allLocalValues.resize( thisFunctionLocals.size() );
 
-		std::sort(thisFunctionLocals.begin(),thisFunctionLocals.end(), [](const useLocalPair& lhs, const useLocalPair& rhs) { return lhs.first < rhs.first; });
 		auto dst_it = allLocalValues.begin();
 
 		for (auto src_it = thisFunctionLocals.rbegin(); src_it != thisFunctionLocals.rend(); ++src_it, ++dst_it )
@@ -503,6 +520,224 @@ void NameGenerator::generateCompressedNames(const Module& M, const GlobalDepsAna
 		assignLocalName(nameHelper.makeLocalName());
 }
 
+void NameGenerator::generateStableNames(const Module& M, const GlobalDepsAnalyzer& gda, LinearMemoryHelper& linearHelper, bool exportedMemory, StringRef nameMapFile)
+{
+	/**
+	 * Global names are persisted in the name map, keyed by a description of
+	 * what they name, so that they do not change across builds. They are all
+	 * prefixed and the local names never start with the prefix, since we could
+	 * not otherwise give to the locals names that do not clash with the globals
+	 * added by later builds.
+	 * Local names only depend on the function, the most used local takes the
+	 * shortest name.
+	 */
+	const std::string prefix = GlobalPrefix.empty() ? std::string("$") : std::string(GlobalPrefix);
+	JSSymbols symbols(reservedNames);
+
+	StringMap<SmallString<4>> nameMap;
+	StringSet<> takenNames;
+	if(ErrorOr<std::unique_ptr<MemoryBuffer>> buffer = MemoryBuffer::getFile(nameMapFile))
+	{
+		SmallVector<StringRef, 0> lines;
+		(*buffer)->getBuffer().split(lines, '\n', -1, /*KeepEmpty*/false);
+		for(StringRef line: lines)
+		{
+			std::pair<StringRef, StringRef> nameAndKey = line.split('\t');
+			SmallString<4> name(nameAndKey.first);
+			// Drop the names which are no longer valid, e.g. because the prefix
+			// or the reserved names changed
+			if(nameAndKey.second.empty() || name.size() <= prefix.size() || !name.startswith(prefix) || symbols.is_reserved_name(name))
+				continue;
+			if(!takenNames.insert(name).second)
+				continue;
+			nameMap[nameAndKey.second] = name;
+		}
+	}
+
+	name_iterator<JSSymbols> global_name_iterator(prefix, JSSymbols(reservedNames));
+	StringSet<> usedKeys;
+	auto makeGlobalName = [&](std::string key) -> SmallString<4>
+	{
+		// Entities without a stable description, or which can not be stored
+		// in the map, get a fresh name
+		if(key.find_first_of("\t\n") != std::string::npos || !usedKeys.insert(key).second)
+			key.clear();
+		if(!key.empty())
+		{
+			auto it = nameMap.find(key);
+			if(it != nameMap.end())
+				return it->second;
+		}
+		while(takenNames.count(*global_name_iterator))
+			++global_name_iterator;
+		SmallString<4> name = *global_name_iterator++;
+		takenNames.insert(name);
+		if(!key.empty())
+			nameMap[key] = name;
+		return name;
+	};
+	auto typeKey = [](StringRef kind, const Type* T) -> std::string
+	{
+		std::string key(kind);
+		raw_string_ostream os(key);
+		const StructType* st = dyn_cast<StructType>(T);
+		if(st && st->hasName())
+			os << st->getName();
+		else
+			T->print(os);
+		return os.str();
+	};
+	auto valueKey = [](StringRef kind, const GlobalValue* GV) -> std::string
+	{
+		if(!GV->hasName())
+			return std::string();
+		return (kind + GV->getName()).str();
+	};
+	auto builtinKey = [](int b) -> std::string
+	{
+		return std::string("b:") + builtinMapKeys[b];
+	};
+
+	// HEAP names are used everywhere, give them the shortest names if they are new
+	if(gda.needAsmJSMemory() || gda.needAsmJSCode())
+	{
+		if (exportedMemory)
+		{
+			builtins[HEAP8] = "HEAP8";
+			builtins[HEAP16] = "HEAP16";
+			builtins[HEAP32] = "HEAP32";
+			builtins[HEAP64] = "HEAP64";
+			builtins[HEAPF32] = "HEAPF32";
+			builtins[HEAPF64] = "HEAPF64";
+		}
+		else
+		{
+			for(int i=HEAP8;i<=HEAPF64;i++)
+				builtins[i] = makeGlobalName(builtinKey(i));
+		}
+	}
+	else
+	{
+		for(int i=HEAP8;i<=HEAPF64;i++)
+			builtins[i] = "null";
+	}
+
+	// New global values are named in order of decreasing uses, and in module
+	// order for the same number of uses
+	std::vector<std::pair<unsigned, const GlobalValue*>> globalValues;
+	const Function* entryPoint = gda.getEntryPoint();
+	for (const Function & f : M.getFunctionList() )
+	{
+		unsigned nUses = f.getNumUses();
+		if ( &f == entryPoint)
+			++nUses; // We explicitly invoke the entry point
+		globalValues.emplace_back( nUses, &f );
+	}
+	for ( const GlobalVariable & GV : M.getGlobalList() )
+	{
+		if ( TypeSupport::isClientGlobal(&GV) )
+		{
+			demangler_iterator dmg( GV.getName() );
+			assert(*dmg == "client");
+			namemap.emplace( &GV, *(++dmg) );
+			continue;
+		}
+		globalValues.emplace_back( GV.getNumUses(), &GV );
+	}
+	std::stable_sort(globalValues.begin(), globalValues.end(),
+		[](const std::pair<unsigned, const GlobalValue*>& lhs, const std::pair<unsigned, const GlobalValue*>& rhs) { return lhs.first > rhs.first; });
+	for (const auto& it: globalValues)
+	{
+		const GlobalValue* G = it.second;
+		namemap.emplace( G, makeGlobalName(valueKey("g:", G)) );
+		if(G->getType()->isPointerTy() && PA.getPointerKind(G) == SPLIT_REGULAR && !PA.getConstantOffsetForPointer(G))
+			secondaryNamemap.emplace( G, makeGlobalName(valueKey("s:", G)) );
+	}
+
+	for(Type* T: gda.classesWithBaseInfo())
+		classmap.emplace(T, makeGlobalName(typeKey("c:", T)));
+	for(Type* T: gda.classesUsed())
+		constructormap.emplace(T, makeGlobalName(typeKey("n:", T)));
+	for(Type* T: gda.dynAllocArrays())
+		arraymap.emplace(T, makeGlobalName(typeKey("a:", T)));
+	for(Type* T: gda.dynResizeArrays())
+		resizemap.emplace(T, makeGlobalName(typeKey("r:", T)));
+	for(auto& tableIt: linearHelper.getFunctionTables())
+		tableIt.second.name = makeGlobalName(typeKey("t:", tableIt.first));
+	for(int i=IMUL;i<MEMORY;i++)
+		builtins[i] = makeGlobalName(builtinKey(i));
+	if(exportedMemory)
+		builtins[MEMORY] = "memory";
+	else
+		builtins[MEMORY] = makeGlobalName(builtinKey(MEMORY));
+
+	// Local names are shared by all the functions, generate them lazily
+	name_iterator<JSSymbols> local_name_iterator{StringRef(), JSSymbols(reservedNames)};
+	std::vector<SmallString<4>> localNames;
+	auto getLocalName = [&](uint32_t i) -> StringRef
+	{
+		while(localNames.size() <= i)
+		{
+			if(local_name_iterator->startswith(prefix))
+			{
+				// Skip over all this sub-part of the range
+				local_name_iterator.advance(prefix.size());
+				assert(!local_name_iterator->startswith(prefix));
+			}
+			localNames.push_back(*local_name_iterator++);
+		}
+		return localNames[i];
+	};
+	for (const Function & f : M.getFunctionList() )
+	{
+		if ( f.empty() )
+			continue;
+		useLocalVec thisFunctionLocals = collectFunctionLocals(f);
+		uint32_t nextLocal = 0;
+		for (auto it = thisFunctionLocals.rbegin(); it != thisFunctionLocals.rend(); ++it)
+		{
+			const localData& v = it->second;
+			SmallString<4> primaryName = getLocalName(nextLocal++);
+			if(const llvm::Function* func = dyn_cast<llvm::Function>(v.argOrFunc))
+			{
+				regNamemap.emplace( std::make_pair( func, v.regId ), primaryName);
+				if(v.needsSecondaryName)
+					regSecondaryNamemap.emplace( std::make_pair( func, v.regId ), getLocalName(nextLocal++));
+			}
+			else
+			{
+				namemap.emplace( v.argOrFunc, primaryName );
+				if(v.needsSecondaryName)
+					secondaryNamemap.emplace( v.argOrFunc, getLocalName(nextLocal++) );
+			}
+			assignLocalName(primaryName);
+		}
+	}
+	if (shortestLocalName.size() == 0)
+		assignLocalName(getLocalName(0));
+
+	// Store the updated map. Names which are no longer used are kept, so that
+	// they are not given to something else by later builds.
+	std::vector<std::pair<StringRef, StringRef>> entries;
+	for(const auto& it: nameMap)
+		entries.emplace_back(it.getKey(), it.getValue());
+	std::sort(entries.begin(), entries.end());
+	SmallString<128> tempPath;
+	int FD;
+	if(sys::fs::createUniqueFile(nameMapFile + ".%%%%%%.tmp", FD, tempPath))
+		report_fatal_error(Twine("Could not write the name map ") + nameMapFile);
+	{
+		raw_fd_ostream out(FD, /*shouldClose*/true);
+		for(const auto& entry: entries)
+			out << entry.second << '\t' << entry.first << '\n';
+	}
+	if(sys::fs::rename(tempPath, nameMapFile))
+	{
+		sys::fs::remove(tempPath);
+		report_fatal_error(Twine("Could not write the name map ") + nameMapFile);
+	}
+}
+
 void NameGenerator::generateReadableNames(const Module& M, const GlobalDepsAnalyzer& gda, LinearMemoryHelper& linearHelper)
 {
 	for (const Function & f : M.getFunctionList() )
@@ -667,6 +902,8 @@ void NameGenerator::generateReadableNames(const Module& M, const GlobalDepsAnaly
 	builtins[HANDLE_VAARG] = "handleVAArg";
 	builtins[EXCEPTION] = "$except";
 	builtins[FETCHBUFFER] = "fetchBuffer";
+	builtins[TAIL_CALL] = "cheerpTailCall";
+	builtins[TRAMPOLINE] = "cheerpTrampoline";
 	builtins[STACKPTR] = "__stackPtr";
 	builtins[HEAP8] = "HEAP8";
 	builtins[HEAP16] = "HEAP16";
@@ -684,6 +921,56 @@ bool NameGenerator::needsName(const Instruction & I, const PointerAnalyzer& PA)
 	return !isInlineable(I, PA) && !I.getType()->isVoidTy() && !I.use_empty();
 }
 
+void NameGenerator::printLocalNamesForKey(const Function& F, raw_ostream& os) const
+{
+	for(const Argument& arg: F.args())
+	{
+		auto it = namemap.find(&arg);
+		if(it != namemap.end())
+			os << it->second;
+		auto secondary = secondaryNamemap.find(&arg);
+		if(secondary != secondaryNamemap.end())
+			os << ',' << secondary->second;
+		os << ' ';
+	}
+	os << '\n';
+	uint32_t numRegs = registerize.getRegistersForFunction(&F).size();
+	for(uint32_t regId = 0; regId < numRegs; regId++)
+	{
+		auto it = regNamemap.find(std::make_pair(&F, regId));
+		if(it != regNamemap.end())
+			os << it->second;
+		auto secondary = regSecondaryNamemap.find(std::make_pair(&F, regId));
+		if(secondary != regSecondaryNamemap.end())
+			os << ',' << secondary->second;
+		os << ' ';
+	}
+	os << '\n';
+}
+
+void NameGenerator::printGlobalNamesForKey(raw_ostream& os) const
+{
+	for(const SmallString<4>& name: builtins)
+		os << name << ' ';
+	os << shortestLocalName << '\n';
+	// The maps are keyed by pointer, sort the entries by the printed type
+	for(const auto* map: { &classmap, &constructormap, &arraymap, &resizemap })
+	{
+		std::vector<std::pair<std::string, StringRef>> entries;
+		for(const auto& it: *map)
+		{
+			std::string type;
+			raw_string_ostream typeOs(type);
+			it.first->print(typeOs);
+			entries.push_back(std::make_pair(typeOs.str(), StringRef(it.second)));
+		}
+		std::sort(entries.begin(), entries.end());
+		for(const auto& entry: entries)
+			os << entry.first << '=' << entry.second << ' ';
+		os << '\n';
+	}
+}
+
 std::vector<std::string> buildJsExportedNamesList(const Module& M)
 {
 	std::vector<std::string> names;
@@ -50,6 +50,11 @@
 #include "llvm/IR/InstIterator.h"
 #include "llvm/IR/ValueMap.h"
 #include "llvm/InitializePasses.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/Process.h"
+#include <chrono>
 #include <map>
 #include <unordered_map>
 #include <vector>
@@ -63,6 +68,12 @@ STATISTIC(NumTimesBumbedGlobals, "Number of times a GlobalVariable alignment has
 
 using namespace llvm;
 
+static cl::opt<bool> PartialExecuterBoundedMemory("cheerp-partial-executer-bounded-memory", cl::init(false),
+	cl::desc("Visit the functions in call graph order in PartialExecuter, releasing their state as soon as possible"));
+
+static cl::opt<std::string> PartialExecuterReport("cheerp-partial-executer-report", cl::value_desc("filename"),
+	cl::desc("Append the time and memory used by PartialExecuter for every function to the given file"));
+
 typedef cheerp::DeterministicUnorderedSet<BasicBlock *, cheerp::RestrictionsLifted::NoErasure> DeterministicBBSet;
 typedef llvm::DenseSet<std::pair<GlobalVariable*, uint32_t> > NewAlignmentData;
 
@@ -807,8 +818,11 @@ class ModuleData
 	std::map<const llvm::Function*, FunctionData> functionData;
 
 	void initFunctionData();
+	void visitCallSites(FunctionData& data);
 public:
 	NewAlignmentData alignmentToBeBumped;
+	// Report of the time and memory used for every function, see -cheerp-partial-executer-report
+	llvm::raw_ostream* report {nullptr};
 	bool fail {false};
 	llvm::Module* getModulePtr()
 	{
@@ -858,6 +872,8 @@ public:
 		return currentEE->replaceKnownCEs();
 	}
 	void visitCallSitesOfAllFunctions();
+	void visitCallSitesInCallGraphOrder();
+	size_t getStateSize() const;
 };
 
 class FunctionData
@@ -884,6 +900,13 @@ class FunctionData
 	std::vector<VectorOfArgs> callEquivalentQueue;
 	PartialInterpreter* currentEE;
 
+	// Once the state has been released only the modifications are kept
+	bool released {false};
+	std::vector<std::pair<llvm::BasicBlock*, llvm::BasicBlock*>> edgesToRemove;
+	std::vector<std::pair<llvm::Instruction*, llvm::APInt>> valuesToReplace;
+	uint32_t numExistingEdges {0};
+	uint32_t numVisitedEdges {0};
+
 	VectorOfArgs getArguments(const llvm::CallBase* callBase)
 	{
 		VectorOfArgs args(F.getFunctionType()->getNumParams(), nullptr);
@@ -1124,6 +1147,12 @@ public:
 	}
 	void cleanupBB()
 	{
+		if (released)
+		{
+			for (auto& p : edgesToRemove)
+				removeEdgeBetweenBlocks(p.first, p.second);
+			return;
+		}
 		//Looping on existingEdges guarantee determinism
 		for (auto& p : existingEdges)
 		{
@@ -1133,6 +1162,8 @@ public:
 	}
 	void buildSetOfEdges(Function& function)
 	{
+		if (released)
+			return;
 		// To be deterministic, we can't actually do sorting based on pointers
 		// So we have existingEdges being a vector and filled according to the visit of the function
 		// existingEdgesSet is an helper data structure to filter doubles
@@ -1149,8 +1180,8 @@ public:
 	}
 	bool hasModifications(const bool emitStats) const
 	{
-		const uint32_t numberVisitedEdges = visitedEdges.size();
-		const uint32_t numberExistingEdges = existingEdges.size();
+		const uint32_t numberVisitedEdges = released ? numVisitedEdges : visitedEdges.size();
+		const uint32_t numberExistingEdges = released ? numExistingEdges : existingEdges.size();
 
 		if (numberVisitedEdges < numberExistingEdges)
 		{
@@ -1193,6 +1224,12 @@ public:
 	}
 	void replaceKnownValues() const
 	{
+		if (released)
+		{
+			for(const auto& it: valuesToReplace)
+				it.first->replaceAllUsesWith(llvm::ConstantInt::get(it.first->getType(), it.second));
+			return;
+		}
 		// See if we can replace any instruction with an integer constant,
 		// we can do so if across all executions the inst was never skipped
 		// and always had the same value
@@ -1205,6 +1242,50 @@ public:
 			I->replaceAllUsesWith(CI);
 		}
 	}
+	// Reduce the state to the modifications that will have to be done. The
+	// function must not be visited anymore after this
+	void releaseState()
+	{
+		assert(!released);
+		buildSetOfEdges(F);
+		for (auto& p : existingEdges)
+		{
+			if (visitedEdges.count(p) == 0)
+				edgesToRemove.push_back(p);
+		}
+		for(const auto& kv: knownValues)
+		{
+			if(!kv.second.everSkipped)
+				valuesToReplace.push_back({kv.first, kv.second.value.IntVal});
+		}
+		numExistingEdges = existingEdges.size();
+		numVisitedEdges = visitedEdges.size();
+		existingEdges = {};
+		visitedEdges = {};
+		knownValues = {};
+		visitCounter = {};
+		released = true;
+	}
+	// The call equivalents are needed until all the callees have been visited
+	void releaseCallEquivalents()
+	{
+		callEquivalentQueue = {};
+	}
+	uint32_t getNumCallEquivalents() const
+	{
+		return callEquivalentQueue.size();
+	}
+	// Approximate size of the state kept for this function, in bytes
+	size_t getStateSize() const
+	{
+		size_t size = visitCounter.getMemorySize() + visitedEdges.getMemorySize() + knownValues.getMemorySize();
+		size += existingEdges.capacity() * sizeof(existingEdges[0]);
+		size += edgesToRemove.capacity() * sizeof(edgesToRemove[0]);
+		size += valuesToReplace.capacity() * sizeof(valuesToReplace[0]);
+		for (const VectorOfArgs& args : callEquivalentQueue)
+			size += sizeof(args) + args.capacity() * sizeof(args[0]);
+		return size;
+	}
 };
 
 void ModuleData::initFunctionData()
@@ -1226,10 +1307,114 @@ const FunctionData& ModuleData::getFunctionData(const llvm::Function& F) const
 	return functionData.at(&F);
 }
 
+void ModuleData::visitCallSites(FunctionData& data)
+{
+	if (!report)
+	{
+		data.visitAllCallSites(this);
+		return;
+	}
+	const uint32_t numCallEquivalents = data.getNumCallEquivalents();
+	auto start = std::chrono::steady_clock::now();
+	data.visitAllCallSites(this);
+	std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+	*report << data.getFunction()->getName() << '\t' << format("%.3f", elapsed.count()) << '\t' << numCallEquivalents << '\t';
+	*report << data.getStateSize() << '\t' << sys::Process::GetMallocUsage() << '\n';
+}
+
 void ModuleData::visitCallSitesOfAllFunctions()
 {
 	for(auto& it: functionData)
-		it.second.visitAllCallSites(this);
+		visitCallSites(it.second);
+}
+
+void ModuleData::visitCallSitesInCallGraphOrder()
+{
+	// Collect the distinct direct callees of every function
+	llvm::DenseMap<const llvm::Function*, std::vector<llvm::Function*>> callees;
+	for (Function& F : module)
+	{
+		if (F.isDeclaration())
+			continue;
+		std::vector<Function*>& list = callees[&F];
+		llvm::SmallPtrSet<const Function*, 8> seen;
+		for (Instruction& I : instructions(F))
+		{
+			const CallBase* CB = dyn_cast<CallBase>(&I);
+			Function* callee = CB ? CB->getCalledFunction() : nullptr;
+			if (callee && !callee->isDeclaration() && callee != &F && seen.insert(callee).second)
+				list.push_back(callee);
+		}
+	}
+
+	// Visit the callers first, so that the call sites of a function are final
+	// when it is visited. This is the reverse of a post order visit of the
+	// callees, starting from the functions in module order.
+	std::vector<Function*> order;
+	llvm::DenseSet<const Function*> reached;
+	std::vector<std::pair<Function*, uint32_t>> stack;
+	for (Function& root : module)
+	{
+		if (root.isDeclaration() || !reached.insert(&root).second)
+			continue;
+		stack.push_back({&root, 0});
+		while (!stack.empty())
+		{
+			Function* F = stack.back().first;
+			const std::vector<Function*>& list = callees.find(F)->second;
+			if (stack.back().second < list.size())
+			{
+				Function* next = list[stack.back().second++];
+				if (reached.insert(next).second)
+					stack.push_back({next, 0});
+				continue;
+			}
+			order.push_back(F);
+			stack.pop_back();
+		}
+	}
+	std::reverse(order.begin(), order.end());
+
+	// The call equivalents of a function are needed to resolve the arguments
+	// in the call sites of its callees, so they are kept until those are visited
+	llvm::DenseMap<const llvm::Function*, uint32_t> pendingCallees;
+	llvm::DenseMap<const llvm::Function*, std::vector<llvm::Function*>> callers;
+	for (Function* F : order)
+	{
+		const std::vector<Function*>& list = callees.find(F)->second;
+		pendingCallees[F] = list.size();
+		for (Function* callee : list)
+			callers[callee].push_back(F);
+	}
+	callees.clear();
+
+	llvm::DenseSet<const Function*> visited;
+	for (Function* F : order)
+	{
+		FunctionData& data = getFunctionData(*F);
+		visitCallSites(data);
+		// All the call sites have been visited, only keep the results
+		data.releaseState();
+		visited.insert(F);
+		if (pendingCallees[F] == 0)
+			data.releaseCallEquivalents();
+		auto it = callers.find(F);
+		if (it == callers.end())
+			continue;
+		for (Function* caller : it->second)
+		{
+			if (--pendingCallees[caller] == 0 && visited.count(caller))
+				getFunctionData(*caller).releaseCallEquivalents();
+		}
+	}
+}
+
+size_t ModuleData::getStateSize() const
+{
+	size_t size = 0;
+	for(const auto& it: functionData)
+		size += it.second.getStateSize();
+	return size;
 }
 
 }//cheerp
@@ -1823,13 +2008,37 @@ bool PartialExecuter::runOnModule( llvm::Module & module )
 	if (data.fail)
 		return false;
 
+	std::unique_ptr<raw_fd_ostream> report;
+	if (!PartialExecuterReport.empty())
+	{
+		// Append, since the pass may run more than once in the same pipeline
+		std::error_code EC;
+		report.reset(new raw_fd_ostream(PartialExecuterReport, EC, sys::fs::OF_Append | sys::fs::OF_Text));
+		if (EC)
+		{
+			llvm::errs() << "warning: cannot open PartialExecuter report " << PartialExecuterReport << ": " << EC.message() << "\n";
+			report.reset();
+		}
+		else
+		{
+			*report << "# function\ttime (ms)\tcall equivalents\tstate (bytes)\tmalloc (bytes)\n";
+			data.report = report.get();
+		}
+	}
+
 	// First part: analysis for determining which Edges are never taken
 	for (const Function& F : module)
 	{
 		processFunction(F, data);
 	}
 
-	data.visitCallSitesOfAllFunctions();
+	if (PartialExecuterBoundedMemory)
+		data.visitCallSitesInCallGraphOrder();
+	else
+		data.visitCallSitesOfAllFunctions();
+
+	if (report)
+		*report << "# retained state (bytes)\t" << data.getStateSize() << "\n";
 
 	bool changed = data.replaceKnownCEs();
 
@@ -80,6 +80,7 @@
 #include "llvm/IR/SafepointIRVerifier.h"
 #include "llvm/IR/Verifier.h"
 #include "llvm/IRPrinter/IRPrintingPasses.h"
+#include "llvm/MC/TargetRegistry.h"
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Support/Debug.h"
 #include "llvm/Support/ErrorHandling.h"
@@ -905,6 +906,8 @@ static bool isModulePassName(StringRef Name, CallbacksT &Callbacks) {
     return true;
   if (Name == "coro-cond")
     return true;
+  if (Name == "PartitionedLTO")
+    return true;
 
   // Explicitly handle custom-parsed pass names.
   if (parseRepeatPassName(Name))
@@ -1085,6 +1088,21 @@ PassBuilder::parsePipelineText(StringRef Text) {
   return {std::move(ResultPipeline)};
 }
 
+// Print back a parsed pipeline in the textual format.
+static void
+printPipelineElements(raw_ostream &OS,
+                      ArrayRef<PassBuilder::PipelineElement> Pipeline) {
+  ListSeparator LS(",");
+  for (const auto &E : Pipeline) {
+    OS << LS << E.Name;
+    if (!E.InnerPipeline.empty()) {
+      OS << "(";
+      printPipelineElements(OS, E.InnerPipeline);
+      OS << ")";
+    }
+  }
+}
+
 Error PassBuilder::parseModulePass(ModulePassManager &MPM,
                                    const PipelineElement &E) {
   auto &Name = E.Name;
@@ -1128,6 +1146,58 @@ Error PassBuilder::parseModulePass(ModulePassManager &MPM,
       MPM.addPass(createRepeatedPass(*Count, std::move(NestedMPM)));
       return Error::success();
     }
+    if (Name == "PartitionedLTO") {
+      // The partitions are optimized in different threads and contexts, each
+      // with a PassBuilder of its own. Check the nested pipeline with one
+      // now, since the parsing callbacks of this one are not available there
+      std::string PipelineText;
+      raw_string_ostream OS(PipelineText);
+      printPipelineElements(OS, InnerPipeline);
+      OS.flush();
+      {
+        ModulePassManager NestedMPM;
+        PassBuilder NestedPB(TM, PTO, PGOOpt);
+        if (auto Err = NestedPB.parsePassPipeline(NestedMPM, PipelineText))
+          return Err;
+      }
+      // The instrumentation is only kept when the whole module is optimized
+      // on the calling thread. The standard instrumentations print to shared
+      // streams and keep state across passes, so the worker threads can't
+      // use them. Each partition also gets a TargetMachine of its own, as
+      // targets may build their subtargets lazily
+      TargetMachine *PipelineTM = TM;
+      PassInstrumentationCallbacks *PipelinePIC = PIC;
+      PipelineTuningOptions PipelinePTO = PTO;
+      Optional<PGOOptions> PipelinePGOOpt = PGOOpt;
+      MPM.addPass(cheerp::PartitionedLTOPass(
+          [PipelineTM, PipelinePIC, PipelinePTO, PipelinePGOOpt,
+           PipelineText](Module &M, bool IsPartition) {
+            std::unique_ptr<TargetMachine> PartitionTM;
+            if (IsPartition && PipelineTM)
+              PartitionTM.reset(PipelineTM->getTarget().createTargetMachine(
+                  PipelineTM->getTargetTriple().str(),
+                  PipelineTM->getTargetCPU(),
+                  PipelineTM->getTargetFeatureString(), PipelineTM->Options,
+                  PipelineTM->getRelocationModel(),
+                  PipelineTM->getCodeModel(), PipelineTM->getOptLevel()));
+            LoopAnalysisManager LAM;
+            FunctionAnalysisManager FAM;
+            CGSCCAnalysisManager CGAM;
+            ModuleAnalysisManager MAM;
+            PassBuilder PB(IsPartition ? PartitionTM.get() : PipelineTM,
+                           PipelinePTO, PipelinePGOOpt,
+                           IsPartition ? nullptr : PipelinePIC);
+            PB.registerModuleAnalyses(MAM);
+            PB.registerCGSCCAnalyses(CGAM);
+            PB.registerFunctionAnalyses(FAM);
+            PB.registerLoopAnalyses(LAM);
+            PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+            ModulePassManager PipelineMPM;
+            cantFail(PB.parsePassPipeline(PipelineMPM, PipelineText));
+            PipelineMPM.run(M, MAM);
+          }));
+      return Error::success();
+    }
 
     for (auto &C : ModulePipelineParsingCallbacks)
       if (C(Name, MPM, InnerPipeline))
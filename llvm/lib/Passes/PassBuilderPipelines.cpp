@@ -26,6 +26,7 @@
 #include "llvm/Cheerp/StructMemFuncLowering.h"
 #include "llvm/Cheerp/IdenticalCodeFolding.h"
 #include "llvm/Cheerp/CFGPasses.h"
+#include "llvm/Cheerp/PointerPasses.h"
 #include "llvm/IR/PassManager.h"
 #include "llvm/Passes/OptimizationLevel.h"
 #include "llvm/Passes/PassBuilder.h"
@@ -481,6 +482,11 @@ PassBuilder::buildFunctionSimplificationPipeline(OptimizationLevel Level,
 
   FunctionPassManager FPM;
 
+  // CHEERP: After inlining many genericjs allocations do not escape anymore,
+  // turn them into allocas so that SROA can remove them
+  if (CheerpLTO)
+    FPM.addPass(cheerp::AllocateToAllocaPass());
+
   // Form SSA out of local memory accesses after breaking apart aggregates into
   // scalars.
   FPM.addPass(SROAPass());
@@ -1193,7 +1199,7 @@ void PassBuilder::addVectorPasses(OptimizationLevel Level,
   }
 
   // Optimize parallel scalar instruction chains into SIMD instructions.
-  if (PTO.SLPVectorization) {
+  if (PTO.SLPVectorization || (CheerpLTO && CheerpOptimizeForSpeed)) {
     FPM.addPass(SLPVectorizerPass());
     if (Level.getSpeedupLevel() > 1 && ExtraVectorizerPasses) {
       FPM.addPass(EarlyCSEPass());
@@ -22,6 +22,7 @@
 #include "llvm/IR/Type.h"
 #include "llvm/Analysis/LoopInfo.h"
 #include "llvm/Analysis/PostDominators.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
 #include "llvm/MC/TargetRegistry.h"
 #include "llvm/Cheerp/Writer.h"
 #include "llvm/Cheerp/WasmWriter.h"
@@ -44,6 +45,13 @@ using namespace llvm;
 static cl::opt<bool> VerbosePassManager("cheerp-verbose-pm", cl::init(false), cl::Hidden,
                                cl::desc("Emit verbose informations"));
 
+static cl::opt<std::string> CheerpPasses("cheerp-passes", cl::init(""), cl::Hidden,
+                               cl::value_desc("pipeline"),
+                               cl::desc("Run the given optimization pipeline, in the opt -passes syntax, before the Cheerp backend"));
+
+static cl::opt<bool> CheerpPassesOnly("cheerp-passes-only", cl::init(false), cl::Hidden,
+                               cl::desc("Only run the -cheerp-passes pipeline and write the resulting bitcode"));
+
 extern "C" void LLVMInitializeCheerpBackendTarget() {
   // Register the target.
   RegisterTargetMachine<CheerpTargetMachine> X(TheCheerpBackendTarget);
@@ -66,32 +74,42 @@ namespace {
   };
 } // end anonymous namespace.
 
-bool CheerpWritePass::runOnModule(Module& M)
-{
+namespace {
+// The pass builder and the analysis managers of a pipeline. The link time
+// optimizer and the backend use separate instances
+struct PipelineContext {
   LoopAnalysisManager LAM;
   FunctionAnalysisManager FAM;
   CGSCCAnalysisManager CGAM;
   ModuleAnalysisManager MAM;
-  
   PassInstrumentationCallbacks PIC;
+  StandardInstrumentations SI;
+  PassBuilder PB;
+  std::unique_ptr<TargetLibraryInfoImpl> TLII;
+
+  PipelineContext(Module& M, TargetMachine* TM);
+};
+
+static PrintPassOptions getPrintPassOptions()
+{
   PrintPassOptions PrintPassOpts;
   PrintPassOpts.Indent = VerbosePassManager;
   PrintPassOpts.SkipAnalyses = false;
-  StandardInstrumentations SI(M.getContext(), VerbosePassManager,
-                              /*VerifyEach*/ false, PrintPassOpts);
-  SI.registerCallbacks(PIC, &FAM);
+  return PrintPassOpts;
+}
 
-  llvm::PipelineTuningOptions PTO;
-  Optional<PGOOptions> PGOOpt;
-  PassBuilder PB(TM, PTO, PGOOpt, &PIC);
+PipelineContext::PipelineContext(Module& M, TargetMachine* TM) :
+  SI(M.getContext(), VerbosePassManager, /*VerifyEach*/ false, getPrintPassOptions()),
+  PB(TM, PipelineTuningOptions(), None, &PIC)
+{
+  SI.registerCallbacks(PIC, &FAM);
 
 #define HANDLE_EXTENSION(Ext)                                                  \
   get##Ext##PluginInfo().RegisterPassBuilderCallbacks(PB);
 #include "llvm/Support/Extension.def"
-  
+
   Triple TargetTriple(M.getTargetTriple());
-  std::unique_ptr<TargetLibraryInfoImpl> TLII(
-  new TargetLibraryInfoImpl(TargetTriple));
+  TLII.reset(new TargetLibraryInfoImpl(TargetTriple));
   FAM.registerPass([&] { return TargetLibraryAnalysis(*TLII); });
 
   // Register all the basic analyses with the managers.
@@ -100,6 +118,39 @@ bool CheerpWritePass::runOnModule(Module& M)
   PB.registerFunctionAnalyses(FAM);
   PB.registerLoopAnalyses(LAM);
   PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+}
+} // end anonymous namespace.
+
+bool CheerpWritePass::runOnModule(Module& M)
+{
+  PipelineContext Ctx(M, TM);
+  ModuleAnalysisManager& MAM = Ctx.MAM;
+
+  // Run the link time optimizations in the same process, this saves writing
+  // and parsing the whole program between opt and llc
+  if (!CheerpPasses.empty())
+  {
+    PipelineContext OptCtx(M, TM);
+    ModulePassManager OptMPM;
+    if (Error Err = OptCtx.PB.parsePassPipeline(OptMPM, CheerpPasses))
+      report_fatal_error(Twine("invalid -cheerp-passes pipeline: ") + toString(std::move(Err)));
+    {
+      PrettyStackTraceString CrashInfo("Link time optimizer");
+      llvm::TimeTraceScope TimeScope("Link time optimizer");
+      OptMPM.run(M, OptCtx.MAM);
+    }
+    // The backend builds the Cheerp analyses again from scratch, since its
+    // pipeline lowers the module further. Drop the results of the optimizer,
+    // and the analyzer state they refer to, before its managers go away
+    OptCtx.MAM.clear();
+    cheerp::GlobalDepsAnalysis::release();
+    cheerp::AllocaStoresExtractorAnalysis::release();
+  }
+  if (CheerpPassesOnly)
+  {
+    WriteBitcodeToFile(M, Out);
+    return true;
+  }
 
   ModulePassManager MPM;
    
@@ -133,6 +184,7 @@ bool CheerpWritePass::runOnModule(Module& M)
     // by I64Lowering.
     FPM.addPass(EarlyCSEPass());
     FPM.addPass(cheerp::JSStringLiteralLoweringPass());
+    FPM.addPass(cheerp::DowncastFoldingPass());
     FPM.addPass(cheerp::BitCastLoweringPass());
     FPM.addPass(cheerp::SIMDTransformPass());
     FPM.addPass(cheerp::SIMDLoweringPass());
@@ -144,6 +196,10 @@ bool CheerpWritePass::runOnModule(Module& M)
   }
 
   MPM.addPass(cheerp::FreeAndDeleteRemovalPass());
+  // Run after StructMemFuncLowering, which turns copies of small structs into loads and stores
+  MPM.addPass(cheerp::GlobalScalarReplacementPass());
+  // Generates wasm helpers, which need to be seen by GlobalDepsAnalyzer
+  MPM.addPass(cheerp::ExternRefTableLoweringPass());
   MPM.addPass(cheerp::GlobalDepsAnalyzerPass(mathMode, /*resolveAliases*/true));
   MPM.addPass(cheerp::AllocaLoweringPass());
   MPM.addPass(cheerp::InvokeWrappingPass());
@@ -231,7 +287,7 @@ PreservedAnalyses cheerp::CheerpWritePassImpl::run(Module& M, ModuleAnalysisMana
   std::vector<std::string> reservedNames(ReservedNames.begin(), ReservedNames.end());
   std::sort(reservedNames.begin(), reservedNames.end());
 
-  cheerp::NameGenerator namegen(M, GDA, registerize, PA, linearHelper, reservedNames, PrettyCode, WasmExportedMemory);
+  cheerp::NameGenerator namegen(M, GDA, registerize, PA, linearHelper, reservedNames, PrettyCode, WasmExportedMemory, NameMap);
 
   std::string wasmFile;
   std::string asmjsMemFile;
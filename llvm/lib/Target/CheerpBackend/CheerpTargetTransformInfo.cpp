@@ -120,11 +120,40 @@ void CheerpTTIImpl::getUnrollingPreferences(Loop *L, ScalarEvolution &SE,
   UP.OptSizeThreshold = 0;
   UP.PartialOptSizeThreshold = 0;
 
+  // When optimizing for speed unroll more aggressively, engines do not unroll
+  // wasm loops by themselves and the code size cost is acceptable.
+  if (CheerpOptimizeForSpeed && !L->getHeader()->getParent()->hasOptSize()) {
+    UP.PartialThreshold = 150;
+    UP.MaxCount = 8;
+  }
+
   // Set number of instructions optimized when "back edge"
   // becomes "fall through" to default value of 2.
   UP.BEInsns = 2;
 }
 
+unsigned CheerpTTIImpl::getMaxInterleaveFactor(unsigned VF) const {
+  // Interleaving vectorized loops trades size for instruction level
+  // parallelism, only do it when optimizing for speed
+  if (CheerpOptimizeForSpeed && VF > 1)
+    return 2;
+  return 1;
+}
+
+unsigned CheerpTTIImpl::adjustInliningThreshold(const CallBase *CB) const {
+  if (!CheerpOptimizeForSpeed)
+    return 0;
+  const Function *Callee = CB->getCalledFunction();
+  if (!Callee || Callee->hasOptSize())
+    return 0;
+  // Calls to genericjs functions are expensive compared to the small helpers
+  // (accessors, operators) they usually implement, and inlining them lets
+  // PartialExecuter and SROA see through the objects they manipulate.
+  if (Callee->getSection() != StringRef("asmjs"))
+    return 100;
+  return 0;
+}
+
 bool CheerpTTIImpl::areInlineCompatible(const Function *Caller,
                                              const Function *Callee) const {
   // Allow inlining only when the Callee has a subset of the Caller's
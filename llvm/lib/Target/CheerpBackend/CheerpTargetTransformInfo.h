@@ -57,6 +57,8 @@ public:
   void getUnrollingPreferences(Loop *L, ScalarEvolution &SE,
                                TTI::UnrollingPreferences &UP,
                                OptimizationRemarkEmitter *ORE);
+  unsigned getMaxInterleaveFactor(unsigned VF) const;
+  unsigned adjustInliningThreshold(const CallBase *CB) const;
   bool areInlineCompatible(const Function *Caller,
                            const Function *Callee) const;
 };
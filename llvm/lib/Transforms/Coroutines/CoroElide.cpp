@@ -43,7 +43,7 @@ struct Lowerer : coro::LowererBase {
   Lowerer(Module &M) : LowererBase(M) {}
 
   void elideHeapAllocations(Function *F, uint64_t FrameSize, Align FrameAlign,
-                            AAResults &AA);
+                            Type *FrameTy, AAResults &AA);
   bool shouldElide(Function *F, DominatorTree &DT) const;
   void collectPostSplitCoroIds(Function *F);
   bool processCoroId(CoroIdInst *, AAResults &AA, DominatorTree &DT);
@@ -137,7 +137,8 @@ static std::unique_ptr<raw_fd_ostream> getOrCreateLogFile() {
 // To elide heap allocations we need to suppress code blocks guarded by
 // llvm.coro.alloc and llvm.coro.free instructions.
 void Lowerer::elideHeapAllocations(Function *F, uint64_t FrameSize,
-                                   Align FrameAlign, AAResults &AA) {
+                                   Align FrameAlign, Type *FrameTy,
+                                   AAResults &AA) {
   LLVMContext &C = F->getContext();
   auto *InsertPt =
       getFirstNonAllocaInTheEntryBlock(CoroIds.front()->getFunction());
@@ -159,7 +160,10 @@ void Lowerer::elideHeapAllocations(Function *F, uint64_t FrameSize,
   // here. Possibly we will need to do a mini SROA here and break the coroutine
   // frame into individual AllocaInst recreating the original alignment.
   const DataLayout &DL = F->getParent()->getDataLayout();
-  auto FrameTy = ArrayType::get(Type::getInt8Ty(C), FrameSize);
+  // CHEERP: Memory is typed in genericjs, allocate the frame type itself. The
+  // frame pointer is cast from and to i8* like the one coming from the heap
+  if (DL.isByteAddressable() || !FrameTy)
+    FrameTy = ArrayType::get(Type::getInt8Ty(C), FrameSize);
   auto *Frame = new AllocaInst(FrameTy, DL.getAllocaAddrSpace(), "", InsertPt);
   Frame->setAlignment(FrameAlign);
   auto *FrameVoidPtr =
@@ -353,8 +357,13 @@ bool Lowerer::processCoroId(CoroIdInst *CoroId, AAResults &AA,
   if (ShouldElide) {
     if (auto FrameSizeAndAlign =
             getFrameLayout(cast<Function>(ResumeAddrConstant))) {
+      // CHEERP: The resume function takes a pointer to the frame type
+      Function *Resume = cast<Function>(ResumeAddrConstant);
+      Type *FrameTy = nullptr;
+      if (Resume->arg_size() && !Resume->getArg(0)->getType()->isOpaquePointerTy())
+        FrameTy = Resume->getArg(0)->getType()->getNonOpaquePointerElementType();
       elideHeapAllocations(CoroId->getFunction(), FrameSizeAndAlign->first,
-                           FrameSizeAndAlign->second, AA);
+                           FrameSizeAndAlign->second, FrameTy, AA);
       coro::replaceCoroFree(CoroId, /*Elide=*/true);
       NumOfCoroElided++;
 #ifndef NDEBUG
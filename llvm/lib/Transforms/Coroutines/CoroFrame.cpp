@@ -28,6 +28,7 @@
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/InstIterator.h"
 #include "llvm/IR/IntrinsicInst.h"
+#include "llvm/Support/CommandLine.h"
 #include "llvm/Support/Debug.h"
 #include "llvm/Support/MathExtras.h"
 #include "llvm/Support/OptimizedStructLayout.h"
@@ -45,6 +46,14 @@ using namespace llvm;
 // "coro-frame", which results in leaner debug spew.
 #define DEBUG_TYPE "coro-suspend-crossing"
 
+// CHEERP: Number of destroyed genericjs frames kept for reuse by each coroutine
+static cl::opt<unsigned> CheerpCoroFrameFreeList(
+    "cheerp-coro-frame-freelist", cl::init(4), cl::Hidden,
+    cl::desc("Number of destroyed genericjs coroutine frames kept for reuse "
+             "by each coroutine, 0 disables the reuse. The pointers in a "
+             "released frame are cleared, the other fields of a reused frame "
+             "keep their old values"));
+
 enum { SmallVectorThreshold = 32 };
 
 // Provides two way mapping between the blocks and numbers.
@@ -1524,6 +1533,163 @@ static Instruction *splitBeforeCatchSwitch(CatchSwitchInst *CatchSwitch) {
   return CleanupRet;
 }
 
+// CHEERP: Frames of genericjs coroutines are JS objects. Instead of allocating
+// a new one for every invocation, keep the last few destroyed frames of each
+// coroutine in a global list and reuse them. The coroutine initializes every
+// field before reading it, so a reused frame behaves like a fresh one even if
+// it is not zero initialized. Its pointers are cleared when it is released.
+static GlobalVariable *getOrCreateCheerpFrameFreeList(Module &M,
+                                                      StructType *FrameTy,
+                                                      GlobalVariable *&Count) {
+  std::string Name = (FrameTy->getName() + ".freelist").str();
+  Type *ListTy = ArrayType::get(FrameTy->getPointerTo(), CheerpCoroFrameFreeList);
+  Type *CountTy = Type::getInt32Ty(M.getContext());
+  auto *List = cast<GlobalVariable>(M.getOrInsertGlobal(Name, ListTy, [&] {
+    return new GlobalVariable(M, ListTy, false, GlobalValue::InternalLinkage,
+                              Constant::getNullValue(ListTy), Name);
+  }));
+  Count = cast<GlobalVariable>(M.getOrInsertGlobal(Name + ".count", CountTy, [&] {
+    return new GlobalVariable(M, CountTy, false, GlobalValue::InternalLinkage,
+                              Constant::getNullValue(CountTy), Name + ".count");
+  }));
+  return List;
+}
+
+// Take a frame from the free list when it is not empty, otherwise allocate one
+static Value *createCheerpFrameAllocation(coro::Shape &Shape,
+                                          IRBuilder<> &Builder) {
+  Module *M = Shape.CoroBegin->getModule();
+  StructType *FrameTy = Shape.FrameTy;
+  PointerType *FramePtrTy = FrameTy->getPointerTo();
+  Type *allocate_types[] = { FramePtrTy, FramePtrTy };
+  Function *allocate = Intrinsic::getDeclaration(M,
+                          Intrinsic::cheerp_allocate, allocate_types);
+  auto CreateAllocate = [&]() {
+    CallBase *Alloc = Builder.CreateCall(allocate,
+        { ConstantPointerNull::get(FramePtrTy), Shape.CheerpCoroAlloc->getOperand(0)});
+    Alloc->addParamAttr(0, llvm::Attribute::get(M->getContext(),
+                        llvm::Attribute::ElementType, FrameTy));
+    return Alloc;
+  };
+
+  Builder.SetInsertPoint(Shape.CheerpCoroAlloc);
+  if (CheerpCoroFrameFreeList == 0)
+    return CreateAllocate();
+
+  GlobalVariable *Count = nullptr;
+  GlobalVariable *List = getOrCreateCheerpFrameFreeList(*M, FrameTy, Count);
+  Value *CurCount = Builder.CreateLoad(Builder.getInt32Ty(), Count);
+  Value *HasFree = Builder.CreateICmpNE(CurCount, Builder.getInt32(0));
+  Instruction *ReuseTerm = nullptr, *AllocTerm = nullptr;
+  SplitBlockAndInsertIfThenElse(HasFree, Shape.CheerpCoroAlloc, &ReuseTerm,
+                                &AllocTerm);
+
+  Builder.SetInsertPoint(ReuseTerm);
+  Value *NewCount = Builder.CreateSub(CurCount, Builder.getInt32(1));
+  Builder.CreateStore(NewCount, Count);
+  Value *Slot = Builder.CreateInBoundsGEP(List->getValueType(), List,
+                                          { Builder.getInt32(0), NewCount });
+  Value *Reused = Builder.CreateLoad(FramePtrTy, Slot);
+
+  Builder.SetInsertPoint(AllocTerm);
+  Value *Alloc = CreateAllocate();
+
+  Builder.SetInsertPoint(Shape.CheerpCoroAlloc);
+  PHINode *Frame = Builder.CreatePHI(FramePtrTy, 2);
+  Frame->addIncoming(Reused, ReuseTerm->getParent());
+  Frame->addIncoming(Alloc, AllocTerm->getParent());
+  return Frame;
+}
+
+static bool cheerpTypeContainsPointers(Type *Ty) {
+  if (Ty->isPointerTy())
+    return true;
+  if (auto *ST = dyn_cast<StructType>(Ty))
+    return any_of(ST->elements(), cheerpTypeContainsPointers);
+  if (auto *AT = dyn_cast<ArrayType>(Ty))
+    return cheerpTypeContainsPointers(AT->getElementType());
+  return false;
+}
+
+// Null every pointer in a released frame, so that the frames in the free list
+// don't keep alive the JS objects they referenced (spilled client objects,
+// promise results...)
+static void clearCheerpFramePointers(IRBuilder<> &Builder, StructType *FrameTy,
+                                     Value *Frame, Type *Ty,
+                                     SmallVectorImpl<Value *> &Indices) {
+  if (!cheerpTypeContainsPointers(Ty))
+    return;
+  if (auto *PT = dyn_cast<PointerType>(Ty)) {
+    Value *Addr = Builder.CreateInBoundsGEP(FrameTy, Frame, Indices);
+    Builder.CreateStore(ConstantPointerNull::get(PT), Addr);
+    return;
+  }
+  if (auto *ST = dyn_cast<StructType>(Ty)) {
+    for (unsigned I = 0, E = ST->getNumElements(); I != E; ++I) {
+      Indices.push_back(Builder.getInt32(I));
+      clearCheerpFramePointers(Builder, FrameTy, Frame, ST->getElementType(I),
+                               Indices);
+      Indices.pop_back();
+    }
+    return;
+  }
+  auto *AT = cast<ArrayType>(Ty);
+  for (uint64_t I = 0, E = AT->getNumElements(); I != E; ++I) {
+    Indices.push_back(Builder.getInt32(I));
+    clearCheerpFramePointers(Builder, FrameTy, Frame, AT->getElementType(),
+                             Indices);
+    Indices.pop_back();
+  }
+}
+
+// Put the frame in the free list before it is deallocated. The deallocation is
+// a no-op for genericjs objects, but a user defined operator delete still runs.
+// When the list is full the most recent entry is replaced.
+static void createCheerpFrameRelease(coro::Shape &Shape) {
+  if (CheerpCoroFrameFreeList == 0)
+    return;
+  Function &F = *Shape.CoroBegin->getFunction();
+  SmallVector<CallBase *, 2> Deallocs;
+  for (Instruction &I : instructions(F)) {
+    auto *CF = dyn_cast<CoroFreeInst>(&I);
+    if (!CF)
+      continue;
+    for (User *U : CF->users()) {
+      auto *CB = dyn_cast<CallBase>(U);
+      if (!CB || CB->arg_size() == 0 || CB->getArgOperand(0) != CF)
+        continue;
+      Function *Callee = CB->getCalledFunction();
+      if (Callee && Callee->isIntrinsic() &&
+          Callee->getIntrinsicID() != Intrinsic::cheerp_deallocate)
+        continue;
+      Deallocs.push_back(CB);
+    }
+  }
+  if (Deallocs.empty())
+    return;
+
+  Module &M = *F.getParent();
+  GlobalVariable *Count = nullptr;
+  GlobalVariable *List = getOrCreateCheerpFrameFreeList(M, Shape.FrameTy, Count);
+  IRBuilder<> Builder(F.getContext());
+  for (CallBase *CB : Deallocs) {
+    Builder.SetInsertPoint(CB);
+    Value *Frame = Builder.CreateBitCast(CB->getArgOperand(0),
+                                         Shape.FrameTy->getPointerTo());
+    SmallVector<Value *, 4> Indices = { Builder.getInt32(0) };
+    clearCheerpFramePointers(Builder, Shape.FrameTy, Frame, Shape.FrameTy,
+                             Indices);
+    Value *CurCount = Builder.CreateLoad(Builder.getInt32Ty(), Count);
+    Value *Last = Builder.getInt32(CheerpCoroFrameFreeList - 1);
+    Value *IsFull = Builder.CreateICmpUGE(CurCount, Last);
+    Value *Index = Builder.CreateSelect(IsFull, Last, CurCount);
+    Value *Slot = Builder.CreateInBoundsGEP(List->getValueType(), List,
+                                            { Builder.getInt32(0), Index });
+    Builder.CreateStore(Frame, Slot);
+    Builder.CreateStore(Builder.CreateAdd(Index, Builder.getInt32(1)), Count);
+  }
+}
+
 static void createFramePtr(coro::Shape &Shape) {
   auto *CB = Shape.CoroBegin;
   IRBuilder<> Builder(CB->getNextNode());
@@ -1563,16 +1729,11 @@ static void createFramePtr(coro::Shape &Shape) {
     if (Shape.CheerpCoroAlloc) {
       // CHEERP: Replace cheerp_coro_alloc with cheerp_allocate, now that we know the
       // final frame type
-      Type* allocate_types[] = { FramePtrTy, FramePtrTy };
-      Function* allocate = Intrinsic::getDeclaration(M,
-                              Intrinsic::cheerp_allocate, allocate_types);
-
-      Builder.SetInsertPoint(Shape.CheerpCoroAlloc);
-      CallBase* Alloc = Builder.CreateCall(allocate, { ConstantPointerNull::get(FramePtrTy), Shape.CheerpCoroAlloc->getOperand(0)});
-      Alloc->addParamAttr(0, llvm::Attribute::get(CB->getContext(), llvm::Attribute::ElementType, FrameTy));
+      Value* Alloc = createCheerpFrameAllocation(Shape, Builder);
       Value* BC = Builder.CreateBitCast(Alloc, Builder.getInt8PtrTy());
       Shape.CheerpCoroAlloc->replaceAllUsesWith(BC);
       Shape.CheerpCoroAlloc->eraseFromParent();
+      createCheerpFrameRelease(Shape);
     }
   }
 }
@@ -0,0 +1,6 @@
+target datalayout = "b-e-p:32:32:32-i1:8:8-i8:8:8-i16:16:16-i24:8:8-i32:32:32-i64:64:64-f32:32:32-f64:64:64-a:0:32-f16:16:16-f32:32:32-f64:64:64-n8:16:32-S64"
+target triple = "cheerp-leaningtech-webbrowser-wasm"
+
+define i32 @libfunc() section "asmjs" {
+  ret i32 7
+}
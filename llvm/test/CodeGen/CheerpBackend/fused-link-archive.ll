@@ -0,0 +1,21 @@
+; Check that the fused pipeline links the bitcode members of archives given as
+; -cheerp-link-input, like llvm-link does for libraries found as lib<name>.a.
+
+; RUN: rm -f %t.a
+; RUN: llvm-as %p/Inputs/fused-link-archive-member.ll -o %t.member.bc
+; RUN: llvm-ar rcs %t.a %t.member.bc
+; RUN: llc -cheerp-link-input=%t.a -cheerp-passes-only -o %t.bc < %s
+; RUN: llvm-dis %t.bc -o - | FileCheck %s
+
+; CHECK: define i32 @_start()
+; CHECK: define i32 @libfunc()
+
+target datalayout = "b-e-p:32:32:32-i1:8:8-i8:8:8-i16:16:16-i24:8:8-i32:32:32-i64:64:64-f32:32:32-f64:64:64-a:0:32-f16:16:16-f32:32:32-f64:64:64-n8:16:32-S64"
+target triple = "cheerp-leaningtech-webbrowser-wasm"
+
+declare i32 @libfunc() section "asmjs"
+
+define i32 @_start() section "asmjs" {
+  %r = call i32 @libfunc()
+  ret i32 %r
+}
@@ -0,0 +1,45 @@
+; Check that genericjs copies between an array in a union and a regular typed
+; array are done in bytes. The union member is reached through a DataView, so
+; the element count must be scaled by the element size, and the DataView can't
+; be used as the source of a subarray.
+
+; RUN: llc -opaque-pointers=0 -o - < %s | FileCheck %s
+
+; CHECK-NOT: .buffer)).set(
+; CHECK-DAG: new Int8Array([[D:[a-zA-Z0-9_$.]+]].buffer,[[D]].byteOffset+{{[^)]+}}).set(new Int8Array([[S:[a-zA-Z0-9_$.]+]].buffer,[[S]].byteOffset+{{[^)]+}}*4).subarray(0,16));
+; CHECK-DAG: new Int8Array([[D2:[a-zA-Z0-9_$.]+]].buffer,[[D2]].byteOffset+{{[^)]+}}*4).set(new Int8Array([[S2:[a-zA-Z0-9_$.]+]].buffer,[[S2]].byteOffset+{{[^)]+}}).subarray(0,16));
+; CHECK-NOT: .buffer)).set(
+
+target datalayout = "b-e-p:32:32:32-i1:8:8-i8:8:8-i16:16:16-i24:8:8-i32:32:32-i64:64:64-f32:32:32-f64:64:64-a:0:32-f16:16:16-f32:32:32-f64:64:64-n8:16:32-S64"
+target triple = "cheerp-leaningtech-webbrowser-genericjs"
+
+%union.U = type bytelayout { [4 x i32] }
+
+; std::copy(a, a + 4, u->arr)
+define void @toUnion(%union.U* %u, i32* %a) noinline {
+entry:
+  %d = getelementptr inbounds %union.U, %union.U* %u, i32 0, i32 0, i32 0
+  call void @llvm.memmove.p0i32.p0i32.i32(i32* elementtype(i32) %d, i32* %a, i32 16, i1 false)
+  ret void
+}
+
+; std::copy(u->arr, u->arr + 4, a)
+define void @fromUnion(i32* %a, %union.U* %u) noinline {
+entry:
+  %s = getelementptr inbounds %union.U, %union.U* %u, i32 0, i32 0, i32 0
+  call void @llvm.memmove.p0i32.p0i32.i32(i32* elementtype(i32) %a, i32* %s, i32 16, i1 false)
+  ret void
+}
+
+define void @webMain() {
+entry:
+  %u = alloca %union.U
+  %arr = alloca [4 x i32]
+  %a = getelementptr inbounds [4 x i32], [4 x i32]* %arr, i32 0, i32 0
+  store i32 1, i32* %a
+  call void @toUnion(%union.U* %u, i32* %a)
+  call void @fromUnion(i32* %a, %union.U* %u)
+  ret void
+}
+
+declare void @llvm.memmove.p0i32.p0i32.i32(i32*, i32*, i32, i1)
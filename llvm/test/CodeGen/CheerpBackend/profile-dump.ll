@@ -0,0 +1,43 @@
+; Check that the profile counters survive the -O2 pipeline as a single global,
+; and that the writer emits __cheerpProfileDump for them. GlobalOpt used to
+; split the counters of small programs, dropping them from the metadata.
+
+; RUN: opt -opaque-pointers=0 -passes='InstrProfLowering,GlobalDepsAnalyzer,default<O2>' -S < %s \
+; RUN:   | FileCheck -check-prefix=IR %s
+; RUN: opt -opaque-pointers=0 -passes='InstrProfLowering,GlobalDepsAnalyzer,default<O2>' < %s \
+; RUN:   | llc -cheerp-linear-output=asmjs -o - | FileCheck %s
+
+; IR: @__cheerp_prf_cnts = global [2 x i64] zeroinitializer, section "asmjs"
+; IR-NOT: @__cheerp_prf_cnts.
+; IR: !cheerp_profile_counters = !{![[COUNTERS:[0-9]+]]}
+; IR: ![[COUNTERS]] = !{[2 x i64]* @__cheerp_prf_cnts}
+
+; CHECK: globalThis.__cheerpProfileDump=function(h,ret,i){
+; CHECK: ret+="foo\n# Func Hash:\n1234\n# Num Counters:\n2\n# Counter Values:\n";
+
+target datalayout = "b-e-p:32:32:32-i1:8:8-i8:8:8-i16:16:16-i24:8:8-i32:32:32-i64:64:64-f32:32:32-f64:64:64-a:0:32-f16:16:16-f32:32:32-f64:64:64-n8:16:32-S64"
+target triple = "cheerp-leaningtech-webbrowser-wasm"
+
+@__profn_foo = private constant [3 x i8] c"foo"
+
+declare void @llvm.instrprof.increment(i8*, i64, i32, i32)
+
+define i32 @foo(i32 %x) section "asmjs" {
+entry:
+  call void @llvm.instrprof.increment(i8* getelementptr inbounds ([3 x i8], [3 x i8]* @__profn_foo, i32 0, i32 0), i64 1234, i32 2, i32 0)
+  %cmp = icmp sgt i32 %x, 0
+  br i1 %cmp, label %positive, label %exit
+
+positive:
+  call void @llvm.instrprof.increment(i8* getelementptr inbounds ([3 x i8], [3 x i8]* @__profn_foo, i32 0, i32 0), i64 1234, i32 2, i32 1)
+  br label %exit
+
+exit:
+  %ret = phi i32 [ 1, %positive ], [ 0, %entry ]
+  ret i32 %ret
+}
+
+define void @_start() section "asmjs" {
+  %r = call i32 @foo(i32 3)
+  ret void
+}
@@ -0,0 +1,42 @@
+; Check that the externref table builtins are lowered to the generated slot
+; allocator, and that the wasm module gets an externref table which grows on
+; demand. The allocator compares the objects with null, and fills the new
+; slots with null when the table is grown.
+
+; RUN: llc -opaque-pointers=0 -cheerp-linear-output=wasm -cheerp-wasm-externref \
+; RUN:   -cheerp-secondary-output-file=%t.wasm -o %t.js < %s
+; RUN: od -An -v -tx1 %t.wasm | tr -d '\n' | FileCheck %s
+
+; Table section: one table of externref, with a minimum of 1 slot and no maximum
+; CHECK: 04 04 01 6f 00 01
+; table.grow
+; CHECK-DAG: fc 0f
+; ref.null extern
+; CHECK-DAG: d0 6f
+; ref.is_null
+; CHECK-DAG: d1
+
+target datalayout = "b-e-p:32:32:32-i1:8:8-i8:8:8-i16:16:16-i24:8:8-i32:32:32-i64:64:64-f32:32:32-f64:64:64-a:0:32-f16:16:16-f32:32:32-f64:64:64-n8:16:32-S64"
+target triple = "cheerp-leaningtech-webbrowser-wasm"
+
+%struct.Obj = type { i32 }
+
+@obj = global %struct.Obj zeroinitializer
+
+define %struct.Obj* @roundtrip(%struct.Obj* %o) section "asmjs" {
+entry:
+  %slot = call i32 @llvm.cheerp.externref.table.alloc.p0s_struct.Objs(%struct.Obj* %o)
+  %r = call %struct.Obj* @llvm.cheerp.externref.table.get.p0s_struct.Objs(i32 %slot)
+  call void @llvm.cheerp.externref.table.free(i32 %slot)
+  ret %struct.Obj* %r
+}
+
+define void @webMain() {
+entry:
+  %r = call %struct.Obj* @roundtrip(%struct.Obj* @obj)
+  ret void
+}
+
+declare i32 @llvm.cheerp.externref.table.alloc.p0s_struct.Objs(%struct.Obj*)
+declare %struct.Obj* @llvm.cheerp.externref.table.get.p0s_struct.Objs(i32)
+declare void @llvm.cheerp.externref.table.free(i32)
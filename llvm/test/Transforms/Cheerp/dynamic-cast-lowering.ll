@@ -0,0 +1,54 @@
+; RUN: opt -opaque-pointers=0 -passes=DynamicCastLowering -S < %s | FileCheck %s
+
+; Cheerp type_infos point to the abi vtables through a bitcast of an all-zero
+; index GEP. The class hierarchy is:
+;   A <- B <- C (single inheritance)
+;   F, G <- E   (multiple inheritance)
+
+%struct._ZN10__cxxabiv113__vtable_baseE = type { %class._ZN10__cxxabiv117__class_type_infoE* }
+%class._ZN10__cxxabiv117__class_type_infoE = type opaque
+%class._ZSt9type_info = type opaque
+
+@_ZTVN10__cxxabiv117__class_type_infoE = external global { { %class._ZSt9type_info* } }
+@_ZTVN10__cxxabiv120__si_class_type_infoE = external global { { %class._ZSt9type_info* } }
+@_ZTVN10__cxxabiv121__vmi_class_type_infoE = external global { { %class._ZSt9type_info* } }
+
+@_ZTS1A = constant [3 x i8] c"1A\00"
+@_ZTS1B = constant [3 x i8] c"1B\00"
+@_ZTS1C = constant [3 x i8] c"1C\00"
+@_ZTS1E = constant [3 x i8] c"1E\00"
+@_ZTS1F = constant [3 x i8] c"1F\00"
+@_ZTS1G = constant [3 x i8] c"1G\00"
+
+@_ZTI1A = constant { %struct._ZN10__cxxabiv113__vtable_baseE*, i8* } { %struct._ZN10__cxxabiv113__vtable_baseE* bitcast ({ %class._ZSt9type_info* }* getelementptr inbounds ({ { %class._ZSt9type_info* } }, { { %class._ZSt9type_info* } }* @_ZTVN10__cxxabiv117__class_type_infoE, i32 0, i32 0) to %struct._ZN10__cxxabiv113__vtable_baseE*), i8* getelementptr inbounds ([3 x i8], [3 x i8]* @_ZTS1A, i32 0, i32 0) }
+@_ZTI1B = constant { %struct._ZN10__cxxabiv113__vtable_baseE*, i8*, %class._ZSt9type_info* } { %struct._ZN10__cxxabiv113__vtable_baseE* bitcast ({ %class._ZSt9type_info* }* getelementptr inbounds ({ { %class._ZSt9type_info* } }, { { %class._ZSt9type_info* } }* @_ZTVN10__cxxabiv120__si_class_type_infoE, i32 0, i32 0) to %struct._ZN10__cxxabiv113__vtable_baseE*), i8* getelementptr inbounds ([3 x i8], [3 x i8]* @_ZTS1B, i32 0, i32 0), %class._ZSt9type_info* bitcast ({ %struct._ZN10__cxxabiv113__vtable_baseE*, i8* }* @_ZTI1A to %class._ZSt9type_info*) }
+@_ZTI1C = constant { %struct._ZN10__cxxabiv113__vtable_baseE*, i8*, %class._ZSt9type_info* } { %struct._ZN10__cxxabiv113__vtable_baseE* bitcast ({ %class._ZSt9type_info* }* getelementptr inbounds ({ { %class._ZSt9type_info* } }, { { %class._ZSt9type_info* } }* @_ZTVN10__cxxabiv120__si_class_type_infoE, i32 0, i32 0) to %struct._ZN10__cxxabiv113__vtable_baseE*), i8* getelementptr inbounds ([3 x i8], [3 x i8]* @_ZTS1C, i32 0, i32 0), %class._ZSt9type_info* bitcast ({ %struct._ZN10__cxxabiv113__vtable_baseE*, i8*, %class._ZSt9type_info* }* @_ZTI1B to %class._ZSt9type_info*) }
+@_ZTI1F = constant { %struct._ZN10__cxxabiv113__vtable_baseE*, i8* } { %struct._ZN10__cxxabiv113__vtable_baseE* bitcast ({ %class._ZSt9type_info* }* getelementptr inbounds ({ { %class._ZSt9type_info* } }, { { %class._ZSt9type_info* } }* @_ZTVN10__cxxabiv117__class_type_infoE, i32 0, i32 0) to %struct._ZN10__cxxabiv113__vtable_baseE*), i8* getelementptr inbounds ([3 x i8], [3 x i8]* @_ZTS1F, i32 0, i32 0) }
+@_ZTI1G = constant { %struct._ZN10__cxxabiv113__vtable_baseE*, i8* } { %struct._ZN10__cxxabiv113__vtable_baseE* bitcast ({ %class._ZSt9type_info* }* getelementptr inbounds ({ { %class._ZSt9type_info* } }, { { %class._ZSt9type_info* } }* @_ZTVN10__cxxabiv117__class_type_infoE, i32 0, i32 0) to %struct._ZN10__cxxabiv113__vtable_baseE*), i8* getelementptr inbounds ([3 x i8], [3 x i8]* @_ZTS1G, i32 0, i32 0) }
+@_ZTI1E = constant { %struct._ZN10__cxxabiv113__vtable_baseE*, i8*, i32, i32, { %class._ZSt9type_info*, i32 }, { %class._ZSt9type_info*, i32 } } { %struct._ZN10__cxxabiv113__vtable_baseE* bitcast ({ %class._ZSt9type_info* }* getelementptr inbounds ({ { %class._ZSt9type_info* } }, { { %class._ZSt9type_info* } }* @_ZTVN10__cxxabiv121__vmi_class_type_infoE, i32 0, i32 0) to %struct._ZN10__cxxabiv113__vtable_baseE*), i8* getelementptr inbounds ([3 x i8], [3 x i8]* @_ZTS1E, i32 0, i32 0), i32 0, i32 2, { %class._ZSt9type_info*, i32 } { %class._ZSt9type_info* bitcast ({ %struct._ZN10__cxxabiv113__vtable_baseE*, i8* }* @_ZTI1F to %class._ZSt9type_info*), i32 2 }, { %class._ZSt9type_info*, i32 } { %class._ZSt9type_info* bitcast ({ %struct._ZN10__cxxabiv113__vtable_baseE*, i8* }* @_ZTI1G to %class._ZSt9type_info*), i32 2050 } }
+
+declare i32 @__dynamic_cast_genericjs(i32, %struct._ZN10__cxxabiv113__vtable_baseE*, %class._ZSt9type_info*, %class._ZSt9type_info*, i32)
+
+; dynamic_cast<B*>(A*) can only succeed for a B or a C, at offset 0
+define i32 @castAToB(%struct._ZN10__cxxabiv113__vtable_baseE* %vtable) {
+; CHECK-LABEL: @castAToB(
+; CHECK-NOT: @__dynamic_cast_genericjs
+; CHECK: [[RTTIPTR:%.*]] = getelementptr inbounds %struct._ZN10__cxxabiv113__vtable_baseE, %struct._ZN10__cxxabiv113__vtable_baseE* %vtable, i32 0, i32 0
+; CHECK: [[RTTI:%.*]] = load %class._ZN10__cxxabiv117__class_type_infoE*, %class._ZN10__cxxabiv117__class_type_infoE** [[RTTIPTR]]
+; CHECK: [[ISB:%.*]] = icmp eq %class._ZN10__cxxabiv117__class_type_infoE* [[RTTI]], bitcast ({{.*}}* @_ZTI1B to %class._ZN10__cxxabiv117__class_type_infoE*)
+; CHECK: [[ISC:%.*]] = icmp eq %class._ZN10__cxxabiv117__class_type_infoE* [[RTTI]], bitcast ({{.*}}* @_ZTI1C to %class._ZN10__cxxabiv117__class_type_infoE*)
+; CHECK: [[ISDST:%.*]] = or i1 [[ISB]], [[ISC]]
+; CHECK: [[RES:%.*]] = select i1 [[ISDST]], i32 0, i32 -2147483648
+; CHECK-NOT: @__dynamic_cast_genericjs
+; CHECK: ret i32 [[RES]]
+  %r = call i32 @__dynamic_cast_genericjs(i32 0, %struct._ZN10__cxxabiv113__vtable_baseE* %vtable, %class._ZSt9type_info* bitcast ({ %struct._ZN10__cxxabiv113__vtable_baseE*, i8* }* @_ZTI1A to %class._ZSt9type_info*), %class._ZSt9type_info* bitcast ({ %struct._ZN10__cxxabiv113__vtable_baseE*, i8*, %class._ZSt9type_info* }* @_ZTI1B to %class._ZSt9type_info*), i32 0)
+  ret i32 %r
+}
+
+; E uses multiple inheritance, so the runtime is still needed
+define i32 @castFToE(%struct._ZN10__cxxabiv113__vtable_baseE* %vtable) {
+; CHECK-LABEL: @castFToE(
+; CHECK: call i32 @__dynamic_cast_genericjs(
+  %r = call i32 @__dynamic_cast_genericjs(i32 0, %struct._ZN10__cxxabiv113__vtable_baseE* %vtable, %class._ZSt9type_info* bitcast ({ %struct._ZN10__cxxabiv113__vtable_baseE*, i8* }* @_ZTI1F to %class._ZSt9type_info*), %class._ZSt9type_info* bitcast ({ %struct._ZN10__cxxabiv113__vtable_baseE*, i8*, i32, i32, { %class._ZSt9type_info*, i32 }, { %class._ZSt9type_info*, i32 } }* @_ZTI1E to %class._ZSt9type_info*), i32 -2)
+  ret i32 %r
+}
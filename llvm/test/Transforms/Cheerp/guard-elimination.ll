@@ -0,0 +1,182 @@
+; RUN: opt -opaque-pointers=0 -passes=GuardElimination -S < %s | FileCheck %s
+
+; The guarded initializations below follow what ItaniumCXXABI::EmitGuardedInit
+; emits for function-local statics.
+
+; A self-contained initializer is evaluated, and the guard goes away.
+; CHECK: @_ZZ4foldvE1x = internal global i32 42
+; CHECK-NOT: @_ZGVZ4foldvE1x =
+@_ZZ4foldvE1x = internal global i32 0
+@_ZGVZ4foldvE1x = internal global i32 0
+
+; Every copy of the initialization computes the same value.
+; CHECK: @_ZZ4samevE1x = internal global i32 8
+; CHECK-NOT: @_ZGVZ4samevE1x =
+@_ZZ4samevE1x = internal global i32 0
+@_ZGVZ4samevE1x = internal global i32 0
+
+; One copy has a constant argument propagated into it, the other one depends on
+; the argument at runtime and may run first.
+; CHECK: @_ZZ5multivE1x = internal global i32 0
+; CHECK: @_ZGVZ5multivE1x = internal global i32 0
+@_ZZ5multivE1x = internal global i32 0
+@_ZGVZ5multivE1x = internal global i32 0
+
+; The initializer also writes another global.
+; CHECK: @_ZZ6sidefxvE1x = internal global i32 0
+; CHECK: @_ZGVZ6sidefxvE1x = internal global i32 0
+; CHECK: @counter = global i32 0
+@_ZZ6sidefxvE1x = internal global i32 0
+@_ZGVZ6sidefxvE1x = internal global i32 0
+@counter = global i32 0
+
+declare i32 @__cxa_guard_acquire(i32*)
+declare void @__cxa_guard_release(i32*)
+
+; CHECK-LABEL: define i32 @fold(
+; CHECK-NOT: call i32 @__cxa_guard_acquire
+; CHECK: ret i32
+define i32 @fold() {
+entry:
+  %guard = load i32, i32* @_ZGVZ4foldvE1x
+  %uninit = icmp eq i32 %guard, 0
+  br i1 %uninit, label %init.check, label %init.end
+
+init.check:
+  %acquired = call i32 @__cxa_guard_acquire(i32* @_ZGVZ4foldvE1x)
+  %tobool = icmp ne i32 %acquired, 0
+  br i1 %tobool, label %init, label %init.end
+
+init:
+  %v = mul i32 6, 7
+  store i32 %v, i32* @_ZZ4foldvE1x
+  call void @__cxa_guard_release(i32* @_ZGVZ4foldvE1x)
+  br label %init.end
+
+init.end:
+  %r = load i32, i32* @_ZZ4foldvE1x
+  ret i32 %r
+}
+
+; CHECK-LABEL: define i32 @sameA(
+; CHECK-NOT: call i32 @__cxa_guard_acquire
+; CHECK: ret i32
+define i32 @sameA() {
+entry:
+  %guard = load i32, i32* @_ZGVZ4samevE1x
+  %uninit = icmp eq i32 %guard, 0
+  br i1 %uninit, label %init.check, label %init.end
+
+init.check:
+  %acquired = call i32 @__cxa_guard_acquire(i32* @_ZGVZ4samevE1x)
+  %tobool = icmp ne i32 %acquired, 0
+  br i1 %tobool, label %init, label %init.end
+
+init:
+  %v = shl i32 4, 1
+  store i32 %v, i32* @_ZZ4samevE1x
+  call void @__cxa_guard_release(i32* @_ZGVZ4samevE1x)
+  br label %init.end
+
+init.end:
+  %r = load i32, i32* @_ZZ4samevE1x
+  ret i32 %r
+}
+
+; CHECK-LABEL: define i32 @sameB(
+; CHECK-NOT: call i32 @__cxa_guard_acquire
+; CHECK: ret i32
+define i32 @sameB() {
+entry:
+  %guard = load i32, i32* @_ZGVZ4samevE1x
+  %uninit = icmp eq i32 %guard, 0
+  br i1 %uninit, label %init.check, label %init.end
+
+init.check:
+  %acquired = call i32 @__cxa_guard_acquire(i32* @_ZGVZ4samevE1x)
+  %tobool = icmp ne i32 %acquired, 0
+  br i1 %tobool, label %init, label %init.end
+
+init:
+  %v = mul i32 2, 4
+  store i32 %v, i32* @_ZZ4samevE1x
+  call void @__cxa_guard_release(i32* @_ZGVZ4samevE1x)
+  br label %init.end
+
+init.end:
+  %r = load i32, i32* @_ZZ4samevE1x
+  ret i32 %r
+}
+
+; CHECK-LABEL: define i32 @multiConst(
+; CHECK: call i32 @__cxa_guard_acquire(i32* @_ZGVZ5multivE1x)
+define i32 @multiConst() {
+entry:
+  %guard = load i32, i32* @_ZGVZ5multivE1x
+  %uninit = icmp eq i32 %guard, 0
+  br i1 %uninit, label %init.check, label %init.end
+
+init.check:
+  %acquired = call i32 @__cxa_guard_acquire(i32* @_ZGVZ5multivE1x)
+  %tobool = icmp ne i32 %acquired, 0
+  br i1 %tobool, label %init, label %init.end
+
+init:
+  %v = mul i32 5, 2
+  store i32 %v, i32* @_ZZ5multivE1x
+  call void @__cxa_guard_release(i32* @_ZGVZ5multivE1x)
+  br label %init.end
+
+init.end:
+  %r = load i32, i32* @_ZZ5multivE1x
+  ret i32 %r
+}
+
+; CHECK-LABEL: define i32 @multiArg(
+; CHECK: call i32 @__cxa_guard_acquire(i32* @_ZGVZ5multivE1x)
+define i32 @multiArg(i32 %n) {
+entry:
+  %guard = load i32, i32* @_ZGVZ5multivE1x
+  %uninit = icmp eq i32 %guard, 0
+  br i1 %uninit, label %init.check, label %init.end
+
+init.check:
+  %acquired = call i32 @__cxa_guard_acquire(i32* @_ZGVZ5multivE1x)
+  %tobool = icmp ne i32 %acquired, 0
+  br i1 %tobool, label %init, label %init.end
+
+init:
+  %v = mul i32 %n, 2
+  store i32 %v, i32* @_ZZ5multivE1x
+  call void @__cxa_guard_release(i32* @_ZGVZ5multivE1x)
+  br label %init.end
+
+init.end:
+  %r = load i32, i32* @_ZZ5multivE1x
+  ret i32 %r
+}
+
+; CHECK-LABEL: define i32 @sidefx(
+; CHECK: call i32 @__cxa_guard_acquire(i32* @_ZGVZ6sidefxvE1x)
+; CHECK: store i32 1, i32* @counter
+define i32 @sidefx() {
+entry:
+  %guard = load i32, i32* @_ZGVZ6sidefxvE1x
+  %uninit = icmp eq i32 %guard, 0
+  br i1 %uninit, label %init.check, label %init.end
+
+init.check:
+  %acquired = call i32 @__cxa_guard_acquire(i32* @_ZGVZ6sidefxvE1x)
+  %tobool = icmp ne i32 %acquired, 0
+  br i1 %tobool, label %init, label %init.end
+
+init:
+  store i32 1, i32* @counter
+  store i32 3, i32* @_ZZ6sidefxvE1x
+  call void @__cxa_guard_release(i32* @_ZGVZ6sidefxvE1x)
+  br label %init.end
+
+init.end:
+  %r = load i32, i32* @_ZZ6sidefxvE1x
+  ret i32 %r
+}
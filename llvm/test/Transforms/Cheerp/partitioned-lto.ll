@@ -0,0 +1,63 @@
+; RUN: opt -opaque-pointers=0 -cheerp-lto-partitions=2 -passes='PartitionedLTO(cgscc(inline))' -S < %s \
+; RUN:   | FileCheck %s --implicit-check-not=DICompileUnit
+
+; @first and @helper end up in one partition, and @second imports @helper in
+; the other one. Both inline it, so the promoted @helper is removed once the
+; partitions are merged back, while the promoted @counter gets back its
+; linkage. Unused globals which were never promoted are left alone, and the
+; compile unit listed again by every partition is only kept once.
+
+target datalayout = "b-e-p:32:32:32-i1:8:8-i8:8:8-i16:16:16-i24:8:8-i32:32:32-i64:64:64-f32:32:32-f64:64:64-a:0:32-f16:16:16-f32:32:32-f64:64:64-n8:16:32-S64"
+target triple = "cheerp-leaningtech-webbrowser-wasm"
+
+; CHECK: @counter = internal global i32 0
+; CHECK: @unused = internal global i32 1
+@counter = internal global i32 0
+@unused = internal global i32 1
+
+; CHECK-NOT: @helper
+define internal i32 @helper(i32 %x) !dbg !5 {
+  %v = load i32, i32* @counter
+  %r = add i32 %x, %v
+  ret i32 %r
+}
+
+; CHECK-LABEL: define i32 @first(
+; CHECK-NOT: call
+; CHECK: load i32, i32* @counter
+define i32 @first(i32 %x) !dbg !9 {
+  %r = call i32 @helper(i32 %x), !dbg !10
+  ret i32 %r
+}
+
+; CHECK-LABEL: define i32 @second(
+; CHECK-NOT: call
+; CHECK: load i32, i32* @counter
+define i32 @second(i32 %x) !dbg !11 {
+  %y = mul i32 %x, 3
+  %r = call i32 @helper(i32 %y), !dbg !12
+  ret i32 %r
+}
+
+; CHECK-NOT: @helper
+; CHECK: !llvm.dbg.cu = !{![[CU:[0-9]+]]}
+; CHECK: ![[CU]] = distinct !DICompileUnit(
+; CHECK-DAG: !DISubprogram(name: "first",{{.*}} unit: ![[CU]]
+; CHECK-DAG: !DISubprogram(name: "second",{{.*}} unit: ![[CU]]
+
+!llvm.dbg.cu = !{!0}
+!llvm.module.flags = !{!3, !4}
+
+!0 = distinct !DICompileUnit(language: DW_LANG_C99, file: !1, producer: "clang", isOptimized: true, runtimeVersion: 0, emissionKind: FullDebug, enums: !2)
+!1 = !DIFile(filename: "partitioned-lto.c", directory: "/")
+!2 = !{}
+!3 = !{i32 2, !"Dwarf Version", i32 4}
+!4 = !{i32 2, !"Debug Info Version", i32 3}
+!5 = distinct !DISubprogram(name: "helper", scope: !1, file: !1, line: 1, type: !6, scopeLine: 1, spFlags: DISPFlagLocalToUnit | DISPFlagDefinition | DISPFlagOptimized, unit: !0, retainedNodes: !2)
+!6 = !DISubroutineType(types: !7)
+!7 = !{!8, !8}
+!8 = !DIBasicType(name: "int", size: 32, encoding: DW_ATE_signed)
+!9 = distinct !DISubprogram(name: "first", scope: !1, file: !1, line: 5, type: !6, scopeLine: 5, spFlags: DISPFlagDefinition | DISPFlagOptimized, unit: !0, retainedNodes: !2)
+!10 = !DILocation(line: 6, column: 10, scope: !9)
+!11 = distinct !DISubprogram(name: "second", scope: !1, file: !1, line: 9, type: !6, scopeLine: 9, spFlags: DISPFlagDefinition | DISPFlagOptimized, unit: !0, retainedNodes: !2)
+!12 = !DILocation(line: 10, column: 10, scope: !11)
@@ -0,0 +1,3 @@
+define i32 @hook() {
+  ret i32 2
+}
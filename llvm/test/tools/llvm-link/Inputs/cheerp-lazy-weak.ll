@@ -0,0 +1,3 @@
+define weak i32 @hook() {
+  ret i32 1
+}
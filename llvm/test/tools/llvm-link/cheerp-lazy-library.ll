@@ -0,0 +1,30 @@
+; Check that a strong definition from a later lazy library overrides a weak
+; one, as it would with an eager link, and that the functions SimplifyLibCalls
+; may rewrite printf into are only kept when printf is used.
+
+; RUN: llvm-as %p/Inputs/cheerp-lazy-weak.ll -o %t.weak.bc
+; RUN: llvm-as %p/Inputs/cheerp-lazy-strong.ll -o %t.strong.bc
+; RUN: llvm-as %p/Inputs/cheerp-lazy-stdio.ll -o %t.stdio.bc
+; RUN: llvm-link -S %s -lazy-library=%t.weak.bc -lazy-library=%t.strong.bc \
+; RUN:   -lazy-library=%t.stdio.bc | FileCheck %s
+; RUN: llvm-link -S %s -lazy-library=%t.weak.bc -lazy-library=%t.strong.bc \
+; RUN:   -lazy-library=%t.stdio.bc -lazy-root=printf \
+; RUN:   | FileCheck -check-prefix=PRINTF --implicit-check-not=@fwrite %s
+
+; CHECK: define i32 @hook()
+; CHECK-NEXT: ret i32 2
+; CHECK-NOT: @printf
+; CHECK-NOT: @puts
+; CHECK-NOT: @putchar
+
+; PRINTF-DAG: define i32 @hook()
+; PRINTF-DAG: define i32 @printf(
+; PRINTF-DAG: define i32 @puts(
+; PRINTF-DAG: define i32 @putchar(
+
+declare i32 @hook()
+
+define i32 @main() {
+  %r = call i32 @hook()
+  ret i32 %r
+}
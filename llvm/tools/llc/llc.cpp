@@ -16,6 +16,8 @@
 #include "llvm/ADT/ScopeExit.h"
 #include "llvm/ADT/Triple.h"
 #include "llvm/Analysis/TargetLibraryInfo.h"
+#include "llvm/BinaryFormat/Magic.h"
+#include "llvm/Cheerp/LazyLinker.h"
 #include "llvm/CodeGen/CommandFlags.h"
 #include "llvm/CodeGen/LinkAllAsmWriterComponents.h"
 #include "llvm/CodeGen/LinkAllCodegenComponents.h"
@@ -35,9 +37,11 @@
 #include "llvm/IR/Verifier.h"
 #include "llvm/IRReader/IRReader.h"
 #include "llvm/InitializePasses.h"
+#include "llvm/Linker/Linker.h"
 #include "llvm/MC/MCTargetOptionsCommandFlags.h"
 #include "llvm/MC/SubtargetFeature.h"
 #include "llvm/MC/TargetRegistry.h"
+#include "llvm/Object/Archive.h"
 #include "llvm/Pass.h"
 #include "llvm/Remarks/HotnessThresholdParser.h"
 #include "llvm/Support/CommandLine.h"
@@ -189,6 +193,27 @@ static cl::opt<std::string> RemarksFormat(
     cl::desc("The format used for serializing remarks (default: YAML)"),
     cl::value_desc("format"), cl::init("yaml"));
 
+// Cheerp: link the whole program in the same process that compiles it, so
+// that the IR is never serialized between the link, optimization and code
+// generation steps.
+static cl::list<std::string>
+    CheerpLinkInputs("cheerp-link-input",
+                     cl::desc("Link the given bitcode file into the input "
+                              "module before compiling it"),
+                     cl::value_desc("filename"));
+
+static cl::list<std::string>
+    CheerpLazyLibraries("cheerp-lazy-library",
+                        cl::desc("Only link the definitions of the given "
+                                 "bitcode library or archive that are needed"),
+                        cl::value_desc("filename"));
+
+static cl::list<std::string>
+    CheerpLazyRoots("cheerp-lazy-root", cl::CommaSeparated,
+                    cl::desc("Symbols that are always pulled from the "
+                             "-cheerp-lazy-library inputs"),
+                    cl::value_desc("symbol"));
+
 namespace {
 
 std::vector<std::string> &getRunPassNames() {
@@ -235,6 +260,75 @@ static int compileModule(char **, LLVMContext &);
   llvm_unreachable("reportError() should not return");
 }
 
+/// Link every bitcode member of an archive, like llvm-link does for the
+/// archives among its inputs.
+static void linkCheerpArchive(LLVMContext &Context, Linker &L,
+                              MemoryBufferRef Buffer) {
+  StringRef ArchiveName = Buffer.getBufferIdentifier();
+  Expected<std::unique_ptr<object::Archive>> ArchiveOrErr =
+      object::Archive::create(Buffer);
+  if (!ArchiveOrErr)
+    reportError(ArchiveOrErr.takeError(), ArchiveName);
+  Error Err = Error::success();
+  for (const object::Archive::Child &C : (*ArchiveOrErr)->children(Err)) {
+    Expected<MemoryBufferRef> MemBuf = C.getMemoryBufferRef();
+    if (!MemBuf)
+      reportError(MemBuf.takeError(), ArchiveName);
+    SMDiagnostic ParseErr;
+    std::unique_ptr<Module> Member = getLazyIRModule(
+        MemoryBuffer::getMemBuffer(*MemBuf, false), ParseErr, Context);
+    if (!Member)
+      reportError(ParseErr.getMessage(), ArchiveName);
+    if (Error E = Member->materializeMetadata())
+      reportError(std::move(E), ArchiveName);
+    UpgradeDebugInfo(*Member);
+    if (L.linkInModule(std::move(Member)))
+      reportError("cannot link archive member", ArchiveName);
+  }
+  if (Err)
+    reportError(std::move(Err), ArchiveName);
+}
+
+/// Link the -cheerp-link-input and -cheerp-lazy-library inputs into \p M, the
+/// same way llvm-link does when running the separate link step.
+static void linkCheerpInputs(LLVMContext &Context, Module &M) {
+  Linker L(M);
+  for (const auto &File : CheerpLinkInputs) {
+    ErrorOr<std::unique_ptr<MemoryBuffer>> Buffer =
+        MemoryBuffer::getFileOrSTDIN(File);
+    if (!Buffer)
+      reportError(errorCodeToError(Buffer.getError()), File);
+    // Libraries found as lib<name>.a are archives of bitcode files
+    if (identify_magic((*Buffer)->getBuffer()) == file_magic::archive) {
+      linkCheerpArchive(Context, L, (*Buffer)->getMemBufferRef());
+      continue;
+    }
+    SMDiagnostic Err;
+    std::unique_ptr<Module> Input =
+        getLazyIRModule(std::move(*Buffer), Err, Context);
+    if (!Input)
+      reportError(Err.getMessage(), File);
+    if (Error E = Input->materializeMetadata())
+      reportError(std::move(E), File);
+    UpgradeDebugInfo(*Input);
+    if (L.linkInModule(std::move(Input)))
+      reportError("cannot link file", File);
+  }
+  if (CheerpLazyLibraries.empty())
+    return;
+  cheerp::LazyLibraryLinker LazyLinker(Context, M);
+  for (const auto &File : CheerpLazyLibraries) {
+    ErrorOr<std::unique_ptr<MemoryBuffer>> Buffer =
+        MemoryBuffer::getFileOrSTDIN(File);
+    if (!Buffer)
+      reportError(errorCodeToError(Buffer.getError()), File);
+    if (Error E = LazyLinker.addLibrary(std::move(*Buffer)))
+      reportError(std::move(E), File);
+  }
+  if (Error E = LazyLinker.link(L, CheerpLazyRoots))
+    reportError(std::move(E), InputFilename);
+}
+
 static std::unique_ptr<ToolOutputFile> GetOutputStream(const char *TargetName,
                                                        Triple::OSType OS,
                                                        const char *ProgName) {
@@ -571,6 +665,8 @@ static int compileModule(char **argv, LLVMContext &Context) {
       Err.print(argv[0], WithColor::error(errs(), argv[0]));
       return 1;
     }
+    if (!CheerpLinkInputs.empty() || !CheerpLazyLibraries.empty())
+      linkCheerpInputs(Context, *M);
     if (!TargetTriple.empty())
       M->setTargetTriple(Triple::normalize(TargetTriple));
 
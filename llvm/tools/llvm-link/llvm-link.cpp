@@ -15,6 +15,7 @@
 #include "llvm/BinaryFormat/Magic.h"
 #include "llvm/Bitcode/BitcodeReader.h"
 #include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/Cheerp/LazyLinker.h"
 #include "llvm/IR/AutoUpgrade.h"
 #include "llvm/IR/DiagnosticInfo.h"
 #include "llvm/IR/DiagnosticPrinter.h"
@@ -129,6 +130,18 @@ static cl::opt<bool> IgnoreNonBitcode(
     cl::desc("Do not report an error for non-bitcode files in archives"),
     cl::Hidden);
 
+static cl::list<std::string> LazyLibraries(
+    "lazy-library", cl::value_desc("filename"),
+    cl::desc("Bitcode library or archive linked on demand: only the "
+             "definitions reachable from the other inputs are linked in"),
+    cl::cat(LinkCategory));
+
+static cl::list<std::string>
+    LazyRoots("lazy-root", cl::value_desc("symbol"), cl::CommaSeparated,
+              cl::desc("Symbol resolved from the lazy libraries even if no "
+                       "input references it"),
+              cl::cat(LinkCategory));
+
 static ExitOnError ExitOnErr;
 
 // Read the specified bitcode file in and return it. This routine searches the
@@ -452,6 +465,30 @@ static bool linkFiles(const char *argv0, LLVMContext &Context, Linker &L,
   return true;
 }
 
+/// Link the -lazy-library inputs, only pulling the definitions needed by the
+/// modules linked so far.
+static bool linkLazyLibraries(const char *argv0, LLVMContext &Context,
+                              Linker &L, Module &Composite) {
+  if (LazyLibraries.empty())
+    return true;
+  cheerp::LazyLibraryLinker LazyLinker(Context, Composite, Verbose,
+                                       IgnoreNonBitcode);
+  for (const auto &File : LazyLibraries) {
+    std::unique_ptr<MemoryBuffer> Buffer =
+        ExitOnErr(errorOrToExpected(MemoryBuffer::getFileOrSTDIN(File)));
+    if (Error E = LazyLinker.addLibrary(std::move(Buffer))) {
+      logAllUnhandledErrors(std::move(E), WithColor::error(errs(), argv0),
+                            "loading file '" + File + "': ");
+      return false;
+    }
+  }
+  if (Error E = LazyLinker.link(L, LazyRoots)) {
+    logAllUnhandledErrors(std::move(E), WithColor::error(errs(), argv0));
+    return false;
+  }
+  return true;
+}
+
 int main(int argc, char **argv) {
   InitLLVM X(argc, argv);
   ExitOnErr.setBanner(std::string(argv[0]) + ": ");
@@ -482,6 +519,10 @@ int main(int argc, char **argv) {
                  Flags | Linker::Flags::OverrideFromSrc))
     return 1;
 
+  // Then resolve the undefined symbols from the -lazy-library ones
+  if (!linkLazyLibraries(argv[0], Context, L, *Composite))
+    return 1;
+
   // Import any functions requested via -import
   if (!importFunctions(argv[0], *Composite))
     return 1;